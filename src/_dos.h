@@ -29,6 +29,7 @@
 #define PLATFORM_SETFILETYPE_CBM(a)
 #define PLATFORM_SETFILETYPE_PLAIN(a)
 #define PLATFORM_SETFILETYPE_HEX(a)
+#define PLATFORM_SETFILETYPE_SREC(a)
 #define PLATFORM_SETFILETYPE_TEXT(a)
 
 // platform specific message output
@@ -29,6 +29,8 @@
 #define PLATFORM_SETFILETYPE_CBM(a)	RISCOS_set_filetype(a, 0x064)
 #define PLATFORM_SETFILETYPE_PLAIN(a)	RISCOS_set_filetype(a, 0xffd)
 #define PLATFORM_SETFILETYPE_TEXT(a)	RISCOS_set_filetype(a, 0xfff)
+#define PLATFORM_SETFILETYPE_HEX(a)	RISCOS_set_filetype(a, 0xfff)
+#define PLATFORM_SETFILETYPE_SREC(a)	RISCOS_set_filetype(a, 0xfff)
 
 // platform specific message output
 #define PLATFORM_WARNING(a)		RISCOS_throwback(a, 0)
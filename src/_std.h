@@ -27,6 +27,7 @@
 #define PLATFORM_SETFILETYPE_PLAIN(a)
 #define PLATFORM_SETFILETYPE_TEXT(a)
 #define PLATFORM_SETFILETYPE_HEX(a)
+#define PLATFORM_SETFILETYPE_SREC(a)
 
 // platform specific message output
 #define PLATFORM_WARNING(a)
@@ -15,24 +15,32 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "acme.h"
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "alu.h"
+#include "batch.h"
 #include "cliargs.h"
 #include "config.h"
 #include "cpu.h"
+#include "depgraph.h"
 #include "dynabuf.h"
 #include "encoding.h"
 #include "flow.h"
 #include "global.h"
 #include "input.h"
 #include "macro.h"
+#include "memstats.h"
 #include "mnemo.h"
 #include "output.h"
+#include "passes.h"
 #include "platform.h"
+#include "profile.h"
 #include "pseudoopcodes.h"
+#include "replay.h"
 #include "section.h"
+#include "server.h"
 #include "symbol.h"
 #include "version.h"
 
@@ -45,6 +53,12 @@ static const char	name_outfile[]		= "output filename";
 static const char	arg_symbollist[]	= "symbol list filename";
 static const char	arg_reportfile[]	= "report filename";
 static const char	arg_vicelabels[]	= "VICE labels filename";
+static const char	arg_variants[]		= "variants filename";
+static const char	arg_batch[]		= "job filename";
+static const char	arg_server[]		= "socket filename";
+static const char	arg_warmstart[]		= "warm start filename";
+static const char	arg_trace[]		= "trace filename";
+static const char	arg_lineprofile[]	= "line profile filename";
 // long options
 #define OPTION_HELP		"help"
 #define OPTION_FORMAT		"format"
@@ -67,6 +81,17 @@ static const char	arg_vicelabels[]	= "VICE labels filename";
 #define OPTION_STRICT_SEGMENTS	"strict-segments"
 #define OPTION_DIALECT		"dialect"
 #define OPTION_TEST		"test"
+#define OPTION_VARIANTS		"variants"
+#define OPTION_BATCH		"batch"
+#define OPTION_JOBS		"jobs"
+#define OPTION_SERVER		"server"
+#define OPTION_CLIENT		"client"
+#define OPTION_WARM_START	"warm-start"
+#define OPTION_PASS_REPORT	"pass-report"
+#define OPTION_STATS		"stats"
+#define OPTION_TRACE		"trace"
+#define OPTION_LINE_PROFILE	"line-profile"
+#define OPTION_MEM_STATS	"mem-stats"
 // options for "-W"
 #define OPTIONWNO_LABEL_INDENT	"no-label-indent"
 #define OPTIONWNO_OLD_FOR	"no-old-for"
@@ -81,14 +106,36 @@ static int		toplevel_src_count	= 0;
 static signed long	start_address		= ILLEGAL_START_ADDRESS;
 static signed long	fill_value		= MEMINIT_USE_DEFAULT;
 static const struct cpu_type	*default_cpu	= NULL;
-const char		*symbollist_filename	= NULL;
 const char		*vicelabels_filename	= NULL;
-const char		*output_filename	= NULL;
-const char		*report_filename	= NULL;
-// maximum recursion depth for macro calls and "!source"
-signed long	macro_recursions_left	= MAX_NESTING;
-signed long	source_recursions_left	= MAX_NESTING;
-
+static const char	*variants_filename	= NULL;
+static const char	*batch_filename		= NULL;
+static signed long	batch_jobs		= 0;	// zero means one per CPU core
+static const char	*server_socket		= NULL;
+static const char	*warmstart_filename	= NULL;	// symbol values of previous build
+static boolean		have_seeds		= FALSE;	// values have been read
+static boolean		warm_pass		= FALSE;	// first pass is using them
+static jmp_buf		warm_jump;	// where to go when warm start pass fails
+static	STRUCT_DYNABUF_REF(warm_messages, 1024);	// messages of warm start pass
+static boolean		serving			= FALSE;	// in server mode, errors end the request, not the program
+static jmp_buf		request_jump;	// where to go when request ends early
+static int		request_exit_code;
+static const char	*program_name		= "acme";
+// "-D" definitions given on command line (re-applied for each build variant)
+static const char	**cli_definitions	= NULL;
+static int		cli_definition_count	= 0;
+#define VARIANT_LINE_MAX	1024	// maximum length of line in variants file
+#define VARIANT_SEPARATORS	" \t\r\n"
+
+
+// end program (or, in server mode, end current request)
+static void quit(int exit_code)
+{
+	if (serving) {
+		request_exit_code = exit_code;
+		longjmp(request_jump, 1);
+	}
+	exit(exit_code);
+}
 
 // show release and platform info (and exit, if wanted)
 static void show_version(int exit_after)
@@ -97,7 +144,7 @@ static void show_version(int exit_after)
 "This is ACME, release " RELEASE " (\"" CODENAME "\"), " CHANGE_DATE " " CHANGE_YEAR "\n"
 "  " PLATFORM_VERSION);
 	if (exit_after)
-		exit(EXIT_SUCCESS);
+		quit(EXIT_SUCCESS);
 }
 
 
@@ -136,6 +183,17 @@ static void show_help_and_exit(void)
 "      --" OPTION_MAXDEPTH " NUMBER  set recursion depth for macro calls and !src\n"
 "      --" OPTION_IGNORE_ZEROES "    do not determine number size by leading zeroes\n"
 "      --" OPTION_STRICT_SEGMENTS "  turn segment overlap warnings into errors\n"
+"      --" OPTION_VARIANTS " FILE    assemble each build variant listed in file\n"
+"      --" OPTION_BATCH " FILE       run assembly jobs listed in file\n"
+"      --" OPTION_JOBS " NUMBER      set number of batch jobs to run at a time\n"
+"      --" OPTION_WARM_START " FILE  start from symbol values of previous build\n"
+"      --" OPTION_PASS_REPORT "      show which forward references caused further passes\n"
+"      --" OPTION_STATS "            show where assembling took its time\n"
+"      --" OPTION_TRACE " FILE       write timeline in Chrome trace event format\n"
+"      --" OPTION_LINE_PROFILE " FILE  write statement count and time of each line as CSV\n"
+"      --" OPTION_MEM_STATS "        show memory use of each category and pass\n"
+"      --" OPTION_SERVER " SOCKET    stay resident and serve requests on socket\n"
+"      --" OPTION_CLIENT " SOCKET ... let server assemble (must be first option)\n"
 "  -vDIGIT                set verbosity level\n"
 "  -DSYMBOL=VALUE         define global symbol\n"
 "  -I PATH/TO/DIR         add search path for input files\n"
@@ -154,35 +212,32 @@ static void show_help_and_exit(void)
 "      --" OPTION_TEST "             enable experimental features\n"
 PLATFORM_OPTION_HELP
 "  -V, --" OPTION_VERSION "          show version and exit\n");
-	exit(EXIT_SUCCESS);
+	quit(EXIT_SUCCESS);
 }
 
 
-// initialise report struct
-static void report_init(struct report *report)
+// initialise report struct. the report is collected in memory during each
+// pass, so it can be written after the final pass without doing another one.
+static	STRUCT_DYNABUF_REF(report_text, 4096);	// report of current pass
+static void report_init(struct report *report, boolean wanted)
 {
-	report->fd = NULL;
+	report->text = wanted ? report_text : NULL;
 	report->asc_used = 0;
 	report->bin_used = 0;
 	report->last_input = NULL;
 }
-// open report file
-static int report_open(struct report *report, const char *filename)
+// write report of final pass to file
+static void report_save(struct report *report, const char *filename)
 {
-	report->fd = fopen(filename, FILE_WRITETEXT);
-	if (report->fd == NULL) {
+	FILE	*fd;
+
+	fd = fopen(filename, FILE_WRITETEXT);
+	if (fd == NULL) {
 		fprintf(stderr, "Error: Cannot open report file \"%s\".\n", filename);
-		return 1;
-	}
-	return 0;	// success
-}
-// close report file
-static void report_close(struct report *report)
-{
-	if (report && report->fd) {
-		fclose(report->fd);
-		report->fd = NULL;
+		return;
 	}
+	fwrite(report->text->buffer, report->text->size, 1, fd);
+	fclose(fd);
 }
 
 
@@ -193,7 +248,6 @@ int ACME_finalize(int exit_code)
 {
 	FILE	*fd;
 
-	report_close(report);
 	if (symbollist_filename) {
 		fd = fopen(symbollist_filename, FILE_WRITETEXT);	// FIXME - what if filename is given via !sl in sub-dir? fix path!
 		if (fd) {
@@ -216,17 +270,41 @@ int ACME_finalize(int exit_code)
 			exit_code = EXIT_FAILURE;
 		}
 	}
+	depgraph_report(stdout);	// if wanted
+	profile_report(stdout);	// if wanted
+	memstats_report(stdout);	// if wanted
 	return exit_code;
 }
+// exit after writing symbol list (called on serious errors)
+static void exit_after_finalize(void)
+{
+	quit(ACME_finalize(EXIT_FAILURE));
+}
 
 
 // save output file
 static void save_output_file(void)
 {
 	FILE	*fd;
-
+	int	ii,
+		ranges	= outputfile_range_count();
+
+	// write additional output files ("!to" with address range)
+	for (ii = 0; ii < ranges; ++ii) {
+		fd = fopen(outputfile_range_name(ii), FILE_WRITEBINARY);
+		if (fd == NULL) {
+			fprintf(stderr, "Error: Cannot open output file \"%s\".\n",
+				outputfile_range_name(ii));
+			continue;
+		}
+		Output_save_range(ii, fd);
+		fclose(fd);
+	}
 	// if no output file chosen, tell user and do nothing
 	if (output_filename == NULL) {
+		if (ranges)
+			return;
+
 		fputs("No output file specified (use the \"-o\" option or the \"!to\" pseudo opcode).\n", stderr);
 		return;
 	}
@@ -241,43 +319,68 @@ static void save_output_file(void)
 }
 
 
-// increment pass number and perform a single pass
-static void perform_pass(void)
+// called by pass driver if toplevel file could not be loaded
+static void cannot_open(const char *name)
 {
-	FILE	*fd;
-	int	ii;
-
-	++pass.number;
-	// call modules' "pass init" functions
-	Output_passinit();	// disable output, PC undefined
-	cputype_passinit(default_cpu);	// set default cpu type
-	// if start address was given on command line, use it:
-	if (start_address != ILLEGAL_START_ADDRESS)
-		vcpu_set_pc(start_address, 0);
-	encoding_passinit();	// set default encoding
-	section_passinit();	// set initial zone (untitled)
-	// init variables
-	pass.undefined_count = 0;
-	//pass.needvalue_count = 0;	FIXME - use
-	pass.error_count = 0;
-	// Process toplevel files
-	for (ii = 0; ii < toplevel_src_count; ++ii) {
-		if ((fd = fopen(toplevel_sources[ii], FILE_READBINARY))) {
-			flow_parse_and_close_file(fd, toplevel_sources[ii]);
-		} else {
-			fprintf(stderr, "Error: Cannot open toplevel file \"%s\".\n", toplevel_sources[ii]);
-			if (toplevel_sources[ii][0] == '-')
-				fprintf(stderr, "Options (starting with '-') must be given _before_ source files!\n");
- 			++pass.error_count;
-		}
+	if (warm_pass)
+		return;	// will be repeated anyway
+
+	fprintf(stderr, "Error: Cannot open toplevel file \"%s\".\n", name);
+	if (name[0] == '-')
+		fprintf(stderr, "Options (starting with '-') must be given _before_ source files!\n");
+}
+
+
+// called on serious errors during warm start pass
+static void abort_warm_pass(void)
+{
+	longjmp(warm_jump, 1);
+}
+
+
+// prototype for restarting after failed warm start pass
+static void define_symbol(const char definition[]);
+// first pass of warm start: forward references to global symbols use the
+// values of the previous build. the pass is only accepted if there were no
+// errors and all those values turned out to be correct. otherwise all state
+// is reset and FALSE is returned, so the caller can start from scratch.
+// (its messages are held back until then, because a cold start repeats them)
+static boolean perform_warm_pass(struct assembly *assembly)
+{
+	void			(*outer_abort)(void)	= abort_assembly;
+	volatile boolean	accepted		= FALSE;	// (must survive longjmp())
+	int			ii;
+
+	DYNABUF_CLEAR(warm_messages);
+	config.msg_dynabuf = warm_messages;
+	abort_assembly = abort_warm_pass;
+	warm_pass = TRUE;
+	symbols_use_seeds(TRUE);
+	if (setjmp(warm_jump) == 0) {
+		passes_perform(assembly);
+		accepted = (pass.error_count == 0) && symbols_seeds_confirmed();
+	} else {
+		// pass was aborted, so forget about unfinished blocks
+		flow_abort();
 	}
-	Output_end_segment();
-/*	TODO:
-	if --save-start is given, parse arg string
-	if --save-limit is given, parse arg string
-*/
-	if (pass.error_count)
-		exit(ACME_finalize(EXIT_FAILURE));
+	symbols_use_seeds(FALSE);
+	warm_pass = FALSE;
+	abort_assembly = outer_abort;
+	config.msg_dynabuf = NULL;
+	if (accepted) {
+		fwrite(warm_messages->buffer, 1, warm_messages->size, config.msg_stream);
+		return TRUE;
+	}
+
+	if (config.process_verbosity > 1)
+		puts("Warm start failed, starting from scratch.");
+	symbols_clear();
+	macros_clear();
+	Output_reset(fill_value);
+	for (ii = 0; ii < cli_definition_count; ++ii)
+		define_symbol(cli_definitions[ii]);
+	pass.number = -1;	// so next pass is first pass again
+	return FALSE;
 }
 
 
@@ -285,45 +388,27 @@ static struct report	global_report;
 // do passes until done (or errors occurred). Return whether output is ready.
 static boolean do_actual_work(void)
 {
-	int	undefs_before;	// number of undefined results in previous pass
+	struct assembly	assembly;
 
 	report = &global_report;	// let global pointer point to something
-	report_init(report);	// we must init struct before doing passes
-	if (config.process_verbosity > 1)
-		puts("First pass.");
-	pass.complain_about_undefined = FALSE;	// disable until error pass needed
-	pass.number = -1;	// pre-init, will be incremented by perform_pass()
-	perform_pass();	// first pass
-	// pretend there has been a previous pass, with one more undefined result
-	undefs_before = pass.undefined_count + 1;
-	// keep doing passes as long as the number of undefined results keeps decreasing.
-	// stop on zero (FIXME - zero-check pass.needvalue_count instead!)
-	while (pass.undefined_count && (pass.undefined_count < undefs_before)) {
-		undefs_before = pass.undefined_count;
-		if (config.process_verbosity > 1)
-			puts("Further pass.");
-		perform_pass();
-	}
-	// any errors left?
-	if (pass.undefined_count == 0) {	// FIXME - use pass.needvalue_count instead!
+	report_init(report, report_filename != NULL);	// we must init struct before doing passes
+	assembly.sources = toplevel_sources;
+	assembly.source_count = toplevel_src_count;
+	assembly.default_cpu = default_cpu;
+	assembly.start_address = start_address;
+	assembly.lists_all_symbols = (vicelabels_filename != NULL);
+	assembly.cannot_open = cannot_open;
+	assembly.first_pass = have_seeds ? perform_warm_pass : NULL;
+	if (passes_do(&assembly)) {
 		// if listing report is wanted and there were no errors,
-		// do another pass to generate listing report
-		if (report_filename) {
-			if (config.process_verbosity > 1)
-				puts("Extra pass to generate listing report.");
-			if (report_open(report, report_filename) == 0) {
-				perform_pass();
-				report_close(report);
-			}
-		}
+		// write the one collected during the final pass
+		if (report_filename)
+			report_save(report, report_filename);
 		return TRUE;
 	}
-	// There are still errors (unsolvable by doing further passes),
-	// so perform additional pass to find and show them.
-	if (config.process_verbosity > 1)
-		puts("Extra pass needed to find error.");
-	pass.complain_about_undefined = TRUE;	// activate error output
-	perform_pass();	// perform pass, but now show "value undefined"
+	// errors have been shown (or the error pass did not find any)
+	if (pass.error_count)
+		quit(ACME_finalize(EXIT_FAILURE));
 	return FALSE;
 }
 
@@ -352,7 +437,7 @@ static void set_output_format(const char format_name[])
 		fputs("Error: No output format specified.\n", stderr);
 	}
 	fprintf(stderr, "Supported formats are:\n\n\t%s\n\n", outputfile_formats);
-	exit(EXIT_FAILURE);
+	quit(EXIT_FAILURE);
 }
 
 
@@ -374,14 +459,14 @@ static void set_starting_cpu(const char cpu_name[])
 		fputs("Error: No CPU type specified.\n", stderr);
 	}
 	fprintf(stderr, "Supported types are:\n\n\t%s\n\n", cputype_names);
-	exit(EXIT_FAILURE);
+	quit(EXIT_FAILURE);
 }
 
 
 static void could_not_parse(const char strange[])
 {
 	fprintf(stderr, "%sCould not parse '%s'.\n", cliargs_error, strange);
-	exit(EXIT_FAILURE);
+	quit(EXIT_FAILURE);
 }
 
 
@@ -424,7 +509,7 @@ static void set_starting_pc(const char expression[])
 		return;
 
 	fprintf(stderr, "%sProgram counter out of range (0-0xffff).\n", cliargs_error);
-	exit(EXIT_FAILURE);
+	quit(EXIT_FAILURE);
 }
 
 
@@ -436,7 +521,7 @@ static void set_mem_contents(const char expression[])
 		return;
 
 	fprintf(stderr, "%sInitmem value out of range (0-0xff).\n", cliargs_error);
-	exit(EXIT_FAILURE);
+	quit(EXIT_FAILURE);
 }
 
 
@@ -458,6 +543,18 @@ static void define_symbol(const char definition[])
 }
 
 
+// remember "-D" definition, so it can be re-applied for each build variant
+static void remember_definition(const char definition[])
+{
+	cli_definitions = realloc(cli_definitions, (cli_definition_count + 1) * sizeof(*cli_definitions));
+	if (cli_definitions == NULL) {
+		fputs("Error: No memory left.\n", stderr);
+		quit(EXIT_FAILURE);
+	}
+	cli_definitions[cli_definition_count++] = definition;
+}
+
+
 struct dialect {
 	enum version	dialect;
 	const char	*version;
@@ -505,7 +602,7 @@ static void set_dialect(const char version[])
 	for (dia = dialects; dia->version; ++dia)
 		fprintf(stderr, "\t%s\t\t%s\n", dia->version, dia->description);
 	fputc('\n', stderr);
-	exit(EXIT_FAILURE);
+	quit(EXIT_FAILURE);
 }
 
 
@@ -548,7 +645,30 @@ static const char *long_option(const char *string)
 		config.honor_leading_zeroes = FALSE;
 	else if (strcmp(string, OPTION_STRICT_SEGMENTS) == 0)
 		config.segment_warning_is_error = TRUE;
-	else if (strcmp(string, OPTION_DIALECT) == 0)
+	else if (strcmp(string, OPTION_VARIANTS) == 0)
+		variants_filename = cliargs_safe_get_next(arg_variants);
+	else if (strcmp(string, OPTION_BATCH) == 0)
+		batch_filename = cliargs_safe_get_next(arg_batch);
+	else if (strcmp(string, OPTION_JOBS) == 0)
+		batch_jobs = string_to_number(cliargs_safe_get_next("number of jobs"));
+	else if (strcmp(string, OPTION_WARM_START) == 0)
+		warmstart_filename = cliargs_safe_get_next(arg_warmstart);
+	else if (strcmp(string, OPTION_PASS_REPORT) == 0)
+		config.pass_report = TRUE;
+	else if (strcmp(string, OPTION_STATS) == 0)
+		config.profile_stats = TRUE;
+	else if (strcmp(string, OPTION_TRACE) == 0)
+		config.profile_trace = cliargs_safe_get_next(arg_trace);
+	else if (strcmp(string, OPTION_LINE_PROFILE) == 0)
+		config.profile_lines = cliargs_safe_get_next(arg_lineprofile);
+	else if (strcmp(string, OPTION_MEM_STATS) == 0)
+		config.mem_stats = TRUE;
+	else if (strcmp(string, OPTION_SERVER) == 0)
+		server_socket = cliargs_safe_get_next(arg_server);
+	else if (strcmp(string, OPTION_CLIENT) == 0) {
+		fputs("Error: \"--" OPTION_CLIENT "\" must be the first argument.\n", stderr);
+		quit(EXIT_FAILURE);
+	} else if (strcmp(string, OPTION_DIALECT) == 0)
 		set_dialect(cliargs_get_next());	// NULL is ok (handled like unknown)
 	else if (strcmp(string, OPTION_TEST) == 0) {
 		config.wanted_version = VER_FUTURE;
@@ -571,6 +691,7 @@ static char short_option(const char *argument)
 		switch (*argument) {
 		case 'D':	// "-D" define constants
 			define_symbol(argument + 1);
+			remember_definition(argument + 1);
 			goto done;
 		case 'f':	// "-f" selects output format
 			set_output_format(cliargs_get_next());	// NULL is ok (handled like unknown)
@@ -618,7 +739,7 @@ static char short_option(const char *argument)
 				goto done;
 			} else {
 				fprintf(stderr, "%sUnknown warning level.\n", cliargs_error);
-				exit(EXIT_FAILURE);
+				quit(EXIT_FAILURE);
 			}
 			break;
 		default:	// unknown ones: program termination
@@ -631,24 +752,225 @@ done:
 }
 
 
+// assemble each build variant listed in variants file ("--variants").
+// each line holds an output file name followed by any number of
+// "-DSYMBOL=VALUE" definitions. empty lines and lines starting with ';' or
+// '#' are ignored. include paths, the cache for "!binary"/"!convtab" files and
+// the keyword trees are kept, but symbols, macros and output are reset before
+// each variant. returns exit code.
+static int assemble_variants(void)
+{
+	FILE		*fd;
+	char		line[VARIANT_LINE_MAX],
+			*token,
+			*filename	= NULL;
+	const char	*symbollist	= symbollist_filename;	// as given on CLI
+	int		ii,
+			line_number	= 0,
+			variant_count	= 0,
+			exit_code	= EXIT_SUCCESS;
+
+	fd = fopen(variants_filename, FILE_READBINARY);
+	if (fd == NULL) {
+		fprintf(stderr, "Error: Cannot open variants file \"%s\".\n", variants_filename);
+		return EXIT_FAILURE;
+	}
+	while (fgets(line, sizeof(line), fd)) {
+		++line_number;
+		if ((strchr(line, '\n') == NULL) && !feof(fd)) {
+			fprintf(stderr, "Error: Line %d of variants file is too long.\n", line_number);
+			exit_code = EXIT_FAILURE;
+			break;
+		}
+		token = strtok(line, VARIANT_SEPARATORS);
+		if ((token == NULL) || (*token == ';') || (*token == '#'))
+			continue;	// empty line or comment
+
+		// reset state left over from previous variant
+		symbols_clear();
+		macros_clear();
+		Output_reset(fill_value);
+		symbollist_filename = symbollist;
+		for (ii = 0; ii < cli_definition_count; ++ii)
+			define_symbol(cli_definitions[ii]);
+		// first token is output file name
+		safe_free(filename);
+		filename = safe_malloc(strlen(token) + 1);
+		strcpy(filename, token);
+		output_filename = filename;
+		// the rest are definitions
+		while ((token = strtok(NULL, VARIANT_SEPARATORS))) {
+			if ((token[0] != '-') || (token[1] != 'D')) {
+				fprintf(stderr, "Error: Line %d of variants file: Expected \"-DSYMBOL=VALUE\", found \"%s\".\n", line_number, token);
+				exit_code = EXIT_FAILURE;
+				break;
+			}
+			define_symbol(token + 2);
+		}
+		if (token)
+			break;	// bad definition, so stop like for a line that is too long
+		if (config.process_verbosity)
+			printf("Assembling variant \"%s\".\n", output_filename);
+		if (do_actual_work())
+			save_output_file();
+		// write symbol list and VICE labels
+		exit_code = ACME_finalize(exit_code);
+		++variant_count;
+	}
+	fclose(fd);
+	if ((variant_count == 0) && (exit_code == EXIT_SUCCESS)) {
+		fprintf(stderr, "Error: No variants found in \"%s\".\n", variants_filename);
+		exit_code = EXIT_FAILURE;
+	}
+	return exit_code;
+}
+
+
+// read symbol values of previous build for warm start (if there are any)
+static void load_seeds(void)
+{
+	FILE	*fd;
+
+	have_seeds = FALSE;
+	fd = fopen(warmstart_filename, FILE_READBINARY);
+	if (fd == NULL)
+		return;	// no previous build, so do a cold start
+
+	have_seeds = (symbols_load_seeds(fd) != 0);
+	fclose(fd);
+}
+
+
+// write symbol values for warm start of next build. returns nonzero on error.
+static int save_seeds(void)
+{
+	FILE	*fd;
+
+	fd = fopen(warmstart_filename, FILE_WRITETEXT);
+	if (fd == NULL) {
+		fprintf(stderr, "Error: Cannot open warm start file \"%s\".\n", warmstart_filename);
+		return 1;
+	}
+	symbols_save_seeds(fd);
+	fclose(fd);
+	return 0;
+}
+
+
+// assemble sources given on command line (options have been handled)
+static int assemble(void)
+{
+	// generate list of files to process
+	cliargs_get_rest(&toplevel_src_count, &toplevel_sources, "No top level sources given");
+	// init output buffer
+	Output_init(fill_value, config.test_new_features);
+	if (variants_filename)
+		return assemble_variants();	// (without warm start)
+
+	if (warmstart_filename)
+		load_seeds();
+	if (do_actual_work()) {
+		save_output_file();
+		if (warmstart_filename && save_seeds())
+			return ACME_finalize(EXIT_FAILURE);
+	}
+	return ACME_finalize(EXIT_SUCCESS);	// dump labels, if wanted
+}
+
+
+// run a single batch job (called in worker process).
+// options given before "--batch" have already been handled and serve as
+// defaults for all jobs.
+static int assemble_job(int argc, const char *argv[])
+{
+	batch_filename = NULL;
+	cliargs_init(argc, argv);
+	cliargs_handle_options(short_option, long_option);
+	if (batch_filename) {
+		fputs("Error: Batch jobs must not use \"--" OPTION_BATCH "\".\n", stderr);
+		return EXIT_FAILURE;
+	}
+	return assemble();
+}
+
+
+// reset everything options may have changed (before handling options of next
+// server request). the contents cache is kept, that is the point of it.
+static void reset_options(void)
+{
+	config_default(&config);
+	start_address = ILLEGAL_START_ADDRESS;
+	fill_value = MEMINIT_USE_DEFAULT;
+	default_cpu = NULL;
+	// names set via "!to" and "!sl" in previous request are not freed,
+	// because names given on command line are not allocated.
+	output_filename = NULL;
+	symbollist_filename = NULL;
+	vicelabels_filename = NULL;
+	report_filename = NULL;
+	variants_filename = NULL;
+	batch_filename = NULL;
+	server_socket = NULL;
+	warmstart_filename = NULL;
+	have_seeds = FALSE;
+	cli_definition_count = 0;
+	macro_recursions_left = MAX_NESTING;
+	source_recursions_left = MAX_NESTING;
+	includepaths_clear();
+	outputfile_clear_format();
+	symbols_clear();
+	macros_clear();
+	profile_close();
+}
+
+
+// handle a single request in server mode (called with stdout/stderr already
+// redirected to client). each request starts with default options.
+static int serve_request(const char *directory, int argc, const char *argv[])
+{
+	if (setjmp(request_jump)) {
+		// request ended early, so forget about unfinished blocks
+		flow_abort();
+		return request_exit_code;
+	}
+	includepaths_free_stale();	// no file is being parsed now
+	reset_options();
+	cliargs_init(argc, argv);
+	cliargs_handle_options(short_option, long_option);
+	if (batch_filename || server_socket) {
+		fputs("Error: Server requests must not use \"--" OPTION_BATCH "\" or \"--" OPTION_SERVER "\".\n", stderr);
+		return EXIT_FAILURE;
+	}
+	includepaths_select_cache(directory);
+	return assemble();
+}
+
+
 // guess what
 int main(int argc, const char *argv[])
 {
 	config_default(&config);
+	abort_assembly = exit_after_finalize;
 	// if called without any arguments, show usage info (not full help)
 	if (argc == 1)
 		show_help_and_exit();
-	cliargs_init(argc, argv);
+	// client mode does not need any setup, it just passes on the arguments
+	if ((argc >= 3) && (strcmp(argv[1], "--" OPTION_CLIENT) == 0))
+		return server_request(argv[2], argc - 3, argv + 3);
+
+	program_name = cliargs_init(argc, argv);
 	// init platform-specific stuff.
 	// this may read the library path from an environment variable.
 	PLATFORM_INIT;
 	// handle command line arguments
 	cliargs_handle_options(short_option, long_option);
-	// generate list of files to process
-	cliargs_get_rest(&toplevel_src_count, &toplevel_sources, "No top level sources given");
-	// init output buffer
-	Output_init(fill_value, config.test_new_features);
-	if (do_actual_work())
-		save_output_file();
-	return ACME_finalize(EXIT_SUCCESS);	// dump labels, if wanted
+	if (batch_filename)
+		return batch_run(batch_filename, program_name, batch_jobs, assemble_job);
+	if (server_socket) {
+		serving = TRUE;
+		cliargs_exit = quit;
+		return server_run(server_socket, program_name, serve_request);
+	}
+
+	return assemble();
 }
@@ -10,7 +10,7 @@
 #include "config.h"
 
 
-// Variables
+// Variables (defined in global.c, so the library does not need acme.c)
 extern const char	*symbollist_filename;
 extern const char	*output_filename;	// TODO - put in "part" struct
 extern const char	*report_filename;	// TODO - put in "part" struct
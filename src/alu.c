@@ -22,10 +22,12 @@
 #include <math.h>	// only for fp support
 #include <string.h>	// for memcpy()
 #include "platform.h"
+#include "depgraph.h"
 #include "dynabuf.h"
 #include "encoding.h"
 #include "global.h"
 #include "input.h"
+#include "macro.h"
 #include "output.h"
 #include "section.h"
 #include "symbol.h"
@@ -37,6 +39,10 @@
 #define ERRORMSG_INITIALSIZE	256	// ad hoc
 #define FUNCTION_INITIALSIZE	8	// enough for "arctan"
 #define HALF_INITIAL_STACK_SIZE	8
+#define UNDEFINED_READS_INITIAL_SIZE	64
+#define UNDEFINED_TEXTS_INITIALSIZE	1024
+#define PROGRAM_INITIAL_SIZE	32	// steps of recorded expressions
+#define PROGRAM_STACK_SIZE	32	// deeper expressions are not recorded
 static const char	exception_div_by_zero[]	= "Division by zero.";
 static const char	exception_no_value[]	= "No value given.";
 static const char	exception_paren_open[]	= "Too many '('.";
@@ -176,6 +182,55 @@ static int		op_sp;
 static struct object	*arg_stack	= NULL;
 static int		argstack_size	= HALF_INITIAL_STACK_SIZE;
 static int		arg_sp;
+// values read while undefined in current pass (first read of each symbol, so
+// errors can be shown without another pass). strings are stored in
+// undefined_texts, the structs only hold offsets.
+struct text_position {
+	int		filename,	// offset of file name
+			line_number,
+			section_title;	// offset of section title
+	const char	*section_type;
+};
+struct undefined_read {
+	struct symbol		*symbol;	// NULL means program counter
+	int			name;		// offset of displayed name (with prefix)
+	struct text_position	position;
+	int			first_call,	// index in undefined_calls
+				call_count;	// number of macro calls in progress
+};
+static struct undefined_read	*undefined_reads	= NULL;
+static int			undefined_reads_count	= 0;
+static int			undefined_reads_size	= 0;
+static struct text_position	*undefined_calls	= NULL;	// call sites, innermost first
+static int			undefined_calls_count	= 0;
+static int			undefined_calls_size	= 0;
+static	STRUCT_DYNABUF_REF(undefined_texts, UNDEFINED_TEXTS_INITIALSIZE);
+// recorded expressions (see ALU_record_start()). each step either pushes an
+// argument or applies an operator to the newest argument(s), in the order the
+// parser has done it, so running the program applies the same handlers.
+enum step_type {
+	STEP_CONSTANT,	// push constant
+	STEP_COUNTER,	// push loop counter
+	STEP_MONADIC,	// apply monadic operator to newest argument
+	STEP_DYADIC,	// apply dyadic operator to two newest arguments
+	STEP_RESULT	// newest argument is result of expression
+};
+struct step {
+	enum step_type		type;
+	const struct op		*op;	// for operators
+	struct object		constant;	// for constants
+};
+struct alu_program {
+	struct step	*steps;
+	int		count,
+			size,
+			results;	// number of expressions
+};
+static struct alu_program	*recording	= NULL;	// NULL means not recording
+static struct symbol		*recorded_counter;
+static boolean			recording_failed;
+static int			recorded_depth;	// arguments on stack, must match arg_sp
+static int			recording_throws;	// message counter at start
 enum alu_state {
 	STATE_EXPECT_ARG_OR_MONADIC_OP,
 	STATE_EXPECT_DYADIC_OP,
@@ -232,6 +287,8 @@ do {							\
 	arg_stack[arg_sp].u.number.flags = (f);		\
 	arg_stack[arg_sp].u.number.val.intval = (i);	\
 	arg_stack[arg_sp++].u.number.addr_refs = (r);	\
+	if (recording)					\
+		record_argument(STEP_CONSTANT);		\
 } while (0)
 #define PUSH_FP_ARG(fp, f)				\
 do {							\
@@ -240,6 +297,8 @@ do {							\
 	arg_stack[arg_sp].u.number.flags = (f);		\
 	arg_stack[arg_sp].u.number.val.fpval = (fp);	\
 	arg_stack[arg_sp++].u.number.addr_refs = 0;	\
+	if (recording)					\
+		record_argument(STEP_CONSTANT);		\
 } while (0)
 
 
@@ -248,9 +307,7 @@ static void enlarge_operator_stack(void)
 {
 	opstack_size *= 2;
 	//printf("Doubling op stack size to %d.\n", opstack_size);
-	op_stack = realloc(op_stack, opstack_size * sizeof(*op_stack));
-	if (op_stack == NULL)
-		Throw_serious_error(exception_no_memory_left);
+	op_stack = tagged_realloc(op_stack, opstack_size * sizeof(*op_stack), MEM_ALU);
 }
 
 
@@ -259,9 +316,77 @@ static void enlarge_argument_stack(void)
 {
 	argstack_size *= 2;
 	//printf("Doubling arg stack size to %d.\n", argstack_size);
-	arg_stack = realloc(arg_stack, argstack_size * sizeof(*arg_stack));
-	if (arg_stack == NULL)
-		Throw_serious_error(exception_no_memory_left);
+	arg_stack = tagged_realloc(arg_stack, argstack_size * sizeof(*arg_stack), MEM_ALU);
+}
+
+
+// add step to recorded program
+static void record_step(enum step_type type, const struct op *op)
+{
+	struct step	*step;
+
+	if (recording->count == recording->size) {
+		recording->size *= 2;
+		recording->steps = tagged_realloc(recording->steps, recording->size * sizeof(*recording->steps), MEM_ALU);
+	}
+	step = &recording->steps[recording->count++];
+	step->type = type;
+	step->op = op;
+	if (type == STEP_CONSTANT)
+		step->constant = arg_stack[arg_sp - 1];
+}
+
+// record newest argument. it must be a defined number, and there must not
+// have been any other pushes the recorder does not know about (strings, lists)
+static void record_argument(enum step_type type)
+{
+	const struct object	*arg	= &arg_stack[arg_sp - 1];
+
+	if (recording_failed)
+		return;
+
+	if ((arg_sp != recorded_depth + 1)
+	|| (arg_sp > PROGRAM_STACK_SIZE)
+	|| (arg->type != &type_number)
+	|| (arg->u.number.ntype == NUMTYPE_UNDEFINED)) {
+		recording_failed = TRUE;
+		return;
+	}
+	++recorded_depth;
+	record_step(type, NULL);
+}
+
+// record operator about to be applied to the newest argument(s)
+static void record_operator(enum step_type type, const struct op *op)
+{
+	if (recording_failed)
+		return;
+
+	if (arg_sp != recorded_depth) {
+		recording_failed = TRUE;
+		return;
+	}
+	if (type == STEP_DYADIC)
+		--recorded_depth;	// two arguments will become one
+	record_step(type, op);
+}
+
+// record result of expression
+static void record_result(const struct expression *expression)
+{
+	if (recording_failed)
+		return;
+
+	if (expression->is_empty
+	|| (recorded_depth != 1)
+	|| (expression->result.type != &type_number)
+	|| (expression->result.u.number.ntype == NUMTYPE_UNDEFINED)) {
+		recording_failed = TRUE;
+		return;
+	}
+	recorded_depth = 0;
+	record_step(STEP_RESULT, NULL);
+	++recording->results;
 }
 
 
@@ -304,6 +429,69 @@ static intval_t my_asr(intval_t left, intval_t right)
 }
 
 
+// add string to undefined_texts and return its offset
+static int add_undefined_text(const char *string)
+{
+	int	offset	= undefined_texts->size;
+
+	DynaBuf_add_string(undefined_texts, string);
+	DynaBuf_append(undefined_texts, '\0');
+	return offset;
+}
+static void set_position(struct text_position *position, const struct input *input, const struct section *section)
+{
+	position->filename = add_undefined_text(input->original_filename);
+	position->line_number = input->line_number;
+	position->section_type = section->type;
+	position->section_title = add_undefined_text(section->title);
+}
+// remember call site of macro call in progress
+static void note_call_site(const struct input *call_site, const struct section *section)
+{
+	if (undefined_calls_count == undefined_calls_size) {
+		undefined_calls_size = undefined_calls_size ? 2 * undefined_calls_size : UNDEFINED_READS_INITIAL_SIZE;
+		undefined_calls = tagged_realloc(undefined_calls, undefined_calls_size * sizeof(*undefined_calls), MEM_ALU);
+	}
+	set_position(&undefined_calls[undefined_calls_count++], call_site, section);
+}
+
+
+// remember where a value was read while undefined (NULL means program counter)
+// This function is not allowed to change DynaBuf because the symbol's name
+// might be stored there!
+static void note_undefined_read(struct symbol *symbol, char optional_prefix_char, const char *name, size_t length)
+{
+	struct undefined_read	*read;
+
+	// only remember first read of each symbol (the symbol knows the index of
+	// its entry, so any later read finds it)
+	if (symbol
+	&& (symbol->undefined_read >= 0)
+	&& (symbol->undefined_read < undefined_reads_count)
+	&& (undefined_reads[symbol->undefined_read].symbol == symbol))
+		return;
+
+	if (undefined_reads_count == undefined_reads_size) {
+		undefined_reads_size = undefined_reads_size ? 2 * undefined_reads_size : UNDEFINED_READS_INITIAL_SIZE;
+		undefined_reads = tagged_realloc(undefined_reads, undefined_reads_size * sizeof(*undefined_reads), MEM_ALU);
+	}
+	if (symbol)
+		symbol->undefined_read = undefined_reads_count;
+	read = &undefined_reads[undefined_reads_count++];
+	read->symbol = symbol;
+	read->name = undefined_texts->size;
+	if (optional_prefix_char)
+		DynaBuf_append(undefined_texts, optional_prefix_char);
+	while (length--)
+		DynaBuf_append(undefined_texts, *name++);
+	DynaBuf_append(undefined_texts, '\0');
+	set_position(&read->position, Input_now, section_now);
+	read->first_call = undefined_calls_count;
+	macro_for_each_call_site(note_call_site);
+	read->call_count = undefined_calls_count - read->first_call;
+}
+
+
 // if wanted, throw "Value not defined" error
 // This function is not allowed to change DynaBuf because the symbol's name
 // might be stored there!
@@ -351,7 +539,7 @@ static void get_symbol_value(scope_t scope, char optional_prefix_char, size_t na
 	struct symbol	*symbol;
 	struct object	*arg;
 
-	symbol = symbol_find(scope);
+	symbol = symbol_find_bound(scope);
 	symbol->has_been_read = TRUE;
 	if (symbol->object.type == NULL) {
 		// finish symbol item by making it an undefined number
@@ -366,6 +554,14 @@ static void get_symbol_value(scope_t scope, char optional_prefix_char, size_t na
 	// first push on arg stack, so we have a local copy we can "unpseudopc"
 	arg = &arg_stack[arg_sp++];
 	*arg = symbol->object;
+	// in warm start pass, forward references use value of previous build
+	// (not where undefined values are errors, and not for '&' operator)
+	if ((arg->type == &type_number)
+	&& (arg->u.number.ntype == NUMTYPE_UNDEFINED)
+	&& (unpseudo_count == 0)
+	&& !pass.complain_about_undefined)
+		symbol_get_seed(symbol, scope, &arg->u.number);
+	depgraph_note_read(symbol, arg);
 	if (unpseudo_count) {
 		if (arg->type == &type_number) {
 			pseudopc_unpseudo(&arg->u.number, symbol->pseudopc, unpseudo_count);
@@ -378,9 +574,19 @@ static void get_symbol_value(scope_t scope, char optional_prefix_char, size_t na
 //	if (!(arg->type->is_defined(arg)))
 // FIXME - now that lists with undefined items are "undefined", this fails in
 // case of "!if len(some_list) {", so check for undefined _numbers_ explicitly:
-	if ((arg->type == &type_number) && (arg->u.number.ntype == NUMTYPE_UNDEFINED))
+	if ((arg->type == &type_number) && (arg->u.number.ntype == NUMTYPE_UNDEFINED)) {
+		note_undefined_read(symbol, optional_prefix_char, GLOBALDYNABUF_CURRENT, name_length);
 		is_not_defined(symbol, optional_prefix_char, GLOBALDYNABUF_CURRENT, name_length);
+	}
 	// FIXME - if arg is list, increment ref count!
+	if (recording) {
+		if (symbol != recorded_counter)
+			record_argument(STEP_CONSTANT);	// cannot change during recorded loop body
+		else if (unpseudo_count == 0)
+			record_argument(STEP_COUNTER);
+		else
+			recording_failed = TRUE;
+	}
 }
 
 
@@ -390,10 +596,13 @@ static void parse_program_counter(unsigned int unpseudo_count)	// Now GotByte =
 	struct number	pc;
 
 	GetByte();
+	recording_failed = TRUE;	// program counter changes between runs of recorded program
 	vcpu_read_pc(&pc);
 	// if needed, output "value not defined" error
-	if (pc.ntype == NUMTYPE_UNDEFINED)
+	if (pc.ntype == NUMTYPE_UNDEFINED) {
+		note_undefined_read(NULL, 0, "*", 1);
 		is_not_defined(NULL, 0, "*", 1);
+	}
 	if (unpseudo_count)
 		pseudopc_unpseudo(&pc, pseudopc_get_context(), unpseudo_count);
 	PUSH_INT_ARG(pc.val.intval, pc.flags, pc.addr_refs);	// FIXME - when undefined pc is allowed, this must be changed for numtype!
@@ -404,7 +613,7 @@ static void parse_program_counter(unsigned int unpseudo_count)	// Now GotByte =
 static void string_prepare_string(struct object *self, int len)
 {
 	self->type = &type_string;
-	self->u.string = safe_malloc(sizeof(*(self->u.string)) + len);
+	self->u.string = tagged_malloc(sizeof(*(self->u.string)) + len, MEM_STRINGS);
 	self->u.string->payload[len] = 0;	// terminate, to facilitate string_print()
 	self->u.string->length = len;	// length does not include the added terminator
 	self->u.string->refs = 1;
@@ -663,7 +872,7 @@ static void parse_function_call(void)
 static void list_init_list(struct object *self)
 {
 	self->type = &type_list;
-	self->u.listhead = safe_malloc(sizeof(*(self->u.listhead)));
+	self->u.listhead = tagged_malloc(sizeof(*(self->u.listhead)), MEM_LISTS);
 	self->u.listhead->next = self->u.listhead;
 	self->u.listhead->prev = self->u.listhead;
 	self->u.listhead->u.listinfo.length = 0;
@@ -674,7 +883,7 @@ static void list_append_object(struct listitem *head, const struct object *obj)
 {
 	struct listitem	*item;
 
-	item = safe_malloc(sizeof(*item));
+	item = tagged_malloc(sizeof(*item), MEM_LISTS);
 	item->u.payload = *obj;
 	item->next = head;
 	item->prev = head->prev;
@@ -837,6 +1046,8 @@ static void push_dyadic_and_check(struct expression *expression, struct op *op)
 			// stacks:	...	...	previous op(monadic)	newest arg	newest op(dyadic)
 			if (arg_sp < 1)
 				Bug_found("ArgStackEmpty", arg_sp);
+			if (recording)
+				record_operator(STEP_MONADIC, PREVIOUS_OPERATOR);
 			NEWEST_ARGUMENT.type->monadic_op(&NEWEST_ARGUMENT, PREVIOUS_OPERATOR);
 			expression->is_parenthesized = FALSE;	// operation was something other than parentheses
 			// now remove previous operator by overwriting with newest one...
@@ -847,6 +1058,8 @@ static void push_dyadic_and_check(struct expression *expression, struct op *op)
 			// stacks:	previous arg	previous op(dyadic)	newest arg	newest op(dyadic)
 			if (arg_sp < 2)
 				Bug_found("NotEnoughArgs", arg_sp);
+			if (recording)
+				record_operator(STEP_DYADIC, PREVIOUS_OPERATOR);
 			PREVIOUS_ARGUMENT.type->dyadic_op(&PREVIOUS_ARGUMENT, PREVIOUS_OPERATOR, &NEWEST_ARGUMENT);
 			expression->is_parenthesized = FALSE;	// operation was something other than parentheses
 			// now remove previous operator by overwriting with newest one...
@@ -2510,10 +2723,13 @@ static int parse_expression(struct expression *expression)
 		}
 		// do some checks depending on int/float
 		result->type->fix_result(result);
+		if (recording)
+			record_result(expression);
 		return 0;	// ok
 	} else {
 		// State is STATE_ERROR. Errors have already been reported,
 		// but we must make sure not to pass bogus data to caller.
+		recording_failed = TRUE;
 		// FIXME - just use the return value to indicate "there were errors, do not use result!"
 		result->type = &type_number;
 		result->u.number.ntype = NUMTYPE_UNDEFINED;	// maybe use NUMTYPE_INT to suppress follow-up errors?
@@ -2546,9 +2762,10 @@ void ALU_any_int(intval_t *target)	// ACCEPT_UNDEFINED
 	if (expression.is_empty)
 		Throw_error(exception_no_value);
 	if (expression.result.type == &type_number) {
-		if (expression.result.u.number.ntype == NUMTYPE_UNDEFINED)
+		if (expression.result.u.number.ntype == NUMTYPE_UNDEFINED) {
 			*target = 0;
-		else if (expression.result.u.number.ntype == NUMTYPE_INT)
+			++pass.needvalue_count;	// all callers use the value for output
+		} else if (expression.result.u.number.ntype == NUMTYPE_INT)
 			*target = expression.result.u.number.val.intval;
 		else if (expression.result.u.number.ntype == NUMTYPE_FLOAT)
 			*target = expression.result.u.number.val.fpval;
@@ -2641,8 +2858,10 @@ void ALU_addrmode_int(struct expression *expression, int paren)	// ACCEPT_UNDEFI
 		// convert float to int
 		if (expression->result.u.number.ntype == NUMTYPE_FLOAT)
 			float_to_int(&(expression->result));
-		else if (expression->result.u.number.ntype == NUMTYPE_UNDEFINED)
+		else if (expression->result.u.number.ntype == NUMTYPE_UNDEFINED) {
 			expression->result.u.number.val.intval = 0;
+			++pass.needvalue_count;	// needed for opcode and argument
+		}
 	} else if (expression->result.type == &type_string) {
 		// accept single-char strings, to be more
 		// compatible with versions before 0.97:
@@ -2683,6 +2902,188 @@ void ALU_any_result(struct object *result)	// ACCEPT_UNDEFINED | ACCEPT_FLOAT
 }
 
 
+// start recording the expressions parsed from now on, so they can be computed
+// again for other values of the given loop counter (without parsing).
+void ALU_record_start(struct symbol *counter)
+{
+	recording = tagged_malloc(sizeof(*recording), MEM_ALU);
+	recording->size = PROGRAM_INITIAL_SIZE;
+	recording->steps = tagged_malloc(recording->size * sizeof(*recording->steps), MEM_ALU);
+	recording->count = 0;
+	recording->results = 0;
+	recorded_counter = counter;
+	recording_failed = FALSE;
+	recorded_depth = 0;
+	recording_throws = Throw_get_counter();
+}
+
+
+// return number of expressions recorded so far (zero if not recording)
+int ALU_record_count(void)
+{
+	return recording ? recording->results : 0;
+}
+
+
+// stop recording. return program, or NULL if it cannot be used.
+struct alu_program *ALU_record_stop(void)
+{
+	struct alu_program	*program	= recording;
+
+	recording = NULL;
+	// messages would not be shown again when running the program
+	if (recording_failed || (Throw_get_counter() != recording_throws)) {
+		ALU_free_program(program);
+		return NULL;
+	}
+	return program;
+}
+
+
+// free recorded program
+void ALU_free_program(struct alu_program *program)
+{
+	safe_free(program->steps);
+	safe_free(program);
+}
+
+
+// compute recorded expressions for given value of loop counter.
+// this only reads global state, so it may be called from worker threads
+// (as long as messages are trapped, see global.h).
+void ALU_run_program(const struct alu_program *program, const struct object *counter, struct object *results)
+{
+	struct object		stack[PROGRAM_STACK_SIZE];
+	const struct step	*step	= program->steps,
+				*end	= program->steps + program->count;
+	int			sp	= 0;
+
+	for (; step < end; ++step) {
+		switch (step->type) {
+		case STEP_CONSTANT:
+			stack[sp++] = step->constant;
+			break;
+		case STEP_COUNTER:
+			stack[sp++] = *counter;
+			break;
+		case STEP_MONADIC:
+			stack[sp - 1].type->monadic_op(&stack[sp - 1], step->op);
+			break;
+		case STEP_DYADIC:
+			--sp;
+			stack[sp - 1].type->dyadic_op(&stack[sp - 1], step->op, &stack[sp]);
+			break;
+		case STEP_RESULT:
+			stack[0].type->fix_result(&stack[0]);
+			*results++ = stack[0];
+			sp = 0;
+			break;
+		}
+	}
+}
+
+
+// forget symbols read while undefined (called at start of each pass)
+void ALU_passinit(void)
+{
+	undefined_reads_count = 0;
+	undefined_calls_count = 0;
+	DYNABUF_CLEAR(undefined_texts);
+}
+
+
+// check whether all undefined values of the current pass were forward
+// references, i.e. whether every symbol read while undefined has got a value
+// by now. If so, further passes would not find any undefined symbols.
+boolean ALU_forward_refs_only(void)
+{
+	int	ii;
+
+	for (ii = 0; ii < undefined_reads_count; ++ii) {
+		if ((undefined_reads[ii].symbol == NULL)	// program counter
+		|| !undefined_reads[ii].symbol->object.type->is_defined(&undefined_reads[ii].symbol->object))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+
+// check whether two positions are the same
+static boolean same_position(const struct text_position *a, const struct text_position *b)
+{
+	return (a->line_number == b->line_number)
+		&& (strcmp(undefined_texts->buffer + a->filename, undefined_texts->buffer + b->filename) == 0);
+}
+
+
+// show "...called from here." for the macro calls of an error that has been
+// shown, unless they are still in progress at the next one (like at the end
+// of a macro call in a pass with error output enabled)
+static void show_call_sites(const struct undefined_read *shown, const struct undefined_read *next)
+{
+	const struct text_position	*site;
+	int				shared	= 0,
+					ii;
+
+	if (shown == NULL)
+		return;
+
+	// count outermost calls the next error is in as well
+	if (next) {
+		while ((shared < shown->call_count)
+		&& (shared < next->call_count)
+		&& same_position(&undefined_calls[shown->first_call + shown->call_count - 1 - shared],
+			&undefined_calls[next->first_call + next->call_count - 1 - shared]))
+			++shared;
+	}
+	for (ii = 0; ii < shown->call_count - shared; ++ii) {
+		site = &undefined_calls[shown->first_call + ii];
+		Throw_warning_at(undefined_texts->buffer + site->filename, site->line_number,
+			site->section_type, undefined_texts->buffer + site->section_title,
+			"...called from here.");
+	}
+}
+
+
+// throw "Value not defined" errors for the values read while undefined in the
+// current pass, if they still are undefined (so another pass with error output
+// enabled would complain about them, too). returns number of errors thrown.
+int ALU_throw_undefined(void)
+{
+	struct undefined_read	*read,
+				*shown	= NULL;
+	struct symbol		*symbol;
+	int			ii,
+				errors	= 0;
+
+	for (ii = 0; ii < undefined_reads_count; ++ii) {
+		read = &undefined_reads[ii];
+		symbol = read->symbol;
+		// only complain once per symbol
+		if (symbol) {
+			if (symbol->has_been_reported
+			|| symbol->object.type->is_defined(&symbol->object))
+				continue;
+
+			symbol->has_been_reported = TRUE;
+		}
+		show_call_sites(shown, read);
+		DYNABUF_CLEAR(errormsg_dyna_buf);
+		DynaBuf_add_string(errormsg_dyna_buf, "Value not defined (");
+		DynaBuf_add_string(errormsg_dyna_buf, undefined_texts->buffer + read->name);
+		DynaBuf_add_string(errormsg_dyna_buf, ").");
+		DynaBuf_append(errormsg_dyna_buf, '\0');
+		++errors;
+		Throw_error_at(undefined_texts->buffer + read->position.filename, read->position.line_number,
+			read->position.section_type, undefined_texts->buffer + read->position.section_title,
+			errormsg_dyna_buf->buffer);
+		shown = read;
+	}
+	show_call_sites(shown, NULL);
+	return errors;
+}
+
+
 /* TODO
 
 maybe move
@@ -12,6 +12,8 @@
 
 struct op;
 struct dynabuf;
+struct symbol;
+struct alu_program;	// recorded expressions, see ALU_record_start()
 struct type {
 	const char	*name;
 	boolean		(*is_defined)(const struct object *self);
@@ -74,6 +76,30 @@ extern void ALU_defined_int(struct number *intresult);
 extern void ALU_addrmode_int(struct expression *expression, int paren);
 // stores resulting object
 extern void ALU_any_result(struct object *result);
+// start recording the expressions parsed from now on, so they can be computed
+// again for other values of the given loop counter (without parsing). all
+// other symbols are taken as constants.
+extern void ALU_record_start(struct symbol *counter);
+// return number of expressions recorded so far (zero if not recording)
+extern int ALU_record_count(void);
+// stop recording. return program, or NULL if it cannot be used (because
+// messages were shown, or because strings, lists, undefined values or the
+// program counter were used). Free program using ALU_free_program().
+extern struct alu_program *ALU_record_stop(void);
+// free recorded program
+extern void ALU_free_program(struct alu_program *program);
+// compute recorded expressions for given value of loop counter, storing one
+// result per expression. this only reads global state, so it may be called
+// from worker threads (as long as messages are trapped, see global.h).
+extern void ALU_run_program(const struct alu_program *program, const struct object *counter, struct object *results);
+// forget symbols read while undefined (called at start of each pass)
+extern void ALU_passinit(void);
+// check whether every symbol read while undefined in the current pass has
+// got a value by now (so further passes would not find undefined symbols)
+extern boolean ALU_forward_refs_only(void);
+// throw "Value not defined" errors for the values read while undefined in the
+// current pass that still are undefined. returns number of errors thrown.
+extern int ALU_throw_undefined(void);
 
 
 #endif
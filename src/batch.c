@@ -0,0 +1,304 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Batch mode (running several independent assembly jobs)
+//
+// The assembler keeps its state in globals (parser, output buffer, pass
+// counter, ...) and calls exit() on serious errors, so jobs are run in
+// worker processes instead of threads. Each worker is forked from the
+// already initialised main process and writes its stdout and stderr output
+// to temporary files, which are shown when the job is done (in job order).
+// On systems without fork(), jobs are run one after another using system().
+// Arguments holding spaces are then put in double quotes, which is all the
+// quoting such systems' shells have in common. Arguments in the job file
+// itself cannot hold spaces anyway, but the program name might.
+#include "batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#define BATCH_USE_FORK
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+
+// constants
+#define JOB_LINE_MAX		1024	// maximum length of line in job file
+#define JOB_SEPARATORS		" \t\r\n"
+#define JOBS_INITIAL_SIZE	64
+#define COPY_BUFSIZE		4096
+
+
+// job struct
+struct job {
+	int		line_number;	// in job file
+	int		argc;
+	const char	**argv;		// argv[0] is program name
+	FILE		*out_log;	// collected stdout output of job
+	FILE		*err_log;	// collected stderr output of job
+	long		pid;		// zero if not running
+	int		exit_code;
+	boolean		done;
+};
+
+
+// variables
+static struct job	*job_list	= NULL;
+static int		job_count	= 0;
+static int		job_list_size	= 0;
+
+
+// complain and exit
+static void no_memory(void)
+{
+	fputs("Error: No memory left.\n", stderr);
+	exit(EXIT_FAILURE);
+}
+
+
+// split line into arguments and add job to list
+static void add_job(char *line, int line_number, const char *program_name)
+{
+	struct job	*job;
+	char		*copy,
+			*token;
+	int		max_args;
+
+	// make room
+	if (job_count == job_list_size) {
+		job_list_size = job_list_size ? 2 * job_list_size : JOBS_INITIAL_SIZE;
+		job_list = realloc(job_list, job_list_size * sizeof(*job_list));
+		if (job_list == NULL)
+			no_memory();
+	}
+	// each argument needs at least two chars (itself plus separator)
+	max_args = strlen(line) / 2 + 3;
+	copy = malloc(strlen(line) + 1);
+	job = &job_list[job_count++];
+	job->argv = malloc(max_args * sizeof(*job->argv));
+	if ((copy == NULL) || (job->argv == NULL))
+		no_memory();
+	strcpy(copy, line);
+	job->line_number = line_number;
+	job->argc = 0;
+	job->argv[job->argc++] = program_name;
+	for (token = strtok(copy, JOB_SEPARATORS); token; token = strtok(NULL, JOB_SEPARATORS))
+		job->argv[job->argc++] = token;
+	job->argv[job->argc] = NULL;
+	job->out_log = NULL;
+	job->err_log = NULL;
+	job->pid = 0;
+	job->exit_code = EXIT_SUCCESS;
+	job->done = FALSE;
+}
+
+
+// read job file. returns nonzero on error.
+static int read_jobs(const char *filename, const char *program_name)
+{
+	FILE	*fd;
+	char	line[JOB_LINE_MAX],
+		*walk;
+	int	line_number	= 0;
+
+	fd = fopen(filename, "r");
+	if (fd == NULL) {
+		fprintf(stderr, "Error: Cannot open job file \"%s\".\n", filename);
+		return 1;
+	}
+	while (fgets(line, sizeof(line), fd)) {
+		++line_number;
+		if ((strchr(line, '\n') == NULL) && !feof(fd)) {
+			fprintf(stderr, "Error: Line %d of job file is too long.\n", line_number);
+			fclose(fd);
+			return 1;
+		}
+		// skip empty lines and comments
+		walk = line + strspn(line, JOB_SEPARATORS);
+		if ((*walk == '\0') || (*walk == ';') || (*walk == '#'))
+			continue;
+
+		add_job(walk, line_number, program_name);
+	}
+	fclose(fd);
+	if (job_count == 0) {
+		fprintf(stderr, "Error: No jobs found in \"%s\".\n", filename);
+		return 1;
+	}
+	return 0;
+}
+
+
+// copy collected output to given stream and close log
+static void copy_log(FILE **log, FILE *stream)
+{
+	char	buffer[COPY_BUFSIZE];
+	size_t	size;
+
+	if (*log == NULL)
+		return;
+
+	rewind(*log);
+	while ((size = fread(buffer, 1, sizeof(buffer), *log)))
+		fwrite(buffer, 1, size, stream);
+	fclose(*log);
+	*log = NULL;
+}
+
+
+// show collected output of finished job
+static void show_log(struct job *job)
+{
+	copy_log(&job->out_log, stdout);
+	fflush(stdout);	// keep order of jobs when both streams go to same place
+	copy_log(&job->err_log, stderr);
+}
+
+
+#ifdef BATCH_USE_FORK
+
+// start job in worker process
+static void start_job(struct job *job, int (*fn)(int argc, const char *argv[]))
+{
+	pid_t	pid;
+
+	job->out_log = tmpfile();
+	job->err_log = tmpfile();
+	if ((job->out_log == NULL) || (job->err_log == NULL)) {
+		fputs("Error: Cannot create temporary files for job output.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	// do not let worker inherit pending output
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (pid < 0) {
+		fputs("Error: Cannot start worker process.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		// worker: redirect all output to logs, then do the work
+		dup2(fileno(job->out_log), STDOUT_FILENO);
+		dup2(fileno(job->err_log), STDERR_FILENO);
+		exit(fn(job->argc, job->argv));
+	}
+	job->pid = pid;
+}
+
+// wait for any worker process to finish and mark its job as done
+static void wait_for_job(void)
+{
+	pid_t	pid;
+	int	status,
+		ii;
+
+	pid = wait(&status);
+	if (pid < 0) {
+		fputs("Error: Lost track of worker processes.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	for (ii = 0; ii < job_count; ++ii) {
+		if (job_list[ii].pid == pid) {
+			job_list[ii].pid = 0;
+			job_list[ii].done = TRUE;
+			job_list[ii].exit_code = (WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS)) ? EXIT_SUCCESS : EXIT_FAILURE;
+			return;
+		}
+	}
+}
+
+// run all jobs, at most max_jobs at a time
+static void run_jobs(int max_jobs, int (*fn)(int argc, const char *argv[]))
+{
+	int	next_to_start	= 0,
+		next_to_show	= 0,
+		running		= 0;
+
+	if (max_jobs < 1)
+		max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (max_jobs < 1)
+		max_jobs = 1;
+	while (next_to_show < job_count) {
+		// start as many jobs as allowed
+		while ((running < max_jobs) && (next_to_start < job_count)) {
+			start_job(&job_list[next_to_start++], fn);
+			++running;
+		}
+		wait_for_job();
+		--running;
+		// show output of finished jobs, but keep job order
+		while ((next_to_show < job_count) && job_list[next_to_show].done)
+			show_log(&job_list[next_to_show++]);
+	}
+}
+
+#else
+
+// add argument to command line (in quotes if it holds spaces)
+static void append_arg(char *command, const char *arg)
+{
+	if (*command)
+		strcat(command, " ");
+	if (strchr(arg, ' ')) {
+		strcat(command, "\"");
+		strcat(command, arg);
+		strcat(command, "\"");
+	} else {
+		strcat(command, arg);
+	}
+}
+
+// run all jobs one after another (no fork() available)
+static void run_jobs(int max_jobs, int (*fn)(int argc, const char *argv[]))
+{
+	struct job	*job;
+	char		*command;
+	size_t		size;
+	int		ii,
+			arg;
+
+	for (ii = 0; ii < job_count; ++ii) {
+		job = &job_list[ii];
+		// build command line (each argument may need separator and quotes)
+		size = 1;
+		for (arg = 0; arg < job->argc; ++arg)
+			size += strlen(job->argv[arg]) + 3;
+		command = malloc(size);
+		if (command == NULL)
+			no_memory();
+		*command = '\0';
+		for (arg = 0; arg < job->argc; ++arg)
+			append_arg(command, job->argv[arg]);
+		fflush(stdout);
+		fflush(stderr);
+		job->exit_code = system(command) ? EXIT_FAILURE : EXIT_SUCCESS;
+		job->done = TRUE;
+		free(command);
+	}
+}
+
+#endif
+
+
+// run all jobs listed in given file
+int batch_run(const char *filename, const char *program_name, int max_jobs, int (*fn)(int argc, const char *argv[]))
+{
+	int	ii,
+		failed	= 0;
+
+	if (read_jobs(filename, program_name))
+		return EXIT_FAILURE;
+
+	run_jobs(max_jobs, fn);
+	for (ii = 0; ii < job_count; ++ii) {
+		if (job_list[ii].exit_code != EXIT_SUCCESS) {
+			fprintf(stderr, "Error: Job in line %d of \"%s\" failed.\n", job_list[ii].line_number, filename);
+			++failed;
+		}
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
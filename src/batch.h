@@ -0,0 +1,20 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Batch mode (running several independent assembly jobs)
+#ifndef batch_H
+#define batch_H
+
+
+// Prototypes
+
+// run all jobs listed in given file, at most max_jobs at a time (zero means
+// one per CPU core). Each line holds the command line arguments of one job.
+// fn is called with these to do the actual work, in a separate process where
+// possible. Diagnostics of each job are collected and shown in job order.
+// Returns exit code (failure if any job failed).
+extern int batch_run(const char *filename, const char *program_name, int max_jobs, int (*fn)(int argc, const char *argv[]));
+
+
+#endif
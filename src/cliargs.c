@@ -14,6 +14,7 @@ const char	cliargs_error[]	= "Error in CLI arguments: ";
 
 
 // variables
+void			(*cliargs_exit)(int exit_code)	= exit;	// called on errors
 static int		arguments_left;		// number of CLI arguments left
 static const char	**next_argument;	// next argument pointer
 
@@ -57,13 +58,13 @@ void cliargs_handle_options(char (*fn_short)(const char *), const char *(*fn_lon
 			problem_string = fn_long(argument + 1);
 			if (problem_string) {
 				fprintf(stderr, "%sUnknown option (--%s).\n", cliargs_error, problem_string);
-				exit(EXIT_FAILURE);
+				cliargs_exit(EXIT_FAILURE);
 			}
 		} else {
 			problem_char = fn_short(argument);
 			if (problem_char) {
 				fprintf(stderr, "%sUnknown switch (-%c).\n", cliargs_error, problem_char);
-				exit(EXIT_FAILURE);
+				cliargs_exit(EXIT_FAILURE);
 			}
 		}
 	}
@@ -80,7 +81,8 @@ const char *cliargs_safe_get_next(const char name[])
 		return string;
 
 	fprintf(stderr, "%sMissing %s.\n", cliargs_error, name);
-	exit(EXIT_FAILURE);
+	cliargs_exit(EXIT_FAILURE);
+	return NULL;	// not reached
 }
 
 
@@ -100,6 +102,6 @@ void cliargs_get_rest(int *argc, const char ***argv, const char error[])
 	*argv = next_argument;
 	if (error && (arguments_left == 0)) {
 		fprintf(stderr, "%s%s.\n", cliargs_error, error);
-		exit(EXIT_FAILURE);
+		cliargs_exit(EXIT_FAILURE);
 	}
 }
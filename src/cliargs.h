@@ -11,6 +11,11 @@
 extern const char	cliargs_error[];
 
 
+// variables
+// called on errors, defaults to exit(). must not return.
+extern void	(*cliargs_exit)(int exit_code);
+
+
 // handle options. Call fn_short for short options, fn_long for long ones.
 extern void cliargs_handle_options(char (*fn_short)(const char *), const char *(*fn_long)(const char *));
 // return next argument.
@@ -0,0 +1,351 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Symbol dependency graph and pass report ("--pass-report")
+//
+// Further passes are done as long as there are undefined results, and once a
+// symbol is defined, its value never changes. So the reason for each further
+// pass is a chain of forward references: a definition read a symbol that was
+// still undefined, so it got its value one pass later, so the definitions
+// reading it got theirs yet another pass later, and so on.
+// To find these chains, each symbol remembers the symbols read by its
+// definition (and whether they were undefined at the time) until it gets a
+// value, and the pass in which that happened.
+// Addressing modes chosen without knowing the argument's value for sure are
+// recorded as well, because they make the output larger than needed.
+#include "depgraph.h"
+#include <stdlib.h>
+#include <string.h>
+#include "alu.h"
+#include "dynabuf.h"
+#include "global.h"
+#include "input.h"
+#include "section.h"
+#include "symbol.h"
+#include "tree.h"
+
+
+// constants
+#define NODES_INITIAL_SIZE	256
+#define READS_INITIAL_SIZE	16
+#define MAX_CHAIN_LENGTH	32	// longer chains are cut off
+
+
+// symbol read by a statement
+struct dep_read {
+	struct dep_node	*node;
+	boolean		undefined,	// value was undefined when read
+			unsure;		// value was undefined in some pass
+};
+// graph node (one for each symbol)
+struct dep_node {
+	const char	*name;		// tree node's name
+	char		prefix;		// '.' or '@' for local symbols, otherwise 0
+	int		defined_pass;	// pass in which symbol got its value (-1 if not yet)
+	int		read_pass;	// pass of reads (-1 if not yet defined at all)
+	struct dep_read	*reads;		// symbols read by definition
+	int		read_count;
+	char		*filename;	// position of definition (NULL if none yet)
+	int		line_number;
+	int		visit;		// to detect loops when following chains
+};
+// addressing mode chosen for unsure value (strings are in unsure_texts)
+struct unsure_size {
+	int	filename,	// offset in unsure_texts
+		line_number,
+		first_read,	// index in unsure_reads
+		read_count;
+};
+
+
+// variables
+static struct dep_node	**nodes		= NULL;	// in order of creation
+static int		nodes_count	= 0;
+static int		nodes_size	= 0;
+static int		visit_count	= 0;
+// symbols read by current statement
+static struct dep_read	*statement_reads	= NULL;
+static int		statement_count		= 0;
+static int		statement_size		= 0;
+// addressing modes chosen for unsure values in current pass
+static struct unsure_size	*unsures	= NULL;
+static int			unsures_count	= 0;
+static int			unsures_size	= 0;
+static struct dep_read		*unsure_reads	= NULL;
+static int			unsure_reads_count	= 0;
+static int			unsure_reads_size	= 0;
+static	STRUCT_DYNABUF_REF(unsure_texts, 1024);
+
+
+// make room for one more array element
+static void *make_room(void *array, int count, int *size, size_t element_size, int initial_size)
+{
+	if (count < *size)
+		return array;
+
+	*size = *size ? 2 * *size : initial_size;
+	array = realloc(array, *size * element_size);
+	if (array == NULL)
+		Throw_serious_error(exception_no_memory_left);
+	return array;
+}
+
+
+// forget graph
+void depgraph_clear(void)
+{
+	int	ii;
+
+	for (ii = 0; ii < nodes_count; ++ii) {
+		free(nodes[ii]->reads);
+		safe_free(nodes[ii]->filename);
+		safe_free(nodes[ii]);
+	}
+	nodes_count = 0;
+	statement_count = 0;
+	depgraph_passinit();
+}
+
+
+// forget addressing mode decisions of previous pass
+void depgraph_passinit(void)
+{
+	unsures_count = 0;
+	unsure_reads_count = 0;
+	DYNABUF_CLEAR(unsure_texts);
+}
+
+
+// forget symbols read so far
+void depgraph_statement(void)
+{
+	statement_count = 0;
+}
+
+
+// create graph node for symbol, if it does not have one yet
+void depgraph_note_node(struct rwnode *node, scope_t scope)
+{
+	struct symbol	*symbol	= node->body;
+	struct dep_node	*dep;
+
+	if ((!config.pass_report) || symbol->dep)
+		return;
+
+	dep = safe_malloc(sizeof(*dep));
+	dep->name = node->id_string;
+	// scopes of locals are even, those of cheap locals are odd
+	if ((scope == SCOPE_GLOBAL) || (*dep->name == '+') || (*dep->name == '-'))
+		dep->prefix = 0;
+	else if (scope & 1)
+		dep->prefix = CHEAP_PREFIX;
+	else
+		dep->prefix = LOCAL_PREFIX;
+	dep->defined_pass = -1;
+	dep->read_pass = -1;
+	dep->reads = NULL;
+	dep->read_count = 0;
+	dep->filename = NULL;
+	dep->line_number = 0;
+	dep->visit = 0;
+	symbol->dep = dep;
+	nodes = make_room(nodes, nodes_count, &nodes_size, sizeof(*nodes), NODES_INITIAL_SIZE);
+	nodes[nodes_count++] = dep;
+}
+
+
+// add symbol to reads of current statement
+void depgraph_note_read(struct symbol *symbol, const struct object *value)
+{
+	struct dep_read	*read;
+
+	if ((!config.pass_report) || (symbol->dep == NULL))
+		return;
+
+	statement_reads = make_room(statement_reads, statement_count, &statement_size, sizeof(*statement_reads), READS_INITIAL_SIZE);
+	read = &statement_reads[statement_count++];
+	read->node = symbol->dep;
+	read->undefined = !value->type->is_defined(value);
+	read->unsure = read->undefined
+		|| ((value->type == &type_number) && (value->u.number.flags & NUMBER_EVER_UNDEFINED));
+}
+
+
+// symbol has been defined by current statement
+void depgraph_define(struct symbol *symbol)
+{
+	struct dep_node	*dep	= symbol->dep;
+	boolean		defined;
+
+	if ((!config.pass_report) || (dep == NULL) || (dep->defined_pass != -1))
+		return;	// if already defined, keep reads that explain when it happened
+
+	defined = symbol->object.type->is_defined(&symbol->object);
+	// keep reads of last pass in which symbol was still undefined
+	if ((!defined) || (dep->read_pass == -1)) {
+		dep->reads = realloc(dep->reads, (statement_count ? statement_count : 1) * sizeof(*dep->reads));
+		if (dep->reads == NULL)
+			Throw_serious_error(exception_no_memory_left);
+		if (statement_count)	// (statement_reads may still be NULL)
+			memcpy(dep->reads, statement_reads, statement_count * sizeof(*dep->reads));
+		dep->read_count = statement_count;
+		dep->read_pass = pass.number;
+		safe_free(dep->filename);
+		dep->filename = safe_malloc(strlen(Input_now->original_filename) + 1);
+		strcpy(dep->filename, Input_now->original_filename);
+		dep->line_number = Input_now->line_number;
+	}
+	if (defined)
+		dep->defined_pass = pass.number;
+}
+
+
+// addressing mode of current statement was chosen for unsure value
+void depgraph_unsure_size(void)
+{
+	struct unsure_size	*unsure;
+	int			ii;
+
+	if (!config.pass_report)
+		return;
+
+	unsures = make_room(unsures, unsures_count, &unsures_size, sizeof(*unsures), NODES_INITIAL_SIZE);
+	unsure = &unsures[unsures_count++];
+	unsure->filename = unsure_texts->size;
+	DynaBuf_add_string(unsure_texts, Input_now->original_filename);
+	DynaBuf_append(unsure_texts, '\0');
+	unsure->line_number = Input_now->line_number;
+	unsure->first_read = unsure_reads_count;
+	for (ii = 0; ii < statement_count; ++ii) {
+		if (!statement_reads[ii].unsure)
+			continue;
+
+		unsure_reads = make_room(unsure_reads, unsure_reads_count, &unsure_reads_size, sizeof(*unsure_reads), NODES_INITIAL_SIZE);
+		unsure_reads[unsure_reads_count++] = statement_reads[ii];
+	}
+	unsure->read_count = unsure_reads_count - unsure->first_read;
+}
+
+
+// print name of symbol
+static void print_name(FILE *fd, const struct dep_node *dep)
+{
+	const char	*name	= dep->name;
+
+	if (dep->prefix)
+		fputc(dep->prefix, fd);
+	// forward anon labels have a counter appended to their name
+	if (*name == '+') {
+		while (*name == '+')
+			fputc(*name++, fd);
+	} else {
+		fputs(name, fd);
+	}
+}
+
+
+// get pass in which symbol got its value (never => after all others)
+static int defined_pass(const struct dep_node *dep)
+{
+	return (dep->defined_pass == -1) ? pass.number + 1 : dep->defined_pass;
+}
+
+
+// find the read the symbol had to wait for longest: the one that was undefined
+// at the time and got defined in the latest pass (or not at all)
+static struct dep_node *latest_undefined_read(const struct dep_node *dep)
+{
+	struct dep_node	*latest	= NULL;
+	int		ii;
+
+	for (ii = 0; ii < dep->read_count; ++ii) {
+		if (!dep->reads[ii].undefined)
+			continue;
+
+		if ((latest == NULL) || (defined_pass(dep->reads[ii].node) > defined_pass(latest)))
+			latest = dep->reads[ii].node;
+	}
+	return latest;
+}
+
+
+// print symbol and the chain of forward references it was waiting for
+static void print_chain(FILE *fd, struct dep_node *dep)
+{
+	int	length	= 0;
+
+	++visit_count;
+	fputc('\t', fd);
+	print_name(fd, dep);
+	fprintf(fd, " (%s, line %d)", dep->filename, dep->line_number);
+	dep->visit = visit_count;
+	while ((dep = latest_undefined_read(dep))) {
+		if ((dep->visit == visit_count) || (++length == MAX_CHAIN_LENGTH)) {
+			fputs(" <- ...", fd);
+			break;
+		}
+
+		dep->visit = visit_count;
+		fputs(" <- ", fd);
+		print_name(fd, dep);
+		if (dep->defined_pass == -1)
+			fputs(" (undefined)", fd);
+		else
+			fprintf(fd, " (pass %d)", dep->defined_pass + 1);
+	}
+	fputc('\n', fd);
+}
+
+
+// write report about what caused each further pass
+void depgraph_report(FILE *fd)
+{
+	int	pass_nr,
+		ii,
+		jj,
+		count;
+
+	if (!config.pass_report)
+		return;
+
+	fprintf(fd, "Pass report: %d pass(es).\n", pass.number + 1);
+	for (pass_nr = 1; pass_nr <= pass.number; ++pass_nr) {
+		count = 0;
+		for (ii = 0; ii < nodes_count; ++ii) {
+			if (nodes[ii]->defined_pass == pass_nr)
+				++count;
+		}
+		if (count == 0)
+			continue;
+
+		fprintf(fd, "Pass %d was needed for %d symbol(s):\n", pass_nr + 1, count);
+		for (ii = 0; ii < nodes_count; ++ii) {
+			if (nodes[ii]->defined_pass == pass_nr)
+				print_chain(fd, nodes[ii]);
+		}
+	}
+	count = 0;
+	for (ii = 0; ii < nodes_count; ++ii) {
+		if ((nodes[ii]->defined_pass == -1) && (nodes[ii]->read_pass != -1))
+			++count;
+	}
+	if (count) {
+		fprintf(fd, "Still undefined after pass %d: %d symbol(s):\n", pass.number + 1, count);
+		for (ii = 0; ii < nodes_count; ++ii) {
+			if ((nodes[ii]->defined_pass == -1) && (nodes[ii]->read_pass != -1))
+				print_chain(fd, nodes[ii]);
+		}
+	}
+	if (unsures_count) {
+		fprintf(fd, "Addressing modes chosen for unsure values in pass %d: %d\n", pass.number + 1, unsures_count);
+		for (ii = 0; ii < unsures_count; ++ii) {
+			fprintf(fd, "\t%s, line %d:", unsure_texts->buffer + unsures[ii].filename, unsures[ii].line_number);
+			for (jj = 0; jj < unsures[ii].read_count; ++jj) {
+				fputc(' ', fd);
+				print_name(fd, unsure_reads[unsures[ii].first_read + jj].node);
+			}
+			fputc('\n', fd);
+		}
+	}
+}
@@ -0,0 +1,40 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Symbol dependency graph and pass report ("--pass-report")
+#ifndef depgraph_H
+#define depgraph_H
+
+
+#include <stdio.h>
+#include "config.h"
+
+
+struct object;
+struct rwnode;
+struct symbol;
+
+// Prototypes
+// (all functions do nothing unless config.pass_report is set)
+
+// forget graph (the symbols are about to be freed)
+extern void depgraph_clear(void);
+// start of pass: forget addressing mode decisions of previous pass
+extern void depgraph_passinit(void);
+// start of statement: forget symbols read so far
+extern void depgraph_statement(void);
+// called when a symbol's tree node has been looked up
+extern void depgraph_note_node(struct rwnode *node, scope_t scope);
+// called when a symbol's value has been read by an expression
+extern void depgraph_note_read(struct symbol *symbol, const struct object *value);
+// called after a symbol has been defined by the current statement
+extern void depgraph_define(struct symbol *symbol);
+// called when the addressing mode of the current statement was chosen
+// without knowing the argument's value for sure
+extern void depgraph_unsure_size(void);
+// write report about what caused each further pass
+extern void depgraph_report(FILE *fd);
+
+
+#endif
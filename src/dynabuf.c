@@ -40,6 +40,7 @@ static void resize(struct dynabuf *db, size_t new_size)
 	new_buf = realloc(db->buffer, new_size);
 	if (new_buf == NULL)
 		Throw_serious_error(exception_no_memory_left);
+	memstats_account(MEM_BUFFERS, db->reserved, new_size);
 	db->reserved = new_size;
 	db->buffer = new_buf;
 }
@@ -57,6 +58,7 @@ static void initstruct(struct dynabuf *db, size_t initial_size)
 		fputs("Error: No memory for dynamic buffer.\n", stderr);
 		exit(EXIT_FAILURE);
 	}
+	memstats_account(MEM_BUFFERS, 0, initial_size);
 }
 
 
@@ -78,7 +80,7 @@ void dynabuf_enlarge(struct dynabuf *db)
 
 // Claim enough memory to hold a copy of the current buffer contents,
 // make that copy and return it.
-// The copy must be released by calling free().
+// The copy must be released by calling safe_free().
 char *DynaBuf_get_copy(struct dynabuf *db)
 {
 	char	*copy;
@@ -49,7 +49,7 @@ extern struct dynabuf	GlobalDynaBuf[1];	// global dynamic buffer
 extern void dynabuf_clear(struct dynabuf *db);
 // call whenever buffer is too small
 extern void dynabuf_enlarge(struct dynabuf *db);
-// return malloc'd copy of buffer contents
+// return malloc'd copy of buffer contents (release with safe_free())
 extern char *DynaBuf_get_copy(struct dynabuf *db);
 // copy string to buffer (without terminator)
 extern void DynaBuf_add_string(struct dynabuf *db, const char *);
@@ -108,11 +108,15 @@ void encoding_passinit(void)
 	encoder_current = &encoder_raw;
 }
 
-// try to load encoding table from given file
-void encoding_load_from_file(unsigned char target[256], FILE *stream)
+// try to load encoding table from given file contents
+void encoding_load_from_file(unsigned char target[256], const struct filecontents *file)
 {
-	if (fread(target, sizeof(char), 256, stream) != 256)
+	if (file->size < 256) {
+		memcpy(target, file->data, file->size);
 		Throw_error("Conversion table incomplete.");
+	} else {
+		memcpy(target, file->data, 256);
+	}
 }
 
 // lookup encoder held in DynaBuf and return its struct pointer (or NULL on failure)
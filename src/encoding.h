@@ -7,7 +7,7 @@
 #define encoding_H
 
 
-#include <stdio.h>	// for FILE*
+#include "input.h"	// for struct filecontents
 
 
 //struct encoder;
@@ -25,8 +25,8 @@ extern unsigned char		*encoding_loaded_table;	// ...loaded from file
 extern unsigned char encoding_encode_char(unsigned char byte);
 // set "raw" as default encoding
 extern void encoding_passinit(void);
-// try to load encoding table from given file
-extern void encoding_load_from_file(unsigned char target[256], FILE *stream);
+// try to load encoding table from given file contents
+extern void encoding_load_from_file(unsigned char target[256], const struct filecontents *file);
 // lookup encoder held in DynaBuf and return its struct pointer (or NULL on failure)
 extern const struct encoder *encoding_find(void);
 
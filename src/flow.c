@@ -19,14 +19,149 @@
 #include "dynabuf.h"
 #include "global.h"
 #include "input.h"
+#include "macro.h"
 #include "mnemo.h"
+#include "output.h"
+#include "profile.h"
+#include "pseudoopcodes.h"
+#include "replay.h"
 #include "symbol.h"
 #include "tree.h"
+#include "typesystem.h"
+#include "workers.h"
+
+
+// Constants
+#define DATA_LOOP_MAX_STATEMENTS	8	// larger bodies are parsed normally
+#define DATA_LOOP_BATCH_SIZE		4096	// iterations computed in advance
+#define IFDEF_MISSES_INITIAL_SIZE	16
+#define IFDEF_NAMES_INITIALSIZE		256
+
+
+// "!ifdef"/"!ifndef" tests of current pass that did not find the symbol. if
+// the symbol gets created later on, the test gives a different result in the
+// next pass (see flow_ifdef_results_final()).
+struct ifdef_miss {
+	scope_t	scope;
+	int	name;	// offset in ifdef_names
+};
+static struct ifdef_miss	*ifdef_misses		= NULL;
+static int			ifdef_misses_count	= 0;
+static int			ifdef_misses_size	= 0;
+static	STRUCT_DYNABUF_REF(ifdef_names, IFDEF_NAMES_INITIALSIZE);
+static boolean			ifdef_saw_undefined	= FALSE;	// symbol existed without value
+
+
+// execution context frames
+
+struct flow_frame	*flow_frame_top	= NULL;	// innermost frame
+
+
+// activate frame
+void flow_push_frame(struct flow_frame *frame, boolean (*end)(struct flow_frame *), void (*discard)(struct flow_frame *))
+{
+	frame->outer = flow_frame_top;
+	frame->end = end;
+	frame->discard = discard;
+	flow_frame_top = frame;
+	// end current statement, so the parser loop fetches the first byte of
+	// the new input next
+	GotByte = CHAR_EOS;
+}
+
+
+// finish innermost frame
+void flow_end_frame(void)
+{
+	struct flow_frame	*frame	= flow_frame_top;
+
+	if (frame->end(frame))
+		return;	// block is to be parsed again
+
+	flow_frame_top = frame->outer;
+	safe_free(frame);
+}
+
+
+// forget all frames (after assembly was aborted)
+void flow_abort(void)
+{
+	struct flow_frame	*frame;
+
+	while ((frame = flow_frame_top)) {
+		flow_frame_top = frame->outer;
+		if (frame->discard)
+			frame->discard(frame);
+		safe_free(frame);
+	}
+	// the frames held the inputs, memo and replay frames and timings of
+	// the blocks in progress
+	Input_reset();
+	macro_passinit();
+	replay_passinit();
+	profile_passinit();
+}
 
 
 // helper functions for if/ifdef/ifndef/else/for/do/while
 
 
+// remember that symbol (name in GlobalDynaBuf) was not found by "!ifdef"
+static void note_ifdef_miss(scope_t scope)
+{
+	struct ifdef_miss	*miss;
+
+	// no need for another entry if the previous miss was the same name
+	if (ifdef_misses_count) {
+		miss = &ifdef_misses[ifdef_misses_count - 1];
+		if ((miss->scope == scope)
+		&& (strcmp(ifdef_names->buffer + miss->name, GLOBALDYNABUF_CURRENT) == 0))
+			return;
+	}
+	if (ifdef_misses_count == ifdef_misses_size) {
+		ifdef_misses_size = ifdef_misses_size ? 2 * ifdef_misses_size : IFDEF_MISSES_INITIAL_SIZE;
+		ifdef_misses = tagged_realloc(ifdef_misses, ifdef_misses_size * sizeof(*ifdef_misses), MEM_ALU);
+	}
+	miss = &ifdef_misses[ifdef_misses_count++];
+	miss->scope = scope;
+	miss->name = ifdef_names->size;
+	DynaBuf_add_string(ifdef_names, GLOBALDYNABUF_CURRENT);
+	DynaBuf_append(ifdef_names, '\0');
+}
+
+
+// forget "!ifdef"/"!ifndef" tests (called at start of each pass)
+void flow_passinit(void)
+{
+	ifdef_misses_count = 0;
+	DYNABUF_CLEAR(ifdef_names);
+	ifdef_saw_undefined = FALSE;
+}
+
+
+// check whether "!ifdef"/"!ifndef" tests of current pass would give the same
+// results in another pass: none of them may have seen a symbol without value,
+// and none of the symbols they did not find may have been created since.
+boolean flow_ifdef_results_final(void)
+{
+	struct rwnode	*node;
+	int		ii;
+
+	if (ifdef_saw_undefined)
+		return FALSE;
+
+	for (ii = 0; ii < ifdef_misses_count; ++ii) {
+		DYNABUF_CLEAR(GlobalDynaBuf);
+		DynaBuf_add_string(GlobalDynaBuf, ifdef_names->buffer + ifdef_misses[ii].name);
+		DynaBuf_append(GlobalDynaBuf, '\0');
+		Tree_hard_scan(&node, symbols_forest, ifdef_misses[ii].scope, FALSE);
+		if (node)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+
 // parse symbol name and return if symbol has defined value (called by ifdef/ifndef)
 boolean check_ifdef_condition(void)
 {
@@ -39,45 +174,71 @@ boolean check_ifdef_condition(void)
 		return FALSE;	// there was an error, it has been reported, so return value is more or less meaningless anway
 
 	// look for it
+	macro_memo_check_scope(scope);
 	Tree_hard_scan(&node, symbols_forest, scope, FALSE);
-	if (!node)
+	if (!node) {
+		replay_taint();	// symbol might be created later on
+		note_ifdef_miss(scope);	// (so might be its value)
 		return FALSE;	// not found -> no, not defined
+	}
 
 	symbol = (struct symbol *) node->body;
+	replay_note_symbol(symbol);
 	symbol->has_been_read = TRUE;	// we did not really read the symbol's value, but checking for its existence still counts as "used it"
 	if (symbol->object.type == NULL)
 		Bug_found("ObjectHasNullType", 0);
-	return symbol->object.type->is_defined(&symbol->object);
+	if (symbol->object.type->is_defined(&symbol->object))
+		return TRUE;
+
+	ifdef_saw_undefined = TRUE;	// value might be found in a later pass
+	return FALSE;
 }
 
 
-// parse a loop body (TODO - also use for macro body?)
-static void parse_ram_block(struct block *block)
+// set up input for (next run of) loop body
+static void start_ram_block(struct block *block)
 {
 	Input_now->line_number = block->start;	// set line number to loop start
 	Input_now->src.ram_ptr = block->body;	// set RAM read pointer to loop
-	// parse block
-	Parse_until_eob_or_eof();
-	if (GotByte != CHAR_EOB)
-		Bug_found("IllegalBlockTerminator", GotByte);
 }
 
 
-// function for "!for" with counter variable
-static void counting_for(struct for_loop *loop)
+// statement of a "data only" loop body (see scan_data_body() below)
+struct data_statement {
+	const struct data_pseudoopcode	*pseudoopcode;
+	char				*arguments;	// RAM read pointer to first byte of arguments
+	int				line_number;
+	int				values;	// number of expressions (when recorded)
+};
+
+// "!for" loop context
+struct for_frame {
+	struct flow_frame	frame;
+	struct for_loop		loop;
+	struct object		loop_var;	// local copy of counter (counting loops)
+	intval_t		index;	// next element (iterating loops)
+	struct input		loop_input,
+				*outer_input;
+	intval_t		iterations;	// total (for profiler)
+	int			data_count;	// number of data statements, or zero
+	struct data_statement	data[DATA_LOOP_MAX_STATEMENTS];
+};
+
+// set up loop counter for counting "!for"
+static void init_counter(struct for_frame *frame)
 {
-	struct object	loop_var;
+	struct for_loop	*loop	= &frame->loop;
 
 	// init counter
-	loop_var.type = &type_number;
-	loop_var.u.number.ntype = NUMTYPE_INT;
-	loop_var.u.number.flags = 0;
-	loop_var.u.number.val.intval = 0;	// SEE BELOW - default value if old algo skips loop entirely
-	loop_var.u.number.addr_refs = loop->u.counter.addr_refs;
+	frame->loop_var.type = &type_number;
+	frame->loop_var.u.number.ntype = NUMTYPE_INT;
+	frame->loop_var.u.number.flags = 0;
+	frame->loop_var.u.number.val.intval = 0;	// SEE BELOW - default value if old algo skips loop entirely
+	frame->loop_var.u.number.addr_refs = loop->u.counter.addr_refs;
 	// CAUTION: next line does not have power to change symbol type, but if
 	// "symbol already defined" error is thrown, the type will still have
 	// been changed. this was done so the code below has a counter var.
-	symbol_set_object(loop->symbol, &loop_var, POWER_CHANGE_VALUE);
+	symbol_set_object(loop->symbol, &frame->loop_var, POWER_CHANGE_VALUE);
 	// TODO: in versions before 0.97, force bit handling was broken
 	// in both "!set" and "!for":
 	// trying to change a force bit correctly raised an error, but
@@ -87,65 +248,280 @@ static void counting_for(struct for_loop *loop)
 	// maybe support this behaviour via --dialect?
 	if (loop->u.counter.force_bit)
 		symbol_set_force_bit(loop->symbol, loop->u.counter.force_bit);
-	loop_var = loop->symbol->object;	// update local copy with force bit
+	frame->loop_var = loop->symbol->object;	// update local copy with force bit
 	loop->symbol->has_been_read = TRUE;	// lock force bit
-	loop_var.u.number.val.intval = loop->u.counter.first;	// SEE ABOVE - this may be nonzero, but has not yet been copied to user symbol!
-	while (loop->iterations_left) {
-		loop->symbol->object = loop_var;	// overwrite whole struct, in case some joker has re-assigned loop counter var
-		parse_ram_block(&loop->block);
-		loop_var.u.number.val.intval += loop->u.counter.increment;
-		loop->iterations_left--;
-	}
-	// new algo wants illegal value in loop counter after block:
-	if (loop->algorithm == FORALGO_NEWCOUNT)
-		loop->symbol->object = loop_var;	// overwrite whole struct, in case some joker has re-assigned loop counter var
+	frame->loop_var.u.number.val.intval = loop->u.counter.first;	// SEE ABOVE - this may be nonzero, but has not yet been copied to user symbol!
 }
 
-// function for "!for" with iterating variable
-static void iterating_for(struct for_loop *loop)
+// if there are iterations left, set loop var and input for next one
+static boolean for_next_iteration(struct for_frame *frame)
 {
-	intval_t	index	= 0;
 	struct object	obj;
 
-	while (loop->iterations_left) {
-		loop->u.iter.obj.type->at(&loop->u.iter.obj, &obj, index++);
-		symbol_set_object(loop->symbol, &obj, POWER_CHANGE_VALUE | POWER_CHANGE_OBJTYPE);
-		parse_ram_block(&loop->block);
-		loop->iterations_left--;
+	if (frame->loop.iterations_left == 0)
+		return FALSE;
+
+	if (frame->loop.algorithm == FORALGO_ITERATE) {
+		frame->loop.u.iter.obj.type->at(&frame->loop.u.iter.obj, &obj, frame->index++);
+		symbol_set_object(frame->loop.symbol, &obj, POWER_CHANGE_VALUE | POWER_CHANGE_OBJTYPE);
+	} else {
+		frame->loop.symbol->object = frame->loop_var;	// overwrite whole struct, in case some joker has re-assigned loop counter var
+	}
+	start_ram_block(&frame->loop.block);
+	return TRUE;
+}
+
+// advance loop var after an iteration
+static void for_advance(struct for_frame *frame)
+{
+	if (frame->loop.algorithm != FORALGO_ITERATE)
+		frame->loop_var.u.number.val.intval += frame->loop.u.counter.increment;
+	frame->loop.iterations_left--;
+}
+
+// check whether loop body consists of nothing but data pseudo opcodes (like
+// "!byte" or "!word") and remember where their arguments start, so
+// run_data_loop() can skip the statement parser. lots of tables are
+// generated like this.
+// returns number of statements, or zero if body is not "data only".
+static int scan_data_body(struct for_frame *frame)
+{
+	int	count	= 0;
+
+	start_ram_block(&frame->loop.block);
+	for (;;) {
+		GetByte();
+		SKIPSPACE();
+		if (GotByte == CHAR_EOS)
+			continue;	// empty statement
+		if (GotByte == CHAR_SOL)
+			continue;	// start of line (GetByte() has counted it)
+		if (GotByte == CHAR_EOB)
+			return count;
+
+		if ((GotByte != config.pseudoop_prefix)
+		|| (count == DATA_LOOP_MAX_STATEMENTS))
+			return 0;
+
+		GetByte();	// skip prefix
+		if (Input_read_and_lower_keyword() == 0)
+			return 0;
+
+		frame->data[count].pseudoopcode = pseudoopcode_find_data();
+		if (frame->data[count].pseudoopcode == NULL)
+			return 0;
+
+		SKIPSPACE();
+		if (GotByte == CHAR_EOS)
+			return 0;	// no arguments, let the parser complain
+
+		frame->data[count].arguments = Input_now->src.ram_ptr - 1;	// GetByte() has already read first byte
+		frame->data[count].line_number = Input_now->line_number;
+		++count;
+		Input_skip_remainder();
 	}
 }
 
+// do an iteration of a "data only" loop
+static void run_data_iteration(struct for_frame *frame)
+{
+	struct data_statement	*statement;
+	int			ii,
+				values;
+
+	for (ii = 0; ii < frame->data_count; ++ii) {
+		statement = &frame->data[ii];
+		Input_now->line_number = statement->line_number;
+		Input_now->src.ram_ptr = statement->arguments;
+		profile_statement_begin();
+		values = ALU_record_count();
+		GetByte();	// fetch first byte of arguments
+		typesystem_force_address_statement(FALSE);
+		pseudoopcode_call(statement->pseudoopcode);
+		if (GotByte != CHAR_EOS)
+			Bug_found("DataStatementNotAtEOS", GotByte);
+		statement->values = ALU_record_count() - values;
+		vcpu_end_statement();	// adjust program counter
+		profile_statement_end(FALSE);
+	}
+	for_advance(frame);
+}
+
+// batch of iterations of a counting "data only" loop, computed in advance
+struct data_batch {
+	const struct alu_program	*program;	// expressions of loop body
+	struct object			counter;	// loop counter of first iteration
+	intval_t			increment;
+	int				values;	// number of values per iteration
+	struct object			*results;
+};
+
+// compute given iterations of batch (called by worker threads)
+static void compute_data_batch(void *arg, int first, int end)
+{
+	struct data_batch	*batch	= arg;
+	struct object		counter	= batch->counter;
+
+	for (; first < end; ++first) {
+		counter.u.number.val.intval = batch->counter.u.number.val.intval + first * batch->increment;
+		ALU_run_program(batch->program, &counter, batch->results + first * batch->values);
+	}
+}
+
+// do remaining iterations of a counting "data only" loop: compute batches of
+// iterations in parallel, then output their values in order. returns FALSE
+// if computing a batch caused warnings or errors, then the remaining
+// iterations must be parsed to show them.
+static boolean run_data_batches(struct for_frame *frame, const struct alu_program *program)
+{
+	struct data_batch	batch;
+	struct data_statement	*statement;
+	struct object		*value;
+	int			size,	// iterations per batch
+				count,	// iterations in current batch
+				ii,
+				jj;
+
+	batch.program = program;
+	batch.increment = frame->loop.u.counter.increment;
+	batch.values = 0;
+	for (ii = 0; ii < frame->data_count; ++ii)
+		batch.values += frame->data[ii].values;
+	size = (frame->loop.iterations_left < DATA_LOOP_BATCH_SIZE) ? frame->loop.iterations_left : DATA_LOOP_BATCH_SIZE;
+	batch.results = tagged_malloc(size * batch.values * sizeof(*batch.results), MEM_LOOPS);
+	for (;;) {
+		count = (frame->loop.iterations_left < size) ? frame->loop.iterations_left : size;
+		batch.counter = frame->loop_var;
+		if (!workers_run(count, compute_data_batch, &batch)) {
+			safe_free(batch.results);
+			return FALSE;
+		}
+		value = batch.results;
+		do {
+			for (ii = 0; ii < frame->data_count; ++ii) {
+				statement = &frame->data[ii];
+				Input_now->line_number = statement->line_number;
+				profile_statement_begin();
+				typesystem_force_address_statement(FALSE);
+				for (jj = 0; jj < statement->values; ++jj)
+					pseudoopcode_output(statement->pseudoopcode, value++);
+				vcpu_end_statement();	// adjust program counter
+				profile_statement_end(FALSE);
+			}
+			for_advance(frame);
+			if (!for_next_iteration(frame)) {
+				safe_free(batch.results);
+				return TRUE;
+			}
+		} while (--count);
+	}
+}
+
+// do all iterations of a "data only" loop. in counting loops, the expressions
+// of the first iteration are recorded, so the others can be computed without
+// parsing, on several threads (values still get output in order).
+static void run_data_loop(struct for_frame *frame)
+{
+	struct alu_program	*program	= NULL;
+
+	if (frame->loop.algorithm == FORALGO_ITERATE) {
+		run_data_iteration(frame);
+	} else {
+		ALU_record_start(frame->loop.symbol);
+		run_data_iteration(frame);
+		program = ALU_record_stop();
+	}
+	if (for_next_iteration(frame)
+	&& !(program && run_data_batches(frame, program))) {
+		do
+			run_data_iteration(frame);
+		while (for_next_iteration(frame));
+	}
+	if (program)
+		ALU_free_program(program);
+}
+
+// tidy up after last iteration
+static void for_finish(struct for_frame *frame)
+{
+	// new algo wants illegal value in loop counter after block:
+	if (frame->loop.algorithm == FORALGO_NEWCOUNT)
+		frame->loop.symbol->object = frame->loop_var;	// overwrite whole struct, in case some joker has re-assigned loop counter var
+	safe_free(frame->loop.block.body);
+	// restore previous input:
+	Input_now = frame->outer_input;
+	profile_end(frame->iterations);
+	// GotByte of outer input would be '}' (if it would still exist)
+	GetByte();	// fetch next byte
+	Input_ensure_EOS();
+}
+
+// end of "!for" loop body
+static boolean for_end(struct flow_frame *context)
+{
+	struct for_frame	*frame	= (struct for_frame *) context;
+
+	if (GotByte != CHAR_EOB)
+		Bug_found("IllegalBlockTerminator", GotByte);
+	for_advance(frame);
+	if (for_next_iteration(frame))
+		return TRUE;	// parse body again
+
+	for_finish(frame);
+	return FALSE;
+}
+
+// "!for" loop aborted
+static void for_discard(struct flow_frame *context)
+{
+	safe_free(((struct for_frame *) context)->loop.block.body);
+}
 
 // back end function for "!for" pseudo opcode
 void flow_forloop(struct for_loop *loop)
 {
-	struct input	loop_input,
-			*outer_input;
+	struct for_frame	*frame	= tagged_malloc(sizeof(*frame), MEM_LOOPS);
 
+	profile_begin(PROFILE_FOR, Input_now->original_filename, loop->block.start);
+	frame->loop = *loop;
+	safe_tag(frame->loop.block.body, MEM_LOOPS);
+	frame->index = 0;
+	frame->iterations = loop->iterations_left;
 	// switching input makes us lose GotByte. But we know it's '}' anyway!
 	// set up new input
-	loop_input = *Input_now;	// copy current input structure into new
-	loop_input.source = INPUTSRC_RAM;	// set new byte source
+	frame->loop_input = *Input_now;	// copy current input structure into new
+	frame->loop_input.source = INPUTSRC_RAM;	// set new byte source
 	// remember old input
-	outer_input = Input_now;
+	frame->outer_input = Input_now;
 	// activate new input
 	// (not yet useable; pointer and line number are still missing)
-	Input_now = &loop_input;
+	Input_now = &frame->loop_input;
 	// fix line number (not for block, but in case symbol handling throws errors)
 	Input_now->line_number = loop->block.start;
 	switch (loop->algorithm) {
 	case FORALGO_OLDCOUNT:
 	case FORALGO_NEWCOUNT:
-		counting_for(loop);
+		init_counter(frame);
 		break;
 	case FORALGO_ITERATE:
-		iterating_for(loop);
 		break;
 	default:
 		Bug_found("IllegalLoopAlgo", loop->algorithm);
 	}
-	// restore previous input:
-	Input_now = outer_input;
+	if (loop->iterations_left > 1)
+		frame->data_count = scan_data_body(frame);
+	else
+		frame->data_count = 0;	// not worth it
+	if (for_next_iteration(frame)) {
+		if (frame->data_count == 0) {
+			flow_push_frame(&frame->frame, for_end, for_discard);
+			return;
+		}
+
+		run_data_loop(frame);
+	}
+	for_finish(frame);
+	safe_free(frame);
 }
 
 
@@ -234,51 +610,166 @@ static boolean check_condition(struct condition *condition)
 }
 
 
+// "!do"/"!while" loop context
+struct do_while_frame {
+	struct flow_frame	frame;
+	struct do_while		loop;
+	struct input		loop_input,
+				*outer_input;
+	char			outer_gotbyte;
+	long			iterations;	// (for profiler)
+};
+
+// tidy up after loop
+static void do_while_finish(struct do_while_frame *frame)
+{
+	profile_end(frame->iterations);
+	safe_free(frame->loop.head_cond.body);
+	safe_free(frame->loop.block.body);
+	safe_free(frame->loop.tail_cond.body);
+	// restore previous input:
+	Input_now = frame->outer_input;
+	if (frame->outer_gotbyte == CHAR_EOB) {
+		// "!while": GotByte of outer input would be '}'
+		GotByte = CHAR_EOB;
+		GetByte();	// fetch next byte
+		Input_ensure_EOS();
+	} else {
+		GotByte = CHAR_EOS;	// CAUTION! Very ugly kluge.
+		// But by switching input, we lost the outer input's GotByte.
+		// We know it was CHAR_EOS. We could just call GetByte() to get
+		// real input, but then the main loop could choke on unexpected
+		// bytes. So we pretend that we got the outer input's GotByte
+		// value magically back.
+	}
+}
+
+// end of "!do"/"!while" loop body
+static boolean do_while_end(struct flow_frame *context)
+{
+	struct do_while_frame	*frame	= (struct do_while_frame *) context;
+
+	if (GotByte != CHAR_EOB)
+		Bug_found("IllegalBlockTerminator", GotByte);
+	// check tail condition, then head condition
+	if (check_condition(&frame->loop.tail_cond)
+	&& check_condition(&frame->loop.head_cond)) {
+		start_ram_block(&frame->loop.block);
+		++frame->iterations;
+		return TRUE;	// parse body again
+	}
+
+	do_while_finish(frame);
+	return FALSE;
+}
+
+// "!do"/"!while" loop aborted
+static void do_while_discard(struct flow_frame *context)
+{
+	struct do_while_frame	*frame	= (struct do_while_frame *) context;
+
+	safe_free(frame->loop.head_cond.body);
+	safe_free(frame->loop.block.body);
+	safe_free(frame->loop.tail_cond.body);
+}
+
 // back end function for "!do" and "!while" pseudo opcodes
 void flow_do_while(struct do_while *loop)
 {
-	struct input	loop_input;
-	struct input	*outer_input;
-
+	struct do_while_frame	*frame	= tagged_malloc(sizeof(*frame), MEM_LOOPS);
+
+	profile_begin(PROFILE_DO, Input_now->original_filename, loop->block.start);
+	frame->loop = *loop;
+	safe_tag(frame->loop.head_cond.body, MEM_LOOPS);
+	safe_tag(frame->loop.block.body, MEM_LOOPS);
+	safe_tag(frame->loop.tail_cond.body, MEM_LOOPS);
+	frame->outer_gotbyte = GotByte;
+	frame->iterations = 0;
 	// set up new input
-	loop_input = *Input_now;	// copy current input structure into new
-	loop_input.source = INPUTSRC_RAM;	// set new byte source
+	frame->loop_input = *Input_now;	// copy current input structure into new
+	frame->loop_input.source = INPUTSRC_RAM;	// set new byte source
 	// remember old input
-	outer_input = Input_now;
+	frame->outer_input = Input_now;
 	// activate new input (not useable yet, as pointer and
 	// line number are not yet set up)
-	Input_now = &loop_input;
-	for (;;) {
-		// check head condition
-		if (!check_condition(&loop->head_cond))
-			break;
-		parse_ram_block(&loop->block);
-		// check tail condition
-		if (!check_condition(&loop->tail_cond))
-			break;
+	Input_now = &frame->loop_input;
+	// check head condition
+	if (check_condition(&frame->loop.head_cond)) {
+		start_ram_block(&frame->loop.block);
+		frame->iterations = 1;
+		flow_push_frame(&frame->frame, do_while_end, do_while_discard);
+	} else {
+		do_while_finish(frame);
+		safe_free(frame);
 	}
-	// restore previous input:
-	Input_now = outer_input;
-	GotByte = CHAR_EOS;	// CAUTION! Very ugly kluge.
-	// But by switching input, we lost the outer input's GotByte. We know
-	// it was CHAR_EOS. We could just call GetByte() to get real input, but
-	// then the main loop could choke on unexpected bytes. So we pretend
-	// that we got the outer input's GotByte value magically back.
 }
 
 
 // parse a whole source code file
-void flow_parse_and_close_file(FILE *fd, const char *filename)
+void flow_parse_file(const struct filecontents *file, const char *filename)
 {
 	// be verbose
 	if (config.process_verbosity > 2)
 		printf("Parsing source file '%s'\n", filename);
+	profile_begin(PROFILE_FILE, file->path, 0);
 	// set up new input
-	Input_new_file(filename, fd);
+	Input_new_file(filename, file);
 	// Parse block and check end reason
 	Parse_until_eob_or_eof();
 	if (GotByte != CHAR_EOF)
 		Throw_error("Found '}' instead of end-of-file.");
-	// close sublevel src
-	fclose(Input_now->src.fd);
+	profile_end(1);
+}
+
+
+// "!source" context
+struct source_frame {
+	struct flow_frame	frame;
+	struct input		file_input,
+				*outer_input;
+	char			outer_gotbyte;
+	char			*filename;
+	struct replay_frame	replay;
+};
+
+// end of included file
+static boolean source_end(struct flow_frame *context)
+{
+	struct source_frame	*frame	= (struct source_frame *) context;
+
+	if (GotByte != CHAR_EOF)
+		Throw_error("Found '}' instead of end-of-file.");
+	Input_now = frame->outer_input;	// restore previous input
+	GotByte = frame->outer_gotbyte;	// CAUTION - ugly kluge
+	safe_free(frame->filename);
+	replay_end(&frame->replay);
+	profile_end(1);	// (timing was started by "!source")
+	++source_recursions_left;	// leave nesting level (entered by "!source")
+	Input_ensure_EOS();
+	return FALSE;
+}
+
+// included file aborted
+static void source_discard(struct flow_frame *context)
+{
+	safe_free(((struct source_frame *) context)->filename);
+}
+
+// start parsing an included source code file ("!source")
+void flow_include_file(const struct filecontents *file, const char *filename)
+{
+	struct source_frame	*frame	= safe_malloc(sizeof(*frame));
+
+	frame->filename = safe_malloc(strlen(filename) + 1);
+	strcpy(frame->filename, filename);
+	frame->outer_input = Input_now;	// remember old input
+	frame->outer_gotbyte = GotByte;	// CAUTION - ugly kluge
+	Input_now = &frame->file_input;	// activate new input
+	// be verbose
+	if (config.process_verbosity > 2)
+		printf("Parsing source file '%s'\n", frame->filename);
+	// set up new input
+	Input_new_file(frame->filename, file);
+	replay_start(&frame->replay, file);
+	flow_push_frame(&frame->frame, source_end, source_discard);
 }
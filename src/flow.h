@@ -7,10 +7,25 @@
 #define flow_H
 
 
-#include <stdio.h>
 #include "config.h"
+#include "input.h"	// for struct filecontents
 
 
+// execution context frame: macro calls, "!source", "!if" blocks and loops do
+// not call the parser recursively. instead they set up their input, put a
+// frame on a heap-allocated stack and let the current parser loop go on with
+// the new input. when that loop reaches the end of the block or file, it calls
+// the frame's "end" function. so nesting depth is not limited by the C stack.
+struct flow_frame {
+	struct flow_frame	*outer;
+	// called at end of block/file. returns TRUE if the block is to be
+	// parsed again (loops), then input must have been set up again.
+	boolean			(*end)(struct flow_frame *frame);
+	// called instead of "end" if assembly gets aborted. releases what the
+	// frame owns (apart from the frame itself). NULL if there is nothing.
+	void			(*discard)(struct flow_frame *frame);
+};
+
 struct block {
 	int	start;	// line number of start of block
 	char	*body;
@@ -53,9 +68,28 @@ struct do_while {
 };
 
 
+// current innermost frame (NULL if there is none)
+extern struct flow_frame	*flow_frame_top;
+
+
+// activate frame (must have been malloc'd, will be freed after "end" returned
+// FALSE). sets GotByte to CHAR_EOS, so the current statement ends and the
+// parser goes on with the new input, which must already be set up.
+extern void flow_push_frame(struct flow_frame *frame, boolean (*end)(struct flow_frame *), void (*discard)(struct flow_frame *));
+// called by parser at end of block or file: finish innermost frame
+extern void flow_end_frame(void);
+// forget all frames and everything else about blocks in progress (after
+// assembly was aborted by longjmp())
+extern void flow_abort(void);
 // parse symbol name and return if symbol has defined value (called by ifdef/ifndef)
 extern boolean check_ifdef_condition(void);
+// forget "!ifdef"/"!ifndef" tests (called at start of each pass)
+extern void flow_passinit(void);
+// check whether "!ifdef"/"!ifndef" tests of current pass would give the same
+// results in another pass
+extern boolean flow_ifdef_results_final(void);
 // back end function for "!for" pseudo opcode
+// (takes ownership of loop body, call with GotByte = '}')
 extern void flow_forloop(struct for_loop *loop);
 // try to read a condition into DynaBuf and store pointer to copy in
 // given condition structure.
@@ -66,10 +100,14 @@ extern void flow_store_doloop_condition(struct condition *condition, char termin
 // given condition structure.
 // call with GotByte = first interesting character
 extern void flow_store_while_condition(struct condition *condition);
-// back end function for "!do" pseudo opcode
+// back end function for "!do" and "!while" pseudo opcodes
+// (takes ownership of conditions and loop body, call with GotByte = '}' if
+// block was last part of statement, with CHAR_EOS otherwise)
 extern void flow_do_while(struct do_while *loop);
 // parse a whole source code file
-extern void flow_parse_and_close_file(FILE *fd, const char *filename);
+extern void flow_parse_file(const struct filecontents *file, const char *filename);
+// start parsing an included source code file ("!source")
+extern void flow_include_file(const struct filecontents *file, const char *filename);
 
 
 #endif
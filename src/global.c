@@ -13,15 +13,19 @@
 #include "global.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "platform.h"
 #include "acme.h"
 #include "alu.h"
 #include "cpu.h"
+#include "depgraph.h"
 #include "dynabuf.h"
 #include "encoding.h"
+#include "flow.h"
 #include "input.h"
 #include "macro.h"
 #include "output.h"
+#include "profile.h"
 #include "pseudoopcodes.h"
 #include "section.h"
 #include "symbol.h"
@@ -50,6 +54,10 @@ const char	exception_symbol_defined[]	= "Symbol already defined.";
 const char	exception_syntax[]		= "Syntax error.";
 // default value for number of errors before exiting
 #define MAXERRORS	10
+// room for line number and fixed parts of messages
+#define MESSAGE_OVERHEAD	64
+// strings and lists of bytes are sent to output in runs of this size
+#define OUTPUT_RUN_SIZE	256
 
 // Flag table:
 // This table contains flags for all the 256 possible byte values. The
@@ -104,6 +112,15 @@ char		GotByte;			// Last byte read (processed)
 struct report 	*report			= NULL;
 struct config	config;
 struct pass	pass;
+void		(*abort_assembly)(void)	= NULL;	// called on serious errors
+void		(*trap_message)(void)	= NULL;	// called instead of outputting messages
+const char	*symbollist_filename	= NULL;
+const char	*output_filename	= NULL;
+const char	*report_filename	= NULL;
+// maximum recursion depth for macro calls and "!source"
+signed long	macro_recursions_left	= MAX_NESTING;
+signed long	source_recursions_left	= MAX_NESTING;
+static	STRUCT_DYNABUF_REF(message_line, 256);	// for building messages
 
 // set configuration to default values
 void config_default(struct config *conf)
@@ -117,22 +134,25 @@ void config_default(struct config *conf)
 	conf->format_msvc		= FALSE;	// enabled by --msvc
 	conf->format_color		= FALSE;	// enabled by --color
 	conf->msg_stream		= stderr;	// set to stdout by --use-stdout
+	conf->msg_dynabuf		= NULL;		// set by library to collect messages
 	conf->honor_leading_zeroes	= TRUE;		// disabled by --ignore-zeroes
 	conf->segment_warning_is_error	= FALSE;	// enabled by --strict-segments		TODO - toggle default?
 	conf->test_new_features		= FALSE;	// enabled by --test
 	conf->wanted_version		= VER_CURRENT;	// changed by --dialect
+	conf->pass_report		= FALSE;	// enabled by --pass-report
+	conf->profile_stats		= FALSE;	// enabled by --stats
+	conf->profile_trace		= NULL;		// set by --trace
+	conf->profile_lines		= NULL;		// set by --line-profile
+	conf->mem_stats			= FALSE;	// enabled by --mem-stats
 }
 
 // memory allocation stuff
 
 // allocate memory and die if not available
+// (the block is accounted for as MEM_OTHER, release it with safe_free())
 void *safe_malloc(size_t size)
 {
-	void	*block;
-
-	if ((block = malloc(size)) == NULL)
-		Throw_serious_error(exception_no_memory_left);
-	return block;
+	return tagged_malloc(size, MEM_OTHER);
 }
 
 
@@ -164,7 +184,7 @@ static void set_label(scope_t scope, bits stat_flags, bits force_bit, bits power
 
 	if ((stat_flags & SF_FOUND_BLANK) && config.warn_on_indented_labels)
 		Throw_first_pass_warning("Label name not in leftmost column.");
-	symbol = symbol_find(scope);
+	symbol = symbol_find_bound(scope);
 	vcpu_read_pc(&pc);	// FIXME - if undefined, check pass.complain_about_undefined and maybe throw "value not defined"!
 	result.type = &type_number;
 	result.u.number.ntype = NUMTYPE_INT;	// FIXME - if undefined, use NUMTYPE_UNDEFINED!
@@ -175,6 +195,7 @@ static void set_label(scope_t scope, bits stat_flags, bits force_bit, bits power
 	if (force_bit)
 		symbol_set_force_bit(symbol, force_bit);
 	symbol->pseudopc = pseudopc_get_context();
+	depgraph_define(symbol);
 	// global labels must open new scope for cheap locals
 	if (scope == SCOPE_GLOBAL)
 		section_new_cheap_scope(section_now);
@@ -189,8 +210,11 @@ void parse_assignment(scope_t scope, bits force_bit, bits powers)
 	struct object	result;
 
 	GetByte();	// eat '='
-	symbol = symbol_find(scope);
+	symbol = symbol_find_bound(scope);
 	ALU_any_result(&result);
+	// a redefinition can only be checked once the value is known
+	if (!result.type->is_defined(&result))
+		++pass.needvalue_count;
 	// if wanted, mark as address reference
 	if (typesystem_says_address()) {
 		// FIXME - checking types explicitly is ugly...
@@ -200,6 +224,7 @@ void parse_assignment(scope_t scope, bits force_bit, bits powers)
 	symbol_set_object(symbol, &result, powers);
 	if (force_bit)
 		symbol_set_force_bit(symbol, force_bit);
+	depgraph_define(symbol);
 }
 
 
@@ -293,70 +318,87 @@ static void parse_forward_anon_def(bits *statement_flags)
 // Has to be re-entrant.
 void Parse_until_eob_or_eof(void)
 {
-	bits	statement_flags;
+	struct flow_frame	*outer_frame	= flow_frame_top;	// all frames above this one are ours
+	bits			statement_flags;
 
 //	// start with next byte, don't care about spaces
 //	NEXTANDSKIPSPACE();
 	// start with next byte
 	GetByte();
 	// loop until end of block or end of file
-	while ((GotByte != CHAR_EOB) && (GotByte != CHAR_EOF)) {
-		// process one statement
-		statement_flags = 0;	// no "label = pc" definition yet
-		typesystem_force_address_statement(FALSE);
-		// Parse until end of statement. Only loops if statement
-		// contains implicit label definition (=pc) and something else; or
-		// if "!ifdef/ifndef" is true/false, or if "!addr" is used without block.
-		do {
-			// check for pseudo opcodes was moved out of switch,
-			// because prefix character is now configurable.
-			if (GotByte == config.pseudoop_prefix) {
-				pseudoopcode_parse();
-			} else {
-				switch (GotByte) {
-				case CHAR_EOS:	// end of statement
-					// Ignore now, act later
-					// (stops from being "default")
-					break;
-				case ' ':	// space
-					statement_flags |= SF_FOUND_BLANK;
-					/*FALLTHROUGH*/
-				case CHAR_SOL:	// start of line
-					GetByte();	// skip
-					break;
-				case '-':
-					parse_backward_anon_def(&statement_flags);
-					break;
-				case '+':
-					GetByte();
-					if ((GotByte == LOCAL_PREFIX)	// TODO - allow "cheap macros"?!
-					|| (BYTE_CONTINUES_KEYWORD(GotByte)))
-						Macro_parse_call();
-					else
-						parse_forward_anon_def(&statement_flags);
-					break;
-				case '*':
-					notreallypo_setpc();	// define program counter (fn is in pseudoopcodes.c)
-					break;
-				case LOCAL_PREFIX:
-					parse_local_symbol_def(&statement_flags, section_now->local_scope);
-					break;
-				case CHEAP_PREFIX:
-					parse_local_symbol_def(&statement_flags, section_now->cheap_scope);
-					break;
-				default:
-					if (BYTE_STARTS_KEYWORD(GotByte)) {
-						parse_mnemo_or_global_symbol_def(&statement_flags);
-					} else {
-						Throw_error(exception_syntax);
-						Input_skip_remainder();
+	for (;;) {
+		while ((GotByte != CHAR_EOB) && (GotByte != CHAR_EOF)) {
+			// process one statement
+			statement_flags = 0;	// no "label = pc" definition yet
+			depgraph_statement();	// no symbols read yet
+			profile_statement_begin();
+			typesystem_force_address_statement(FALSE);
+			// Parse until end of statement. Only loops if statement
+			// contains implicit label definition (=pc) and something else; or
+			// if "!ifdef/ifndef" is true/false, or if "!addr" is used without block.
+			do {
+				if ((GotByte != CHAR_EOS) && (GotByte != ' ') && (GotByte != CHAR_SOL))
+					statement_flags |= SF_NOT_EMPTY;
+				// check for pseudo opcodes was moved out of switch,
+				// because prefix character is now configurable.
+				if (GotByte == config.pseudoop_prefix) {
+					pseudoopcode_parse();
+				} else {
+					switch (GotByte) {
+					case CHAR_EOS:	// end of statement
+						// Ignore now, act later
+						// (stops from being "default")
+						break;
+					case ' ':	// space
+						statement_flags |= SF_FOUND_BLANK;
+						/*FALLTHROUGH*/
+					case CHAR_SOL:	// start of line
+						GetByte();	// skip
+						break;
+					case '-':
+						parse_backward_anon_def(&statement_flags);
+						break;
+					case '+':
+						GetByte();
+						if ((GotByte == LOCAL_PREFIX)	// TODO - allow "cheap macros"?!
+						|| (BYTE_CONTINUES_KEYWORD(GotByte)))
+							Macro_parse_call();
+						else
+							parse_forward_anon_def(&statement_flags);
+						break;
+					case '*':
+						notreallypo_setpc();	// define program counter (fn is in pseudoopcodes.c)
+						break;
+					case LOCAL_PREFIX:
+						parse_local_symbol_def(&statement_flags, section_now->local_scope);
+						break;
+					case CHEAP_PREFIX:
+						parse_local_symbol_def(&statement_flags, section_now->cheap_scope);
+						break;
+					default:
+						if (BYTE_STARTS_KEYWORD(GotByte)) {
+							parse_mnemo_or_global_symbol_def(&statement_flags);
+						} else {
+							Throw_error(exception_syntax);
+							Input_skip_remainder();
+						}
 					}
 				}
-			}
-		} while (GotByte != CHAR_EOS);	// until end-of-statement
+			} while (GotByte != CHAR_EOS);	// until end-of-statement
+			vcpu_end_statement();	// adjust program counter
+			profile_statement_end(!(statement_flags & SF_NOT_EMPTY));
+			// go on with next byte
+			GetByte();	//NEXTANDSKIPSPACE();
+		}
+		// end of block or file. if it belongs to a frame that was pushed
+		// in here (macro call, "!source", "!if" block or loop), finish
+		// that and go on with the outer input. otherwise we're done.
+		if (flow_frame_top == outer_frame)
+			return;
+
+		flow_end_frame();	// restores outer input and GotByte
 		vcpu_end_statement();	// adjust program counter
-		// go on with next byte
-		GetByte();	//NEXTANDSKIPSPACE();
+		GetByte();	// go on with next byte (or with loop body again)
 	}
 }
 
@@ -387,29 +429,64 @@ int Throw_get_counter(void)
 }
 
 // This function will do the actual output for warnings, errors and serious
-// errors. It shows the given message string, as well as the current
-// context: file name, line number, source type and source title.
+// errors. It shows the given message string, as well as the given context:
+// file name, line number, source type and source title.
 // TODO: make un-static so !info and !debug can use this.
-static void throw_message(const char *message, const char *type)
+static void throw_message_at(const char *message, const char *type, const char *filename, int line_number, const char *section_type, const char *section_title)
 {
+	size_t	size;
+
 	++throw_counter;
 
-	char *filename = Input_now->original_filename;
-	
 #ifdef _WINDOWS
 	char absPath[_MAX_PATH];
 	_fullpath(absPath, filename, _MAX_PATH);
 	filename = absPath;
 #endif
 
+	// make sure the whole line fits, then build it
+	size = strlen(filename) + strlen(type) + strlen(section_type)
+		+ strlen(section_title) + strlen(message) + MESSAGE_OVERHEAD;
+	DYNABUF_CLEAR(message_line);
+	while (message_line->reserved < size)
+		dynabuf_enlarge(message_line);
 	if (config.format_msvc)
-		fprintf(config.msg_stream, "%s(%d) : %s (%s %s): %s\n",
-			filename, Input_now->line_number,
-			type, section_now->type, section_now->title, message);
+		sprintf(message_line->buffer, "%s(%d) : %s (%s %s): %s\n",
+			filename, line_number,
+			type, section_type, section_title, message);
 	else
-		fprintf(config.msg_stream, "%s - File %s, line %d (%s %s): %s\n",
-			type, filename, Input_now->line_number,
-			section_now->type, section_now->title, message);
+		sprintf(message_line->buffer, "%s - File %s, line %d (%s %s): %s\n",
+			type, filename, line_number,
+			section_type, section_title, message);
+	if (config.msg_dynabuf)
+		DynaBuf_add_string(config.msg_dynabuf, message_line->buffer);
+	else
+		fputs(message_line->buffer, config.msg_stream);
+}
+// same, using current context
+static void throw_message(const char *message, const char *type)
+{
+	throw_message_at(message, type, Input_now->original_filename, Input_now->line_number, section_now->type, section_now->title);
+}
+
+
+// if messages are trapped (see workers.c), pass them on and return TRUE
+static boolean message_trapped(void)
+{
+	if (trap_message == NULL)
+		return FALSE;
+
+	trap_message();
+	return TRUE;
+}
+
+
+// stop assembly
+static void stop_assembly(void)
+{
+	if (abort_assembly)
+		abort_assembly();	// does not return
+	exit(EXIT_FAILURE);
 }
 
 
@@ -419,12 +496,23 @@ static void throw_message(const char *message, const char *type)
 // assembled a 16-bit parameter with an 8-bit value.
 void Throw_warning(const char *message)
 {
+	if (message_trapped())
+		return;
+
 	PLATFORM_WARNING(message);
 	if (config.format_color)
 		throw_message(message, "\033[33mWarning\033[0m");
 	else
 		throw_message(message, "Warning");
 }
+// Output a warning for a position that has already been left (see above).
+void Throw_warning_at(const char *filename, int line_number, const char *section_type, const char *section_title, const char *message)
+{
+	if (config.format_color)
+		throw_message_at(message, "\033[33mWarning\033[0m", filename, line_number, section_type, section_title);
+	else
+		throw_message_at(message, "Warning", filename, line_number, section_type, section_title);
+}
 // Output a warning if in first pass. See above.
 void Throw_first_pass_warning(const char *message)
 {
@@ -440,6 +528,9 @@ void Throw_first_pass_warning(const char *message)
 // the user gets to know about more than one of his typos at a time.
 void Throw_error(const char *message)
 {
+	if (message_trapped())
+		return;
+
 	PLATFORM_ERROR(message);
 	if (config.format_color)
 		throw_message(message, "\033[31mError\033[0m");
@@ -447,7 +538,21 @@ void Throw_error(const char *message)
 		throw_message(message, "Error");
 	++pass.error_count;
 	if (pass.error_count >= config.max_errors)
-		exit(ACME_finalize(EXIT_FAILURE));
+		stop_assembly();
+}
+
+
+// Output an error for a position that has already been left (see above).
+// This is used for errors found in a pass but only reported after it.
+void Throw_error_at(const char *filename, int line_number, const char *section_type, const char *section_title, const char *message)
+{
+	if (config.format_color)
+		throw_message_at(message, "\033[31mError\033[0m", filename, line_number, section_type, section_title);
+	else
+		throw_message_at(message, "Error", filename, line_number, section_type, section_title);
+	++pass.error_count;
+	if (pass.error_count >= config.max_errors)
+		stop_assembly();
 }
 
 
@@ -457,25 +562,77 @@ void Throw_error(const char *message)
 // be set correctly in this case, so proceeding would be of no use at all.
 void Throw_serious_error(const char *message)
 {
+	if (message_trapped())
+		return;
+
 	PLATFORM_SERIOUS(message);
 	if (config.format_color)
 		throw_message(message, "\033[1m\033[31mSerious error\033[0m");
 	else
 		throw_message(message, "Serious error");
+	++pass.error_count;
 	// FIXME - exiting immediately inhibits output of macro call stack!
-	exit(ACME_finalize(EXIT_FAILURE));
+	stop_assembly();
 }
 
 
 // Handle bugs
 void Bug_found(const char *message, int code)
 {
+	if (message_trapped())
+		return;
+
 	Throw_warning("Bug in ACME, code follows");
 	fprintf(stderr, "(0x%x:)", code);
 	Throw_serious_error(message);
 }
 
 
+// send list of 8-bit values. runs of integers are collected and sent at once,
+// everything else (nested lists, strings, undefined or out-of-range values)
+// goes through output_object().
+static void output_byte_list(struct listitem *head, struct iter_context *iter)
+{
+	char		run[OUTPUT_RUN_SIZE];
+	size_t		used	= 0;
+	struct listitem	*item;
+	struct number	*number;
+
+	for (item = head->next; item != head; item = item->next) {
+		number = &item->u.payload.u.number;
+		if ((item->u.payload.type == &type_number)
+		&& (number->ntype == NUMTYPE_INT)
+		&& (number->val.intval >= -0x80)
+		&& (number->val.intval <= 0xff)) {
+			if (used == OUTPUT_RUN_SIZE) {
+				output_sequence(run, used);
+				used = 0;
+			}
+			run[used++] = (char) number->val.intval;
+		} else {
+			output_sequence(run, used);
+			used = 0;
+			output_object(&item->u.payload, iter);
+		}
+	}
+	output_sequence(run, used);
+}
+
+
+// send string as 8-bit values (encoded and xor'd like single characters)
+static void output_byte_string(const char *read, int length, struct iter_context *iter)
+{
+	char	run[OUTPUT_RUN_SIZE];
+	size_t	used;
+
+	while (length) {
+		for (used = 0; length && (used < OUTPUT_RUN_SIZE); --length)
+			run[used++] = (char) (iter->stringxor ^ encoding_encode_char(*(read++)));
+		output_sequence(run, used);
+	}
+}
+
+
 // insert object (in case of list, will iterate/recurse until done)
 void output_object(struct object *object, struct iter_context *iter)
 {
@@ -484,8 +641,10 @@ void output_object(struct object *object, struct iter_context *iter)
 	char		*read;
 
 	if (object->type == &type_number) {
-		if (object->u.number.ntype == NUMTYPE_UNDEFINED)
+		if (object->u.number.ntype == NUMTYPE_UNDEFINED) {
 			iter->fn(0);
+			++pass.needvalue_count;
+		}
 		else if (object->u.number.ntype == NUMTYPE_INT)
 			iter->fn(object->u.number.val.intval);
 		else if (object->u.number.ntype == NUMTYPE_FLOAT)
@@ -494,6 +653,11 @@ void output_object(struct object *object, struct iter_context *iter)
 			Bug_found("IllegalNumberType0", object->u.number.ntype);
 	} else if (object->type == &type_list) {
 		// iterate over list
+		if (iter->fn == output_8) {
+			output_byte_list(object->u.listhead, iter);
+			return;
+		}
+
 		item = object->u.listhead->next;
 		while (item != object->u.listhead) {
 			output_object(&item->u.payload, iter);
@@ -506,6 +670,11 @@ void output_object(struct object *object, struct iter_context *iter)
 		// single-char strings are accepted, to be more compatible with
 		// versions before 0.97 (and empty strings are not really a problem...)
 		if (iter->accept_long_strings || (length < 2)) {
+			if (iter->fn == output_8) {
+				output_byte_string(read, length, iter);
+				return;
+			}
+
 			while (length--)
 				iter->fn(iter->stringxor ^ encoding_encode_char(*(read++)));
 		} else {
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "config.h"
+#include "memstats.h"
 
 #define LOCAL_PREFIX		'.'	// FIXME - this is not yet used consistently!
 #define CHEAP_PREFIX		'@'	// prefix character for cheap locals
@@ -21,6 +22,7 @@
 
 #define SF_FOUND_BLANK		(1u << 0)	// statement had space or tab
 #define SF_IMPLIED_LABEL	(1u << 1)	// statement had implied label def
+#define SF_NOT_EMPTY		(1u << 2)	// statement had more than blanks (for line profile)
 extern char		s_untitled[];
 // error messages during assembly
 extern const char	exception_missing_string[];
@@ -73,28 +75,41 @@ struct config {
 	boolean		format_msvc;		// enabled by --msvc
 	boolean		format_color;		// enabled by --color
 	FILE		*msg_stream;		// defaults to stderr, changed to stdout by --use-stdout
+	struct dynabuf	*msg_dynabuf;		// if set, messages are collected there instead of being written to msg_stream
 	boolean		honor_leading_zeroes;	// TRUE, disabled by --ignore-zeroes
 	boolean		segment_warning_is_error;	// FALSE, enabled by --strict-segments
 	boolean		test_new_features;	// FALSE, enabled by --test
 	enum version	wanted_version;	// set by --dialect (and --test --test)
+	boolean		pass_report;	// FALSE, enabled by --pass-report
+	boolean		profile_stats;	// FALSE, enabled by --stats
+	const char	*profile_trace;	// NULL, set by --trace
+	const char	*profile_lines;	// NULL, set by --line-profile
+	boolean		mem_stats;	// FALSE, enabled by --mem-stats
 };
 extern struct config	config;
 
 struct pass {
 	int	number;	// counts up from zero
 	int	undefined_count;	// counts undefined expression results (if this stops decreasing, next pass must list them as errors)
-	//int	needvalue_count;	// counts undefined expression results actually needed for output (when this hits zero, we're done)	FIXME - use
+	int	needvalue_count;	// counts undefined expression results actually needed for output (when this hits zero, we're done)
 	int	error_count;
 	boolean	complain_about_undefined;	// will be FALSE until error pass is needed
 };
 extern struct pass	pass;
+// called on serious errors (or when there were too many errors) instead of
+// exiting. must not return. acme.c sets this to write the symbol list first.
+extern void	(*abort_assembly)(void);
+// while set, warnings and errors are not output but passed to this function,
+// which returns (even for serious errors). workers.c sets this while worker
+// threads are running, because messages cannot be shown from there.
+extern void	(*trap_message)(void);
 #define FIRST_PASS	(pass.number == 0)
 
 // report stuff
 #define REPORT_ASCBUFSIZE	1024
 #define REPORT_BINBUFSIZE	9	// eight are shown, then "..."
 struct report {
-	FILE		*fd;		// report file descriptor (NULL => no report)
+	struct dynabuf	*text;		// report of current pass (NULL => no report)
 	struct input	*last_input;
 	size_t		asc_used;
 	size_t		bin_used;
@@ -141,6 +156,8 @@ extern int Throw_get_counter(void);
 // situation that should be reported to the user, for example ACME may have
 // assembled a 16-bit parameter with an 8-bit value.
 extern void Throw_warning(const char *msg);
+// Output a warning for the given position instead of the current one.
+extern void Throw_warning_at(const char *filename, int line_number, const char *section_type, const char *section_title, const char *msg);
 // Output a warning if in first pass. See above.
 extern void Throw_first_pass_warning(const char *msg);
 // Output an error.
@@ -149,6 +166,8 @@ extern void Throw_first_pass_warning(const char *msg);
 // syntax error. The assembler will try to go on with the assembly though, so
 // the user gets to know about more than one of his typos at a time.
 extern void Throw_error(const char *msg);
+// Output an error for the given position instead of the current one.
+extern void Throw_error_at(const char *filename, int line_number, const char *section_type, const char *section_title, const char *msg);
 // Output a serious error, stopping assembly.
 // Serious errors are those that make it impossible to go on with the
 // assembly. Example: "!fill" without a parameter - the program counter cannot
@@ -6,6 +6,10 @@
 // 19 Nov 2014	Merged Johann Klasek's report listing generator patch
 //  9 Jan 2018	Allowed "//" comments
 #include "input.h"
+#include <stdlib.h>
+#include <string.h>	// for strcmp() and memset()
+#include <sys/types.h>
+#include <sys/stat.h>	// for stat()
 #include "config.h"
 #include "alu.h"
 #include "dynabuf.h"
@@ -31,7 +35,7 @@ static struct input	outermost	= {
 	INPUTSRC_FILE,	// fake file access, so no RAM read
 	INPUTSTATE_EOF,	// state of input
 	{
-		NULL	// RAM read pointer or file handle
+		{ NULL, NULL }	// file contents or RAM read pointer
 	}
 };
 
@@ -42,30 +46,42 @@ struct input	*Input_now	= &outermost;	// current input structure
 
 // functions
 
-// let current input point to start of file
-void Input_new_file(const char *filename, FILE *fd)
+// let current input point to start of file contents
+void Input_new_file(const char *filename, const struct filecontents *file)
 {
 	Input_now->original_filename	= filename;
 	Input_now->line_number		= 1;
 	Input_now->source		= INPUTSRC_FILE;
 	Input_now->state		= INPUTSTATE_SOF;
-	Input_now->src.fd		= fd;
+	Input_now->src.file.ptr		= file->data;
+	Input_now->src.file.end		= file->data + file->size;
+}
+
+
+// forget current input (after assembly was aborted)
+void Input_reset(void)
+{
+	Input_now = &outermost;
 }
 
 
 // remember source code character for report generator
 #define HEXBUFSIZE	9	// actually, 4+1 is enough, but for systems without snprintf(), let's be extra-safe.
-#define IF_WANTED_REPORT_SRCCHAR(c)	do { if (report->fd) report_srcchar(c); } while(0)
+#define LINESTART_BUFSIZE	(2 * REPORT_BINBUFSIZE + 2 + HEXBUFSIZE + 32)	// line number or address and bytes
+#define IF_WANTED_REPORT_SRCCHAR(c)	do { if (report->text) report_srcchar(c); } while(0)
 static void report_srcchar(char new_char)
 {
 	static char	prev_char	= '\0';
 	int		ii;
 	char		hex_address[HEXBUFSIZE];
 	char		hexdump[2 * REPORT_BINBUFSIZE + 2];	// +2 for '.' and terminator
+	char		line_start[LINESTART_BUFSIZE];
 
 	// if input has changed, insert explanation
 	if (Input_now != report->last_input) {
-		fprintf(report->fd, "\n; ******** Source: %s\n", Input_now->original_filename);
+		DynaBuf_add_string(report->text, "\n; ******** Source: ");
+		DynaBuf_add_string(report->text, Input_now->original_filename);
+		DynaBuf_append(report->text, '\n');
 		report->last_input = Input_now;
 		report->asc_used = 0;	// clear buffer
 		prev_char = '\0';
@@ -74,7 +90,8 @@ static void report_srcchar(char new_char)
 		// line start after line break detected and EOS processed,
 		// build report line:
 		// show line number...
-		fprintf(report->fd, "%6d  ", Input_now->line_number - 1);
+		sprintf(line_start, "%6d  ", Input_now->line_number - 1);
+		DynaBuf_add_string(report->text, line_start);
 		// prepare outbytes' start address
 		if (report->bin_used) {
 #if _BSD_SOURCE || _XOPEN_SOURCE >= 500 || _ISOC99_SOURCE || _POSIX_C_SOURCE >= 200112L
@@ -93,13 +110,15 @@ static void report_srcchar(char new_char)
 		if (report->bin_used == REPORT_BINBUFSIZE)
 			sprintf(hexdump + 2 * (REPORT_BINBUFSIZE - 1), "...");
 		// show address and bytes
-		fprintf(report->fd, "%-4s %-19s", hex_address, hexdump);
+		sprintf(line_start, "%-4s %-19s", hex_address, hexdump);
+		DynaBuf_add_string(report->text, line_start);
 		// at this point the output should be a multiple of 8 characters
 		// so far to preserve tabs of the source...
 		if (report->asc_used == REPORT_ASCBUFSIZE)
 			--report->asc_used;
 		report->asc_buf[report->asc_used] = '\0';
-		fprintf(report->fd, "%s\n", report->asc_buf);	// show source line
+		DynaBuf_add_string(report->text, report->asc_buf);	// show source line
+		DynaBuf_append(report->text, '\n');
 		report->asc_used = 0;	// reset buffers
 		report->bin_used = 0;
 	}
@@ -111,6 +130,9 @@ static void report_srcchar(char new_char)
 }
 
 
+// fetch raw byte from current file contents (EOF at end, like getc())
+#define FETCH_FROM_FILE()	((Input_now->src.file.ptr < Input_now->src.file.end) ? (unsigned char) *(Input_now->src.file.ptr++) : EOF)
+
 // Deliver source code from current file (!) in shortened high-level format
 static char get_processed_from_file(void)
 {
@@ -120,7 +142,7 @@ static char get_processed_from_file(void)
 		switch (Input_now->state) {
 		case INPUTSTATE_SOF:
 			// fetch first byte from the current source file
-			from_file = getc(Input_now->src.fd);
+			from_file = FETCH_FROM_FILE();
 			IF_WANTED_REPORT_SRCCHAR(from_file);
 			//TODO - check for bogus/malformed BOM and ignore?
 			// check for hashbang line and ignore
@@ -133,7 +155,7 @@ static char get_processed_from_file(void)
 			break;
 		case INPUTSTATE_NORMAL:
 			// fetch a fresh byte from the current source file
-			from_file = getc(Input_now->src.fd);
+			from_file = FETCH_FROM_FILE();
 			IF_WANTED_REPORT_SRCCHAR(from_file);
 			// now process it
 			/*FALLTHROUGH*/
@@ -183,7 +205,7 @@ static char get_processed_from_file(void)
 
 			case '/':
 				// to check for "//", get another byte:
-				from_file = getc(Input_now->src.fd);
+				from_file = FETCH_FROM_FILE();
 				IF_WANTED_REPORT_SRCCHAR(from_file);
 				if (from_file != '/') {
 					// not "//", so:
@@ -209,7 +231,7 @@ static char get_processed_from_file(void)
 		case INPUTSTATE_SKIPBLANKS:
 			// read until non-blank, then deliver that
 			do {
-				from_file = getc(Input_now->src.fd);
+				from_file = FETCH_FROM_FILE();
 				IF_WANTED_REPORT_SRCCHAR(from_file);
 			} while ((from_file == '\t') || (from_file == ' '));
 			// re-process last byte
@@ -226,7 +248,7 @@ static char get_processed_from_file(void)
 			return CHAR_SOL;	// new line
 
 		case INPUTSTATE_SKIPLF:
-			from_file = getc(Input_now->src.fd);
+			from_file = FETCH_FROM_FILE();
 			IF_WANTED_REPORT_SRCCHAR(from_file);
 			// if LF, ignore it and fetch another byte
 			// otherwise, process current byte
@@ -238,7 +260,7 @@ static char get_processed_from_file(void)
 		case INPUTSTATE_COMMENT:
 			// read until end-of-line or end-of-file
 			do {
-				from_file = getc(Input_now->src.fd);
+				from_file = FETCH_FROM_FILE();
 				IF_WANTED_REPORT_SRCCHAR(from_file);
 			} while ((from_file != EOF) && (from_file != CHAR_CR) && (from_file != CHAR_LF));
 			// re-process last byte
@@ -307,7 +329,7 @@ static char GetQuotedByte(void)
 		break;
 	case INPUTSRC_FILE:
 		// fetch a fresh byte from the current source file
-		from_file = getc(Input_now->src.fd);
+		from_file = FETCH_FROM_FILE();
 		IF_WANTED_REPORT_SRCCHAR(from_file);
 		switch (from_file) {
 		case EOF:
@@ -688,6 +710,22 @@ struct ipi {
 };
 static struct ipi	ipi_head	= {&ipi_head, &ipi_head, NULL};	// head element
 static	STRUCT_DYNABUF_REF(pathbuf, 256);	// to combine search path and file spec
+// contents cache for includepaths_load(), one per context (see includepaths_select_cache())
+struct filecache {
+	struct filecache	*next;
+	char			*context;
+	struct rwnode		*forest[256];
+};
+static struct filecache	*cache_list	= NULL;	// additional caches (server mode)
+static struct rwnode	*default_forest[256]	= { NULL };
+static struct rwnode	**file_forest	= default_forest;	// current cache
+// contents of changed files (may still be parsed, see includepaths_free_stale())
+static struct filecontents	**stale_list	= NULL;
+static int			stale_count	= 0;
+static int			stale_size	= 0;
+#define ID_TOPLEVEL	2	// cache id for toplevel files (0 and 1 are used for "uses_lib")
+static const struct filecontents	*memfile_list	= NULL;	// in-memory files (for library use)
+static int				memfile_count	= 0;
 
 // add entry
 void includepaths_add(const char *path)
@@ -701,6 +739,17 @@ void includepaths_add(const char *path)
 	ipi->next->prev = ipi;
 	ipi->prev->next = ipi;
 }
+// complain about file (name in GlobalDynaBuf) not being accessible
+static void complain_cannot_open(void)
+{
+	// CAUTION, I'm re-using the path dynabuf to assemble the error message:
+	DYNABUF_CLEAR(pathbuf);
+	DynaBuf_add_string(pathbuf, "Cannot open input file \"");
+	DynaBuf_add_string(pathbuf, GLOBALDYNABUF_CURRENT);
+	DynaBuf_add_string(pathbuf, "\".");
+	DynaBuf_append(pathbuf, '\0');
+	Throw_error(pathbuf->buffer);
+}
 // open file for reading (trying list entries as prefixes)
 // "uses_lib" tells whether to access library or to make use of include paths
 // file name is expected in GlobalDynaBuf
@@ -739,15 +788,195 @@ FILE *includepaths_open_ro(boolean uses_lib)
 			}
 		}
 	}
-	if (stream == NULL) {
-		// CAUTION, I'm re-using the path dynabuf to assemble the error message:
-		DYNABUF_CLEAR(pathbuf);
-		DynaBuf_add_string(pathbuf, "Cannot open input file \"");
-		DynaBuf_add_string(pathbuf, GLOBALDYNABUF_CURRENT);
-		DynaBuf_add_string(pathbuf, "\".");
-		DynaBuf_append(pathbuf, '\0');
-		Throw_error(pathbuf->buffer);
-	}
+	if (stream == NULL)
+		complain_cannot_open();
 	//fprintf(stderr, "File is [%s]\n", GLOBALDYNABUF_CURRENT);
 	return stream;
 }
+
+// get modification time and size of file. whole seconds are not enough to
+// notice a file being changed right after it was read, so nanoseconds are
+// fetched as well where stat() provides them.
+// returns FALSE if file cannot be accessed.
+static boolean get_file_stats(const char *path, time_t *mtime, long *mtime_nsec, long *size)
+{
+	struct stat	info;
+
+	if (stat(path, &info))
+		return FALSE;
+
+	*mtime = info.st_mtime;
+#if defined(__APPLE__) && defined(__MACH__)
+	*mtime_nsec = (long) info.st_mtimespec.tv_nsec;
+#elif defined(_POSIX_C_SOURCE) && (_POSIX_C_SOURCE >= 200809L)
+	*mtime_nsec = (long) info.st_mtim.tv_nsec;
+#else
+	*mtime_nsec = 0;
+#endif
+	*size = (long) info.st_size;
+	return TRUE;
+}
+
+// find in-memory file, file name is expected in GlobalDynaBuf.
+// returns NULL if there is none.
+static const struct filecontents *find_memfile(void)
+{
+	int	ii;
+
+	for (ii = 0; ii < memfile_count; ++ii) {
+		if (strcmp(memfile_list[ii].path, GLOBALDYNABUF_CURRENT) == 0)
+			return &memfile_list[ii];
+	}
+	return NULL;
+}
+
+// read whole file, or re-use contents from an earlier call if file has not
+// changed since. "id" is the cache id (see includepaths_load() and
+// includepaths_load_toplevel()).
+// file name is expected in GlobalDynaBuf
+static const struct filecontents *load_file(int id)
+{
+	const struct filecontents	*memfile;
+	struct rwnode		*node;
+	struct filecontents	*file;
+	FILE			*stream;
+	time_t			mtime;
+	long			mtime_nsec,
+				size;
+
+	// in-memory files replace the file system completely
+	if (memfile_list) {
+		memfile = find_memfile();
+		if ((memfile == NULL) && (id != ID_TOPLEVEL))
+			complain_cannot_open();
+		return memfile;
+	}
+	// cache is keyed by file name as given and by id
+	if (Tree_hard_scan(&node, file_forest, id, TRUE))
+		node->body = NULL;	// new node, nothing cached yet
+	file = node->body;
+	if (file) {
+		if (get_file_stats(file->path, &mtime, &mtime_nsec, &size)
+		&& (mtime == file->mtime)
+		&& (mtime_nsec == file->mtime_nsec)
+		&& (size == file->size)) {
+			// still valid. put actual path in GlobalDynaBuf, just
+			// like when loading, so messages use the same name.
+			DYNABUF_CLEAR(GlobalDynaBuf);
+			DynaBuf_add_string(GlobalDynaBuf, file->path);
+			DynaBuf_append(GlobalDynaBuf, '\0');
+			return file;
+		}
+
+		// file has changed, so forget old contents (they are not
+		// freed yet because an outer "!source" may still be reading them)
+		if (stale_count == stale_size) {
+			stale_size = stale_size ? 2 * stale_size : 16;
+			stale_list = realloc(stale_list, stale_size * sizeof(*stale_list));
+			if (stale_list == NULL)
+				Throw_serious_error(exception_no_memory_left);
+		}
+		stale_list[stale_count++] = file;
+		node->body = NULL;
+	}
+	// if file cannot be opened, do not remember anything
+	if (id == ID_TOPLEVEL)
+		stream = fopen(GLOBALDYNABUF_CURRENT, FILE_READBINARY);
+	else
+		stream = includepaths_open_ro(id);	// puts actual path in GlobalDynaBuf
+	if (stream == NULL)
+		return NULL;
+
+	file = tagged_malloc(sizeof(*file), MEM_FILES);
+	file->path = DynaBuf_get_copy(GlobalDynaBuf);
+	safe_tag(file->path, MEM_FILES);
+	if (!get_file_stats(file->path, &file->mtime, &file->mtime_nsec, &size)) {
+		file->mtime = 0;	// will be read again next time
+		file->mtime_nsec = 0;
+	}
+	fseek(stream, 0, SEEK_END);
+	file->size = ftell(stream);
+	if (file->size < 0)
+		file->size = 0;
+	file->data = tagged_malloc(file->size ? file->size : 1, MEM_FILES);
+	rewind(stream);
+	file->size = (long) fread(file->data, 1, file->size, stream);
+	fclose(stream);
+	node->body = file;
+	return file;
+}
+
+// read whole file (trying list entries as prefixes), or re-use contents from
+// an earlier call if file has not changed since.
+// "uses_lib" tells whether to access library or to make use of include paths
+// file name is expected in GlobalDynaBuf
+const struct filecontents *includepaths_load(boolean uses_lib)
+{
+	return load_file(uses_lib ? 1 : 0);
+}
+
+// read whole toplevel source file (without using include paths)
+// file name is expected in GlobalDynaBuf
+const struct filecontents *includepaths_load_toplevel(void)
+{
+	return load_file(ID_TOPLEVEL);
+}
+
+// use given in-memory files instead of file system
+void includepaths_set_memfiles(const struct filecontents *files, int count)
+{
+	memfile_list = files;
+	memfile_count = files ? count : 0;
+}
+
+// remove all entries (before handling options of next server request)
+void includepaths_clear(void)
+{
+	struct ipi	*ipi;
+
+	while ((ipi = ipi_head.next) != &ipi_head) {
+		ipi_head.next = ipi->next;
+		safe_free(ipi);
+	}
+	ipi_head.prev = &ipi_head;
+}
+
+// select contents cache for given working directory and current include
+// paths (both change the meaning of file names). caches are kept, so
+// selecting a context again re-uses its cache.
+void includepaths_select_cache(const char *directory)
+{
+	struct filecache	*cache;
+	struct ipi		*ipi;
+
+	DYNABUF_CLEAR(pathbuf);
+	DynaBuf_add_string(pathbuf, directory);
+	for (ipi = ipi_head.next; ipi != &ipi_head; ipi = ipi->next) {
+		DynaBuf_append(pathbuf, '\n');
+		DynaBuf_add_string(pathbuf, ipi->path);
+	}
+	DynaBuf_append(pathbuf, '\0');
+	for (cache = cache_list; cache; cache = cache->next) {
+		if (strcmp(cache->context, pathbuf->buffer) == 0)
+			break;
+	}
+	if (cache == NULL) {
+		cache = safe_malloc(sizeof(*cache));
+		cache->context = DynaBuf_get_copy(pathbuf);
+		memset(cache->forest, 0, sizeof(cache->forest));
+		cache->next = cache_list;
+		cache_list = cache;
+	}
+	file_forest = cache->forest;
+}
+
+// free contents of files that have changed since they were read
+void includepaths_free_stale(void)
+{
+	while (stale_count) {
+		--stale_count;
+		safe_free(stale_list[stale_count]->data);
+		safe_free(stale_list[stale_count]->path);
+		safe_free(stale_list[stale_count]);
+	}
+}
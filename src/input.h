@@ -8,6 +8,7 @@
 
 
 #include <stdio.h>	// for FILE
+#include <time.h>	// for time_t
 #include "config.h"	// for bits and scope_t
 
 
@@ -30,13 +31,24 @@ enum inputsrc {
 	INPUTSRC_FILE,
 	INPUTSRC_RAM
 };
+// contents of a file read by includepaths_load()
+struct filecontents {
+	char	*path;	// where the file was found
+	time_t	mtime;	// modification time when it was read
+	long	mtime_nsec;	// (fraction, if the system provides it)
+	long	size;
+	char	*data;
+};
 struct input {
 	const char	*original_filename;	// during RAM reads, too
 	int		line_number;	// in file (on RAM reads, too)
 	enum inputsrc	source;
 	enum inputstate	state;	// state of input
 	union {
-		FILE	*fd;		// file descriptor
+		struct {
+			const char	*ptr;	// read pointer
+			const char	*end;	// end of contents
+		} file;			// file contents (see includepaths_load())
 		char	*ram_ptr;	// RAM read ptr (loop or macro block)
 	} src;
 };
@@ -60,8 +72,10 @@ extern struct input	*Input_now;	// current input structure
 
 // Prototypes
 
-// let current input point to start of file
-extern void Input_new_file(const char *filename, FILE *fd);
+// let current input point to start of file contents
+extern void Input_new_file(const char *filename, const struct filecontents *file);
+// forget current input (after assembly was aborted)
+extern void Input_reset(void);
 // get next byte from currently active byte source in shortened high-level
 // format. When inside quotes, use Input_quoted_to_dynabuf() instead!
 extern char GetByte(void);
@@ -132,6 +146,25 @@ extern void includepaths_add(const char *path);
 // "uses_lib" tells whether to access library or to make use of include paths
 // file name is expected in GlobalDynaBuf
 extern FILE *includepaths_open_ro(boolean uses_lib);
+// read whole file (see includepaths_open_ro()). contents are kept for the
+// whole run and only read again if the file has changed.
+// returns NULL on error (which has been reported then).
+extern const struct filecontents *includepaths_load(boolean uses_lib);
+// read whole toplevel source file (like includepaths_load(), but without
+// using include paths). file name is expected in GlobalDynaBuf.
+// returns NULL on error (which has NOT been reported, caller should do that).
+extern const struct filecontents *includepaths_load_toplevel(void);
+// use given in-memory files instead of file system (for library use, NULL
+// switches back to file system). the array must stay valid while in use.
+extern void includepaths_set_memfiles(const struct filecontents *files, int count);
+// remove all entries (before handling options of next server request)
+extern void includepaths_clear(void);
+// select contents cache for given working directory and current include
+// paths (for server mode, where these change between requests)
+extern void includepaths_select_cache(const char *directory);
+// free contents of files that have changed since they were read. only call
+// this when no file is being parsed.
+extern void includepaths_free_stale(void);
 
 
 #endif
@@ -0,0 +1,234 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Library interface (assembling in-memory sources without file I/O)
+//
+// This drives the same modules as acme.c, but sources and "!binary"/"!convtab"
+// files are taken from memory, messages are collected in a buffer and serious
+// errors jump back to acme_assemble() instead of exiting. Output files given
+// via "!to", "!sl" etc. are not written, the caller gets the used part of the
+// output buffer and the global symbols instead.
+#include "libacme.h"
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "acme.h"
+#include "alu.h"
+#include "config.h"
+#include "cpu.h"
+#include "dynabuf.h"
+#include "flow.h"
+#include "global.h"
+#include "input.h"
+#include "macro.h"
+#include "output.h"
+#include "passes.h"
+#include "symbol.h"
+#include "tree.h"
+
+
+// variables
+static jmp_buf			abort_jump;	// where to go on serious errors
+static	STRUCT_DYNABUF_REF(messages, 1024);	// collected warnings and errors
+static boolean			output_ready	= FALSE;	// output buffer allocated?
+static struct report		no_report;	// listing reports are not supported
+
+
+// called on serious errors (instead of exit())
+static void jump_back(void)
+{
+	longjmp(abort_jump, 1);
+}
+
+
+// add error message that is not related to a source position
+static void add_message(const char *text, const char *name)
+{
+	DynaBuf_add_string(messages, "Error: ");
+	DynaBuf_add_string(messages, text);
+	DynaBuf_add_string(messages, " \"");
+	DynaBuf_add_string(messages, name);
+	DynaBuf_add_string(messages, "\".\n");
+}
+
+
+// called by pass driver if toplevel file could not be loaded
+static void cannot_open(const char *name)
+{
+	add_message("Cannot open toplevel file", name);
+}
+
+
+// forget file names set by source code in previous assembly
+static void forget_filenames(void)
+{
+	safe_free((char *) output_filename);
+	safe_free((char *) symbollist_filename);
+	output_filename = NULL;
+	symbollist_filename = NULL;
+	report_filename = NULL;
+}
+
+
+// count global symbols holding numbers
+static void count_symbol(struct rwnode *node, void *env)
+{
+	struct symbol	*symbol	= node->body;
+
+	if (symbol->object.type == &type_number)
+		++((struct acme_result *) env)->symbol_count;
+}
+// copy global symbol holding a number to result
+static void copy_symbol(struct rwnode *node, void *env)
+{
+	struct acme_result	*result	= env;
+	struct symbol		*symbol	= node->body;
+	struct acme_symbol	*target;
+
+	if (symbol->object.type != &type_number)
+		return;
+
+	target = &result->symbols[result->symbol_count++];
+	target->name = safe_malloc(strlen(node->id_string) + 1);
+	strcpy(target->name, node->id_string);
+	target->type = ACME_SYMBOL_UNDEFINED;
+	target->intval = 0;
+	target->fpval = 0;
+	if (symbol->object.u.number.ntype == NUMTYPE_INT) {
+		target->type = ACME_SYMBOL_INT;
+		target->intval = symbol->object.u.number.val.intval;
+	} else if (symbol->object.u.number.ntype == NUMTYPE_FLOAT) {
+		target->type = ACME_SYMBOL_FLOAT;
+		target->fpval = symbol->object.u.number.val.fpval;
+	}
+}
+
+
+// copy output and symbols to result
+static void collect_result(struct acme_result *result)
+{
+	intval_t	start,
+			amount;
+
+	Output_get_used_range(&start, &amount);
+	result->start = start;
+	result->size = amount;
+	result->image = safe_malloc(amount ? amount : 1);
+	Output_copy_part((char *) result->image, start, amount);
+	// count symbols, then copy them
+	Tree_dump_forest(symbols_forest, SCOPE_GLOBAL, count_symbol, result);
+	result->symbols = safe_malloc((result->symbol_count ? result->symbol_count : 1) * sizeof(*result->symbols));
+	result->symbol_count = 0;
+	Tree_dump_forest(symbols_forest, SCOPE_GLOBAL, copy_symbol, result);
+}
+
+
+// set options to default values
+void acme_default_options(struct acme_options *options)
+{
+	memset(options, 0, sizeof(*options));
+	options->cpu = NULL;
+	options->start_address = -1;
+	options->fill_value = -1;
+}
+
+
+// assemble in-memory sources
+int acme_assemble(const struct acme_options *options, struct acme_result *result)
+{
+	struct filecontents	*memfiles;
+	struct assembly		assembly;
+	signed long		fill_value;
+	int			ii;
+
+	memset(result, 0, sizeof(*result));
+	config_default(&config);
+	if (options->max_errors > 0)
+		config.max_errors = options->max_errors;
+	config.msg_dynabuf = messages;
+	abort_assembly = jump_back;
+	DYNABUF_CLEAR(messages);
+	pass.error_count = 0;
+	// let file accesses use the given files
+	memfiles = safe_malloc((options->file_count ? options->file_count : 1) * sizeof(*memfiles));
+	for (ii = 0; ii < options->file_count; ++ii) {
+		memfiles[ii].path = (char *) options->files[ii].name;
+		memfiles[ii].mtime = 0;
+		memfiles[ii].mtime_nsec = 0;
+		memfiles[ii].size = (long) options->files[ii].size;
+		memfiles[ii].data = (char *) options->files[ii].data;
+	}
+	includepaths_set_memfiles(memfiles, options->file_count);
+	// reset state left over from previous assembly
+	fill_value = (options->fill_value == -1) ? MEMINIT_USE_DEFAULT : options->fill_value;
+	if (output_ready) {
+		symbols_clear();
+		macros_clear();
+		Output_reset(fill_value);
+	} else {
+		Output_init(fill_value, FALSE);
+		output_ready = TRUE;
+	}
+	forget_filenames();
+	macro_recursions_left = MAX_NESTING;
+	source_recursions_left = MAX_NESTING;
+	report = &no_report;
+	// all symbol values are returned, so undefined ones always need another pass
+	assembly.sources = options->sources;
+	assembly.source_count = options->source_count;
+	assembly.default_cpu = NULL;
+	assembly.start_address = options->start_address;
+	assembly.lists_all_symbols = TRUE;
+	assembly.cannot_open = cannot_open;
+	assembly.first_pass = NULL;
+	if (options->cpu) {
+		DYNABUF_CLEAR(GlobalDynaBuf);
+		DynaBuf_add_string(GlobalDynaBuf, options->cpu);
+		DynaBuf_append(GlobalDynaBuf, '\0');
+		assembly.default_cpu = cputype_find();
+		if (assembly.default_cpu == NULL) {
+			add_message("Unknown CPU type", options->cpu);
+			++pass.error_count;
+		}
+	}
+	if (pass.error_count == 0) {
+		if (setjmp(abort_jump) == 0) {
+			for (ii = 0; ii < options->definition_count; ++ii) {
+				DYNABUF_CLEAR(GlobalDynaBuf);
+				DynaBuf_add_string(GlobalDynaBuf, options->definitions[ii].name);
+				DynaBuf_append(GlobalDynaBuf, '\0');
+				symbol_define(options->definitions[ii].value);
+			}
+			if (passes_do(&assembly))
+				collect_result(result);
+			else if (pass.error_count == 0)
+				pass.error_count = 1;	// output is not usable anyway
+		} else {
+			// assembly was aborted, so forget about unfinished blocks
+			flow_abort();
+		}
+	}
+	result->error_count = pass.error_count;
+	DynaBuf_append(messages, '\0');
+	result->messages = DynaBuf_get_copy(messages);
+	// do not keep pointers to caller's data
+	includepaths_set_memfiles(NULL, 0);
+	safe_free(memfiles);
+	abort_assembly = NULL;
+	return result->error_count;
+}
+
+
+// release memory held by result
+void acme_free_result(struct acme_result *result)
+{
+	int	ii;
+
+	for (ii = 0; ii < result->symbol_count; ++ii)
+		safe_free(result->symbols[ii].name);
+	safe_free(result->symbols);
+	safe_free(result->image);
+	safe_free(result->messages);
+	memset(result, 0, sizeof(*result));
+}
@@ -0,0 +1,84 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Library interface (assembling in-memory sources without file I/O)
+//
+// Each assembly is described by a "struct assembly" context (see passes.h),
+// which holds what to assemble and how problems are reported, and the pass
+// driver is the same one the stand-alone assembler uses. Symbols, macros,
+// the output buffer and the parser state are still held by the modules in
+// static variables, though, so the library is not reentrant: assemblies
+// must be done one after the other, and not in parallel to acme's main().
+#ifndef libacme_H
+#define libacme_H
+
+
+#include <stddef.h>	// for size_t
+
+
+// in-memory file (source code, or data for "!binary" and "!convtab")
+struct acme_file {
+	const char	*name;	// as used in source code (or in "sources" list)
+	const char	*data;
+	size_t		size;
+};
+
+// symbol definition (like "-D" on command line)
+struct acme_definition {
+	const char	*name;
+	long		value;
+};
+
+// what to assemble and how (set up with acme_default_options() first)
+struct acme_options {
+	const struct acme_file		*files;		// all files the sources may access
+	int				file_count;
+	const char * const		*sources;	// names of toplevel sources (from "files")
+	int				source_count;
+	const struct acme_definition	*definitions;
+	int				definition_count;
+	const char			*cpu;		// like "--cpu" (NULL: default)
+	long				start_address;	// like "--setpc" (-1: none)
+	int				fill_value;	// like "--initmem" (-1: default)
+	int				max_errors;	// like "--maxerrors" (0: default)
+};
+
+// global symbol (only numbers are listed)
+enum acme_symbol_type {
+	ACME_SYMBOL_UNDEFINED,
+	ACME_SYMBOL_INT,
+	ACME_SYMBOL_FLOAT
+};
+struct acme_symbol {
+	char			*name;
+	enum acme_symbol_type	type;
+	long			intval;		// if type is ACME_SYMBOL_INT
+	double			fpval;		// if type is ACME_SYMBOL_FLOAT
+};
+
+// result of assembly (release with acme_free_result())
+struct acme_result {
+	int			error_count;	// zero on success
+	long			start;		// address of first byte of image
+	size_t			size;
+	unsigned char		*image;		// without file format header (NULL on errors)
+	struct acme_symbol	*symbols;
+	int			symbol_count;
+	char			*messages;	// warnings and errors, one per line
+};
+
+
+// Prototypes
+
+// set options to default values
+extern void acme_default_options(struct acme_options *options);
+// assemble in-memory sources, without accessing the file system.
+// returns number of errors (zero on success).
+// only one assembly can be done at a time (see top of file).
+extern int acme_assemble(const struct acme_options *options, struct acme_result *result);
+// release memory held by result
+extern void acme_free_result(struct acme_result *result);
+
+
+#endif
@@ -10,8 +10,12 @@
 #include "acme.h"
 #include "alu.h"
 #include "dynabuf.h"
+#include "encoding.h"
+#include "flow.h"
 #include "global.h"
 #include "input.h"
+#include "output.h"
+#include "profile.h"
 #include "section.h"
 #include "symbol.h"
 #include "tree.h"
@@ -24,6 +28,9 @@
 #define ARGTYPE_REF	'r'
 #define REFERENCE_CHAR	'~'	// prefix for call-by-reference
 #define HALF_INITIAL_ARG_TABLE_SIZE	4
+#define CALLSITE_CACHE_SIZE	1024	// must be a power of two
+#define MEMO_TABLE_SIZE		1024	// must be a power of two
+#define MEMO_MAX_SIZE		4096	// larger expansions are not memoized
 static const char	exception_macro_twice[]	= "Macro already defined.";
 
 
@@ -34,6 +41,7 @@ struct macro {
 		*original_name,	// user-supplied name		for error msgs
 		*parameter_list,	// parameters (whole line)
 		*body;	// RAM block containing macro body
+	boolean	impure;	// an expansion depended on more than its arguments
 };
 // there's no need to make this a struct and add a type component:
 // when the macro has been found, accessing its parameter_list component
@@ -43,6 +51,47 @@ union macro_arg_t {
 	struct object	result;	// value and flags (call by value)
 	struct symbol	*symbol;	// pointer to symbol struct (call by reference)
 };
+// call site cache entry: remembers which macro a call from a given source
+// position resolved to, so repeated calls from there (in loops, from within
+// other macros, or in later passes) do not have to search the macro tree.
+// "site" is the RAM read pointer for stored blocks and the file name for
+// files. Different calls may end up with the same position (RAM blocks of
+// loops get freed and re-used, several calls may share a line), so a hit is
+// only accepted if scope and signature match as well. The signature is not
+// built for this, but checked against the node's name while it is read.
+struct callsite {
+	const void	*site;	// RAM read pointer or file name
+	int		line_number;	// line number of call
+	scope_t		scope;	// macro scope at time of call
+	struct rwnode	*node;	// macro tree node the call resolved to
+};
+// memoized macro expansion: if an expansion did not depend on anything but
+// its arguments (no PC, no outside symbols, no files), the bytes it produced
+// are remembered, so later calls with the same arguments can just output
+// them again. "key" holds macro node, CPU/encoder state and argument values.
+struct memo {
+	char		*key;
+	size_t		key_size;
+	char		*bytes;	// produced bytes (with xor undone)
+	intval_t	size;
+	scope_t		local_scopes,	// scope numbers used up by expansion
+			cheap_scopes;
+};
+// info about an expansion in progress (linked list, innermost first)
+struct memo_frame {
+	struct memo_frame	*outer;
+	boolean			tainted;	// depends on more than arguments
+	scope_t			local_max,	// scope maxima at start, so larger
+				cheap_max;	// scopes are private to expansion
+	const struct cpu_type	*cpu_type;
+	boolean			a_is_long,
+				xy_are_long;
+	const struct encoder	*encoder;
+	char			xor;
+	intval_t		write_idx;
+	int			undefined_count,
+				throw_count;
+};
 
 
 // Variables
@@ -52,6 +101,12 @@ static struct rwnode	*macro_forest[256];	// trees (because of 8b hash)
 // Dynamic argument table
 static union macro_arg_t	*arg_table	= NULL;
 static int			argtable_size	= HALF_INITIAL_ARG_TABLE_SIZE;
+// call site cache (direct-mapped, entries get overwritten on collision)
+static struct callsite		callsite_cache[CALLSITE_CACHE_SIZE];
+// memoized expansions (direct-mapped as well)
+static	STRUCT_DYNABUF_REF(memo_key, NAME_INITIALSIZE);
+static struct memo		memo_table[MEMO_TABLE_SIZE];
+static struct memo_frame	*memo_innermost	= NULL;	// NULL if no expansion is tracked
 
 
 // Functions
@@ -66,9 +121,18 @@ static void enlarge_arg_table(void)
 		Throw_serious_error(exception_no_memory_left);
 }
 
-// Read macro scope and title. Title is read to GlobalDynaBuf and then copied
-// over to internal_name DynaBuf, where ARG_SEPARATOR is added.
-// In user_macro_name DynaBuf, the original name is reconstructed (even with
+// Copy macro title from GlobalDynaBuf to internal_name DynaBuf, where
+// ARG_SEPARATOR is added.
+static void start_internal_name(void)
+{
+	DYNABUF_CLEAR(internal_name);
+	DynaBuf_add_string(internal_name, GLOBALDYNABUF_CURRENT);
+	DynaBuf_append(internal_name, ARG_SEPARATOR);
+}
+
+// Read macro scope and title (for macro definitions). Title is read to
+// GlobalDynaBuf and then copied over to internal_name DynaBuf.
+// The original name is reconstructed in user_macro_name DynaBuf (even with
 // LOCAL_PREFIX) so a copy can be linked to the resulting macro struct.
 static scope_t get_scope_and_title(void)
 {
@@ -76,18 +140,15 @@ static scope_t get_scope_and_title(void)
 
 	Input_read_scope_and_keyword(&macro_scope);	// skips spaces before
 	// now GotByte = illegal character after title
-	// copy macro title to private dynabuf and add separator character
 	DYNABUF_CLEAR(user_macro_name);
-	DYNABUF_CLEAR(internal_name);
 	if (macro_scope != SCOPE_GLOBAL) {
 		// TODO - allow "cheap macros"?!
 		DynaBuf_append(user_macro_name, LOCAL_PREFIX);
 	}
 	DynaBuf_add_string(user_macro_name, GLOBALDYNABUF_CURRENT);
-	DynaBuf_add_string(internal_name, GLOBALDYNABUF_CURRENT);
 	DynaBuf_append(user_macro_name, '\0');
-	DynaBuf_append(internal_name, ARG_SEPARATOR);
-	SKIPSPACE();	// done here once so it's not necessary at two callers
+	start_internal_name();
+	SKIPSPACE();
 	return macro_scope;
 }
 
@@ -102,19 +163,19 @@ static int pipe_comma(void)
 	return result;
 }
 
-// Return malloc'd copy of string
+// Return malloc'd copy of string (accounted for as macro memory)
 static char *get_string_copy(const char *original)
 {
 	size_t	size;
 	char	*copy;
 
 	size = strlen(original) + 1;
-	copy = safe_malloc(size);
+	copy = tagged_malloc(size, MEM_MACROS);
 	memcpy(copy, original, size);
 	return copy;
 }
 
-// This function is called from both macro definition and macro call.
+// This function is called from macro definition.
 // Terminate macro name and copy from internal_name to GlobalDynaBuf
 // (because that's where Tree_hard_scan() looks for the search string).
 // Then try to find macro and return whether it was created.
@@ -128,6 +189,252 @@ static int search_for_macro(struct rwnode **result, scope_t scope, int create)
 	return Tree_hard_scan(result, macro_forest, scope, create);
 }
 
+// Get call site cache entry for a call (its title held in GlobalDynaBuf).
+// If the entry's macro has the same title, return the argument types of its
+// signature, so the call's types can be checked against them while they are
+// read. Otherwise return NULL.
+static const char *callsite_lookup(struct callsite **entry, const struct callsite *call, int title_length)
+{
+	size_t		index;
+	const char	*id;
+
+	index = ((size_t) call->site >> 2) ^ ((size_t) call->line_number * 31) ^ call->scope;
+	*entry = &callsite_cache[index & (CALLSITE_CACHE_SIZE - 1)];
+	if (((*entry)->node == NULL)
+	|| ((*entry)->site != call->site)
+	|| ((*entry)->line_number != call->line_number)
+	|| ((*entry)->scope != call->scope))
+		return NULL;
+
+	id = (*entry)->node->id_string;
+	if (strncmp(id, GLOBALDYNABUF_CURRENT, title_length) || (id[title_length] != ARG_SEPARATOR))
+		return NULL;
+
+	return id + title_length + 1;
+}
+
+// Add argument type to signature of call. As long as the types match the
+// ones of the cached macro, only "expected" is advanced. On the first
+// difference, the matching part of the macro's name is copied to
+// internal_name, which then grows to the call's signature.
+static void add_arg_type(const struct callsite *entry, const char **expected, char type)
+{
+	const char	*read;
+
+	if (*expected) {
+		if (**expected == type) {
+			++*expected;
+			return;
+		}
+		DYNABUF_CLEAR(internal_name);
+		for (read = entry->node->id_string; read < *expected; ++read)
+			DynaBuf_append(internal_name, *read);
+		*expected = NULL;
+	}
+	DynaBuf_append(internal_name, type);
+}
+
+// Find macro for a call whose signature does not match the cached one.
+// internal_name must hold the full signature (already terminated).
+// Stores NULL if there is no matching macro.
+static void find_called_macro(struct rwnode **result, struct callsite *entry, const struct callsite *call)
+{
+	DYNABUF_CLEAR(GlobalDynaBuf);
+	DynaBuf_add_string(GlobalDynaBuf, internal_name->buffer);
+	DynaBuf_append(GlobalDynaBuf, '\0');
+	Tree_hard_scan(result, macro_forest, call->scope, FALSE);
+	// only remember successful lookups (unknown macros are errors anyway)
+	if (*result) {
+		*entry = *call;
+		entry->node = *result;
+	}
+}
+
+// mark all expansions in progress as depending on more than their arguments
+void macro_memo_taint(void)
+{
+	struct memo_frame	*frame;
+
+	for (frame = memo_innermost; frame; frame = frame->outer)
+		frame->tainted = TRUE;
+}
+
+// a symbol in the given scope is accessed, so mark all expansions in progress
+// the scope is not private to. scope numbers only ever grow during a pass, so
+// a scope created after the start of an expansion belongs to it (and to all
+// outer ones). locals use even scope numbers, cheap locals use odd ones.
+void macro_memo_check_scope(scope_t scope)
+{
+	struct memo_frame	*frame;
+
+	for (frame = memo_innermost; frame; frame = frame->outer) {
+		if (scope > ((scope & 1) ? frame->cheap_max : frame->local_max))
+			return;	// private to this and all outer expansions
+
+		frame->tainted = TRUE;
+	}
+}
+
+// add raw data to memo key
+static void memo_add(const void *data, size_t size)
+{
+	const char	*read	= data;
+
+	while (size--)
+		DYNABUF_APPEND(memo_key, *read++);
+}
+
+// Build memo key for macro call in memo_key DynaBuf.
+// Returns FALSE if the expansion must not be memoized.
+static boolean memo_build_key(struct rwnode *macro_node, int arg_count)
+{
+	struct macro	*actual_macro	= macro_node->body;
+	struct object	*arg;
+	int		arg_index;
+
+	// user-defined tables are not part of the key, and call-by-reference
+	// args give access to outer symbols. (reports are fine: only lines read
+	// from files are shown, and the bytes of a replayed expansion are
+	// reported just like the real ones.)
+	if (actual_macro->impure
+	|| (encoder_current == &encoder_file)
+	|| strchr(strchr(macro_node->id_string, ARG_SEPARATOR), ARGTYPE_REF))
+		return FALSE;
+
+	DYNABUF_CLEAR(memo_key);
+	memo_add(&macro_node, sizeof(macro_node));
+	memo_add(&CPU_state.type, sizeof(CPU_state.type));
+	memo_add(&CPU_state.a_is_long, sizeof(CPU_state.a_is_long));
+	memo_add(&CPU_state.xy_are_long, sizeof(CPU_state.xy_are_long));
+	memo_add(&encoder_current, sizeof(encoder_current));
+	for (arg_index = 0; arg_index < arg_count; ++arg_index) {
+		arg = &(arg_table[arg_index].result);
+		memo_add(&arg->type, sizeof(arg->type));
+		if (arg->type == &type_number) {
+			if (arg->u.number.ntype == NUMTYPE_UNDEFINED)
+				return FALSE;
+
+			memo_add(&arg->u.number.ntype, sizeof(arg->u.number.ntype));
+			memo_add(&arg->u.number.flags, sizeof(arg->u.number.flags));
+			memo_add(&arg->u.number.addr_refs, sizeof(arg->u.number.addr_refs));
+			if (arg->u.number.ntype == NUMTYPE_INT)
+				memo_add(&arg->u.number.val.intval, sizeof(arg->u.number.val.intval));
+			else
+				memo_add(&arg->u.number.val.fpval, sizeof(arg->u.number.val.fpval));
+		} else if (arg->type == &type_string) {
+			memo_add(&arg->u.string->length, sizeof(arg->u.string->length));
+			memo_add(arg->u.string->payload, arg->u.string->length);
+		} else {
+			return FALSE;	// lists are not supported
+		}
+	}
+	return TRUE;
+}
+
+// return memo table slot for key in memo_key DynaBuf
+static struct memo *memo_slot(void)
+{
+	unsigned int	hash	= 2166136261u;	// FNV-1a
+	size_t		ii;
+
+	for (ii = 0; ii < memo_key->size; ++ii)
+		hash = (hash ^ (unsigned char) memo_key->buffer[ii]) * 16777619u;
+	return &memo_table[hash & (MEMO_TABLE_SIZE - 1)];
+}
+
+// start tracking an expansion
+static void memo_start(struct memo_frame *frame)
+{
+	frame->outer = memo_innermost;
+	frame->tainted = FALSE;
+	section_get_scope_maxima(&frame->local_max, &frame->cheap_max);
+	frame->cpu_type = CPU_state.type;
+	frame->a_is_long = CPU_state.a_is_long;
+	frame->xy_are_long = CPU_state.xy_are_long;
+	frame->encoder = encoder_current;
+	frame->xor = output_get_xor();
+	frame->write_idx = output_get_write_idx();
+	frame->undefined_count = pass.undefined_count;
+	frame->throw_count = Throw_get_counter();
+	memo_innermost = frame;
+}
+
+// stop tracking an expansion. if it was pure, store its output in given slot.
+// takes ownership of key.
+static void memo_end(struct memo_frame *frame, struct macro *actual_macro, char *key, size_t key_size, struct memo *memo)
+{
+	intval_t	size	= output_get_write_idx() - frame->write_idx;
+	scope_t		local_max,
+			cheap_max;
+
+	memo_innermost = frame->outer;
+	if (frame->tainted) {
+		actual_macro->impure = TRUE;	// do not bother trying again
+		safe_free(key);
+		return;
+	}
+
+	// do not memoize expansions with undefined results, messages or
+	// lasting state changes
+	if ((size > MEMO_MAX_SIZE)
+	|| (pass.undefined_count != frame->undefined_count)
+	|| (Throw_get_counter() != frame->throw_count)
+	|| (CPU_state.type != frame->cpu_type)
+	|| (CPU_state.a_is_long != frame->a_is_long)
+	|| (CPU_state.xy_are_long != frame->xy_are_long)
+	|| (encoder_current != frame->encoder)
+	|| (output_get_xor() != frame->xor)) {
+		safe_free(key);
+		return;
+	}
+
+	// replace previous contents of slot
+	safe_free(memo->key);
+	safe_free(memo->bytes);
+	memo->key = key;
+	memo->key_size = key_size;
+	memo->bytes = size ? tagged_malloc(size, MEM_MACROS) : NULL;
+	output_read_back(memo->bytes, frame->write_idx, size);
+	memo->size = size;
+	section_get_scope_maxima(&local_max, &cheap_max);
+	memo->local_scopes = local_max - frame->local_max;
+	memo->cheap_scopes = cheap_max - frame->cheap_max;
+}
+
+// free macro struct and its strings
+static void free_macro(void *body)
+{
+	struct macro	*macro	= body;
+
+	safe_free(macro->def_filename);
+	safe_free(macro->original_name);
+	safe_free(macro->parameter_list);
+	safe_free(macro->body);
+	safe_free(macro);
+}
+
+// forget all macros (done before assembling another build variant)
+void macros_clear(void)
+{
+	int	ii;
+
+	Tree_free_forest(macro_forest, free_macro);
+	// cached call sites and memoized expansions refer to freed macros
+	memset(callsite_cache, 0, sizeof(callsite_cache));
+	for (ii = 0; ii < MEMO_TABLE_SIZE; ++ii) {
+		safe_free(memo_table[ii].key);
+		safe_free(memo_table[ii].bytes);
+		memo_table[ii].key = NULL;
+		memo_table[ii].bytes = NULL;
+	}
+}
+
+// forget about expansions in progress
+void macro_passinit(void)
+{
+	memo_innermost = NULL;
+}
+
 // This function is called when an already existing macro is re-defined.
 // It first outputs a warning and then a serious error, stopping assembly.
 // Showing the first message as a warning guarantees that ACME does not reach
@@ -199,6 +506,7 @@ void Macro_parse_definition(void)	// Now GotByte = illegal char after "!macro"
 	// now GlobalDynaBuf = comma-separated parameter list without spaces,
 	// but terminated with CHAR_EOS.
 	formal_parameters = DynaBuf_get_copy(GlobalDynaBuf);
+	safe_tag(formal_parameters, MEM_MACROS);
 	// now GlobalDynaBuf = unused
 	// Reading the macro body would change the line number. To have correct
 	// error messages, we're checking for "macro twice" *now*.
@@ -207,32 +515,105 @@ void Macro_parse_definition(void)	// Now GotByte = illegal char after "!macro"
 	if (search_for_macro(&macro_node, macro_scope, TRUE) == FALSE)
 		report_redefinition(macro_node);	// quits with serious error
 	// Create new macro struct and set it up. Finally we'll read the body.
-	new_macro = safe_malloc(sizeof(*new_macro));
+	new_macro = tagged_malloc(sizeof(*new_macro), MEM_MACROS);
 	new_macro->def_line_number = Input_now->line_number;
 	new_macro->def_filename = get_string_copy(Input_now->original_filename);
 	new_macro->original_name = get_string_copy(user_macro_name->buffer);
 	new_macro->parameter_list = formal_parameters;
 	new_macro->body = Input_skip_or_store_block(TRUE);	// changes LineNumber
+	safe_tag(new_macro->body, MEM_MACROS);
+	new_macro->impure = FALSE;
 	macro_node->body = new_macro;	// link macro struct to tree node
 	// and that about sums it up
 }
 
+// macro call context
+struct call_frame {
+	struct flow_frame	frame;
+	struct input		macro_input,
+				*outer_input;
+	struct section		macro_section,
+				*outer_section;
+	char			outer_gotbyte;
+	int			outer_err_count;
+	struct macro		*macro;
+	// memoization stuff (only used if key is not NULL)
+	char			*key;
+	size_t			key_size;
+	struct memo		*memo;
+	struct memo_frame	memo_frame;
+};
+
+// end of macro body
+static boolean call_end(struct flow_frame *context)
+{
+	struct call_frame	*frame	= (struct call_frame *) context;
+
+	if (GotByte != CHAR_EOB)
+		Bug_found("IllegalBlockTerminator", GotByte);
+	// end section (free title memory, if needed)
+	section_finalize(&frame->macro_section);
+	// restore previous section
+	section_now = frame->outer_section;
+	// restore previous input:
+	Input_now = frame->outer_input;
+	// restore old Gotbyte context
+	GotByte = frame->outer_gotbyte;	// CAUTION - ugly kluge
+	if (frame->key)
+		memo_end(&frame->memo_frame, frame->macro, frame->key, frame->key_size, frame->memo);
+
+	// if needed, output call stack
+	if (Throw_get_counter() != frame->outer_err_count)
+		Throw_warning("...called from here.");
+
+	profile_end(1);
+	Input_ensure_EOS();
+	++macro_recursions_left;	// leave this nesting level
+	return FALSE;
+}
+
+// macro call aborted
+static void call_discard(struct flow_frame *context)
+{
+	struct call_frame	*frame	= (struct call_frame *) context;
+
+	section_finalize(&frame->macro_section);
+	section_now = frame->outer_section;	// (frame is about to be freed)
+	safe_free(frame->key);
+}
+
+// call given function for the call site of each macro call in progress
+void macro_for_each_call_site(void (*fn)(const struct input *call_site, const struct section *section))
+{
+	struct flow_frame	*frame;
+	struct call_frame	*call;
+
+	for (frame = flow_frame_top; frame; frame = frame->outer) {
+		if (frame->end != call_end)
+			continue;	// not a macro call
+
+		call = (struct call_frame *) frame;
+		fn(call->outer_input, call->outer_section);
+	}
+}
+
 // Parse macro call ("+MACROTITLE"). Has to be re-entrant.
+// The body is not parsed in here: a frame gets pushed, so the parser loop goes
+// on with the body and then calls call_end().
 void Macro_parse_call(void)	// Now GotByte = dot or first char of macro name
 {
-	char		local_gotbyte;
 	struct symbol	*symbol;
-	struct section	new_section,
-			*outer_section;
-	struct input	new_input,
-			*outer_input;
+	struct call_frame	*frame;
 	struct macro	*actual_macro;
 	struct rwnode	*macro_node,
 			*symbol_node;
-	scope_t		macro_scope,
-			symbol_scope;
-	int		arg_count	= 0;
-	int		outer_err_count;
+	scope_t		symbol_scope;
+	int		arg_count	= 0,
+			title_length;
+	struct callsite	call,
+			*entry;
+	const char	*expected;
+	struct memo	*memo	= NULL;
 
 	// make sure arg_table is ready (if not yet initialised, do it now)
 	if (arg_table == NULL)
@@ -242,9 +623,21 @@ void Macro_parse_call(void)	// Now GotByte = dot or first char of macro name
 	// Quit program if recursion too deep.
 	if (--macro_recursions_left < 0)
 		Throw_serious_error("Too deeply nested. Recursive macro calls?");
-	macro_scope = get_scope_and_title();
+	// remember call site for cache lookup
+	if (Input_now->source == INPUTSRC_RAM)
+		call.site = Input_now->src.ram_ptr;
+	else
+		call.site = Input_now->original_filename;
+	call.line_number = Input_now->line_number;
+	title_length = Input_read_scope_and_keyword(&call.scope);	// skips spaces before
+	// now GotByte = illegal character after title
+	// if cached macro has same title, check arg types against its signature,
+	// otherwise build signature in internal_name
+	expected = callsite_lookup(&entry, &call, title_length);
+	if (expected == NULL)
+		start_internal_name();	// internal_name = MacroTitle ARG_SEPARATOR (grows to signature)
+	SKIPSPACE();
 	// now GotByte = first non-space after title
-	// internal_name = MacroTitle ARG_SEPARATOR (grows to signature)
 	// Accept n>=0 comma-separated arguments before CHAR_EOS.
 	// Valid argument formats are:
 	//	~SYMBOL		call by ref
@@ -259,14 +652,14 @@ void Macro_parse_call(void)	// Now GotByte = dot or first char of macro name
 			// In both cases, GlobalDynaBuf may be used.
 			if (GotByte == REFERENCE_CHAR) {
 				// read call-by-reference arg
-				DynaBuf_append(internal_name, ARGTYPE_REF);
+				add_arg_type(entry, &expected, ARGTYPE_REF);
 				GetByte();	// eat '~'
 				Input_read_scope_and_keyword(&symbol_scope);
 				// GotByte = illegal char
 				arg_table[arg_count].symbol = symbol_find(symbol_scope);	// CAUTION, object type may be NULL!
 			} else {
 				// read call-by-value arg
-				DynaBuf_append(internal_name, ARGTYPE_VALUE);
+				add_arg_type(entry, &expected, ARGTYPE_VALUE);
 				ALU_any_result(&(arg_table[arg_count].result));
 			}
 			++arg_count;
@@ -275,85 +668,104 @@ void Macro_parse_call(void)	// Now GotByte = dot or first char of macro name
 	// now arg_table contains the arguments
 	// now GlobalDynaBuf = unused
 	// check for "unknown macro"
-	// Search for macro. Do not create if not found.
-	search_for_macro(&macro_node, macro_scope, FALSE);
+	// Use cached macro if all arg types matched, otherwise search for macro.
+	// Do not create if not found.
+	if (expected && (*expected == '\0')) {
+		macro_node = entry->node;
+	} else {
+		if (expected)
+			add_arg_type(entry, &expected, '\0');	// too few args
+		else
+			DynaBuf_append(internal_name, '\0');	// terminate macro name
+		find_called_macro(&macro_node, entry, &call);
+	}
 	if (macro_node == NULL) {
 		Throw_error("Macro not defined (or wrong signature).");
 		Input_skip_remainder();
-	} else {
-		// make macro_node point to the macro struct
-		actual_macro = macro_node->body;
-		local_gotbyte = GotByte;	// CAUTION - ugly kluge
-
-		// set up new input
-		new_input.original_filename = actual_macro->def_filename;
-		new_input.line_number = actual_macro->def_line_number;
-		new_input.source = INPUTSRC_RAM;
-		new_input.state = INPUTSTATE_NORMAL;	// FIXME - fix others!
-		new_input.src.ram_ptr = actual_macro->parameter_list;
-		// remember old input
-		outer_input = Input_now;
-		// activate new input
-		Input_now = &new_input;
-
-		outer_err_count = Throw_get_counter();	// remember error count (for call stack decision)
-
-		// remember old section
-		outer_section = section_now;
-		// start new section (with new scope)
-		// FALSE = title mustn't be freed
-		section_new(&new_section, "Macro", actual_macro->original_name, FALSE);
-		section_new_cheap_scope(&new_section);
-		GetByte();	// fetch first byte of parameter list
-		// assign arguments
-		if (GotByte != CHAR_EOS) {	// any at all?
-			arg_count = 0;
-			do {
-				// Decide whether call-by-reference
-				// or call-by-value
-				// In both cases, GlobalDynaBuf may be used.
-				if (GotByte == REFERENCE_CHAR) {
-					// assign call-by-reference arg
-					GetByte();	// eat '~'
-					Input_read_scope_and_keyword(&symbol_scope);
-					// create new tree node and link existing symbol struct from arg list to it
-					if ((Tree_hard_scan(&symbol_node, symbols_forest, symbol_scope, TRUE) == FALSE)
-					&& (FIRST_PASS))
-						Throw_error("Macro parameter twice.");
-					symbol_node->body = arg_table[arg_count].symbol;	// CAUTION, object type may be NULL
-				} else {
-					// assign call-by-value arg
-					Input_read_scope_and_keyword(&symbol_scope);
-					symbol = symbol_find(symbol_scope);
+		++macro_recursions_left;	// leave this nesting level
+		return;
+	}
+
+	// make macro_node point to the macro struct
+	actual_macro = macro_node->body;
+	profile_begin(PROFILE_MACRO, actual_macro->original_name, 0);	// ended by call_end() or below
+	if (memo_build_key(macro_node, arg_count)) {
+		memo = memo_slot();
+		if (memo->key
+		&& (memo->key_size == memo_key->size)
+		&& (memcmp(memo->key, memo_key->buffer, memo_key->size) == 0)) {
+			// same call as before, so just output the same bytes
+			output_sequence(memo->bytes, memo->size);
+			section_skip_scopes(memo->local_scopes, memo->cheap_scopes);
+			Input_ensure_EOS();
+			profile_end(1);
+			++macro_recursions_left;	// leave this nesting level
+			return;
+		}
+	}
+
+	frame = tagged_malloc(sizeof(*frame), MEM_MACROS);
+	frame->macro = actual_macro;
+	frame->key = NULL;
+	if (memo) {
+		frame->key = DynaBuf_get_copy(memo_key);
+		safe_tag(frame->key, MEM_MACROS);
+		frame->key_size = memo_key->size;
+		frame->memo = memo;
+		memo_start(&frame->memo_frame);
+	}
+	frame->outer_gotbyte = GotByte;	// CAUTION - ugly kluge
+
+	// set up new input
+	frame->macro_input.original_filename = actual_macro->def_filename;
+	frame->macro_input.line_number = actual_macro->def_line_number;
+	frame->macro_input.source = INPUTSRC_RAM;
+	frame->macro_input.state = INPUTSTATE_NORMAL;	// FIXME - fix others!
+	frame->macro_input.src.ram_ptr = actual_macro->parameter_list;
+	// remember old input
+	frame->outer_input = Input_now;
+	// activate new input
+	Input_now = &frame->macro_input;
+
+	frame->outer_err_count = Throw_get_counter();	// remember error count (for call stack decision)
+
+	// remember old section
+	frame->outer_section = section_now;
+	// start new section (with new scope)
+	// FALSE = title mustn't be freed
+	section_new(&frame->macro_section, "Macro", actual_macro->original_name, FALSE);
+	section_new_cheap_scope(&frame->macro_section);
+	GetByte();	// fetch first byte of parameter list
+	// assign arguments
+	if (GotByte != CHAR_EOS) {	// any at all?
+		arg_count = 0;
+		do {
+			// Decide whether call-by-reference
+			// or call-by-value
+			// In both cases, GlobalDynaBuf may be used.
+			if (GotByte == REFERENCE_CHAR) {
+				// assign call-by-reference arg
+				GetByte();	// eat '~'
+				Input_read_scope_and_keyword(&symbol_scope);
+				// create new tree node and link existing symbol struct from arg list to it
+				if ((Tree_hard_scan(&symbol_node, symbols_forest, symbol_scope, TRUE) == FALSE)
+				&& (FIRST_PASS))
+					Throw_error("Macro parameter twice.");
+				symbol_node->body = arg_table[arg_count].symbol;	// CAUTION, object type may be NULL
+			} else {
+				// assign call-by-value arg
+				Input_read_scope_and_keyword(&symbol_scope);
+				symbol = symbol_find(symbol_scope);
 // FIXME - find out if symbol was just created.
 // Then check for the same error message here as above ("Macro parameter twice.").
 // TODO - on the other hand, this would rule out globals as args (stupid anyway, but not illegal yet!)
-					symbol->object = arg_table[arg_count].result;	// FIXME - this assignment redefines globals/whatever without throwing errors!
-				}
-				++arg_count;
-			} while (Input_accept_comma());
-		}
-		// and now, finally, parse the actual macro body
-		Input_now->state = INPUTSTATE_NORMAL;	// FIXME - fix others!
-// maybe call parse_ram_block(actual_macro->def_line_number, actual_macro->body)
-		Input_now->src.ram_ptr = actual_macro->body;
-		Parse_until_eob_or_eof();
-		if (GotByte != CHAR_EOB)
-			Bug_found("IllegalBlockTerminator", GotByte);
-		// end section (free title memory, if needed)
-		section_finalize(&new_section);
-		// restore previous section
-		section_now = outer_section;
-		// restore previous input:
-		Input_now = outer_input;
-		// restore old Gotbyte context
-		GotByte = local_gotbyte;	// CAUTION - ugly kluge
-
-		// if needed, output call stack
-		if (Throw_get_counter() != outer_err_count)
-			Throw_warning("...called from here.");
-
-		Input_ensure_EOS();
+				symbol->object = arg_table[arg_count].result;	// FIXME - this assignment redefines globals/whatever without throwing errors!
+			}
+			++arg_count;
+		} while (Input_accept_comma());
 	}
-	++macro_recursions_left;	// leave this nesting level
+	// and now, finally, let the parser loop parse the actual macro body
+	Input_now->state = INPUTSTATE_NORMAL;	// FIXME - fix others!
+	Input_now->src.ram_ptr = actual_macro->body;
+	flow_push_frame(&frame->frame, call_end, call_discard);
 }
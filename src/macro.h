@@ -10,12 +10,29 @@
 #include "config.h"
 
 
+struct input;
+struct section;
+
+
 // Prototypes
 
 // only call once (during first pass)
 extern void Macro_parse_definition(void);
 // Parse macro call ("+MACROTITLE"). Has to be re-entrant.
 extern void Macro_parse_call(void);
+// forget all macros (done before assembling another build variant)
+extern void macros_clear(void);
+// forget about expansions in progress
+extern void macro_passinit(void);
+// memoization of macro expansions:
+// called whenever something reads or changes state that makes the current
+// macro expansion(s) depend on more than the arguments (PC, files, ...)
+extern void macro_memo_taint(void);
+// called on symbol access, taints expansions the given scope is not local to
+extern void macro_memo_check_scope(scope_t scope);
+// call given function for the call site of each macro call in progress
+// (innermost first), so messages can be shown with call stack later on
+extern void macro_for_each_call_site(void (*fn)(const struct input *call_site, const struct section *section));
 
 
 #endif
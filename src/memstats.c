@@ -0,0 +1,227 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Memory accounting ("--mem-stats")
+//
+// Each block got from safe_malloc() or tagged_malloc() is preceded by a small
+// header holding its size and category, so safe_free() knows what to subtract.
+// Dynamic buffers are accounted for separately by dynabuf.c, using their
+// reserved size. The report shows current and peak bytes and the number of
+// allocations (growing a block counts as an allocation) for each category,
+// and the same totals for each pass.
+#include "memstats.h"
+#include "config.h"
+#include "global.h"
+
+
+// constants
+#define PASSES_INITIAL_SIZE	8
+
+
+// header in front of each block
+union mem_header {
+	struct {
+		size_t			size;
+		enum mem_category	category;
+	} info;
+	double	align;	// make sure block after header is aligned
+};
+// counters for a category (or all of them)
+struct mem_count {
+	size_t	current,
+		peak;
+	long	allocations;
+};
+// counters for a pass
+struct mem_pass {
+	boolean	used;
+	long	allocations;
+	size_t	allocated,	// bytes
+		peak,
+		current;	// at end of pass
+};
+
+
+// variables
+static const char	*category_names[MEM_CATEGORIES]	= {
+	"other",	// MEM_OTHER
+	"symbols",	// MEM_SYMBOLS
+	"tree nodes",	// MEM_TREE
+	"macros",	// MEM_MACROS
+	"loops",	// MEM_LOOPS
+	"strings",	// MEM_STRINGS
+	"lists",	// MEM_LISTS
+	"segments",	// MEM_SEGMENTS
+	"ALU stacks",	// MEM_ALU
+	"output",	// MEM_OUTPUT
+	"files",	// MEM_FILES
+	"dynabufs",	// MEM_BUFFERS
+};
+static struct mem_count	categories[MEM_CATEGORIES];
+static struct mem_count	total;
+// index 0 is for allocations before first pass
+static struct mem_pass	*passes		= NULL;
+static int		passes_size	= 0;
+static int		passes_count	= 0;
+static int		pass_index	= 0;
+
+
+// get counters of current pass
+static struct mem_pass *current_pass(void)
+{
+	if (pass_index >= passes_size) {
+		passes_size = passes_size ? 2 * passes_size : PASSES_INITIAL_SIZE;
+		if (passes_size <= pass_index)
+			passes_size = pass_index + 1;
+		passes = realloc(passes, passes_size * sizeof(*passes));
+		if (passes == NULL)
+			Throw_serious_error(exception_no_memory_left);
+	}
+	while (passes_count <= pass_index)
+		passes[passes_count++].used = FALSE;
+	if (!passes[pass_index].used) {
+		passes[pass_index].used = TRUE;
+		passes[pass_index].allocations = 0;
+		passes[pass_index].allocated = 0;
+		passes[pass_index].peak = total.current;
+		passes[pass_index].current = total.current;
+	}
+	return &passes[pass_index];
+}
+
+
+// add to counters
+static void grow(struct mem_count *count, size_t amount)
+{
+	count->current += amount;
+	++count->allocations;
+	if (count->current > count->peak)
+		count->peak = count->current;
+}
+
+
+// account for change in size
+void memstats_account(enum mem_category category, size_t old_size, size_t new_size)
+{
+	struct mem_pass	*pass_count	= current_pass();
+
+	if (new_size > old_size) {
+		grow(&categories[category], new_size - old_size);
+		grow(&total, new_size - old_size);
+		++pass_count->allocations;
+		pass_count->allocated += new_size - old_size;
+		if (total.current > pass_count->peak)
+			pass_count->peak = total.current;
+	} else {
+		categories[category].current -= old_size - new_size;
+		total.current -= old_size - new_size;
+	}
+	pass_count->current = total.current;
+}
+
+
+// change size of block (or allocate new one if NULL) and die if not available
+void *tagged_realloc(void *block, size_t size, enum mem_category category)
+{
+	union mem_header	*header	= NULL;
+	size_t			old_size	= 0;
+
+	if (block) {
+		header = ((union mem_header *) block) - 1;
+		old_size = header->info.size;
+		category = header->info.category;
+	}
+	header = realloc(header, sizeof(*header) + size);
+	if (header == NULL)
+		Throw_serious_error(exception_no_memory_left);
+	header->info.size = size;
+	header->info.category = category;
+	memstats_account(category, old_size, size);
+	return header + 1;
+}
+
+
+// allocate memory for given category and die if not available
+void *tagged_malloc(size_t size, enum mem_category category)
+{
+	return tagged_realloc(NULL, size, category);
+}
+
+
+// release block (NULL is ignored)
+void safe_free(void *block)
+{
+	union mem_header	*header;
+
+	if (block == NULL)
+		return;
+
+	header = ((union mem_header *) block) - 1;
+	memstats_account(header->info.category, header->info.size, 0);
+	free(header);
+}
+
+
+// change category of block
+void safe_tag(void *block, enum mem_category category)
+{
+	union mem_header	*header;
+	struct mem_count	*old;
+
+	if (block == NULL)
+		return;
+
+	header = ((union mem_header *) block) - 1;
+	old = &categories[header->info.category];
+	old->current -= header->info.size;
+	--old->allocations;
+	grow(&categories[category], header->info.size);
+	header->info.category = category;
+}
+
+
+// start of pass
+void memstats_passinit(int pass_nr)
+{
+	pass_index = pass_nr + 1;
+	if (pass_index < passes_count)
+		passes[pass_index].used = FALSE;	// forget earlier run of this pass
+	current_pass();
+}
+
+
+// print counters
+static void print_count(FILE *fd, const char *name, const struct mem_count *count)
+{
+	fprintf(fd, "\t%-12s%12lu%12lu%12ld\n", name, (unsigned long) count->current, (unsigned long) count->peak, count->allocations);
+}
+
+
+// write report and forget per-pass statistics
+void memstats_report(FILE *fd)
+{
+	int	ii;
+
+	if (config.mem_stats) {
+		fprintf(fd, "Memory statistics (bytes):\n\t%-12s%12s%12s%12s\n", "category", "current", "peak", "allocs");
+		for (ii = 0; ii < MEM_CATEGORIES; ++ii) {
+			if (categories[ii].allocations)
+				print_count(fd, category_names[ii], &categories[ii]);
+		}
+		print_count(fd, "total", &total);
+		fprintf(fd, "\t%-12s%12s%12s%12s%12s\n", "pass", "allocated", "peak", "at end", "allocs");
+		for (ii = 0; ii < passes_count; ++ii) {
+			if (!passes[ii].used)
+				continue;
+
+			if (ii)
+				fprintf(fd, "\t%-12d", ii);
+			else
+				fprintf(fd, "\t%-12s", "setup");
+			fprintf(fd, "%12lu%12lu%12lu%12ld\n", (unsigned long) passes[ii].allocated, (unsigned long) passes[ii].peak, (unsigned long) passes[ii].current, passes[ii].allocations);
+		}
+	}
+	passes_count = 0;
+	pass_index = 0;
+}
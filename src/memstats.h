@@ -0,0 +1,53 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Memory accounting ("--mem-stats")
+#ifndef memstats_H
+#define memstats_H
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+// what memory is used for
+enum mem_category {
+	MEM_OTHER,	// everything not tagged otherwise
+	MEM_SYMBOLS,	// symbol structs
+	MEM_TREE,	// tree nodes and their names
+	MEM_MACROS,	// macro structs, names, parameter lists, bodies and memos
+	MEM_LOOPS,	// loop frames, bodies and conditions
+	MEM_STRINGS,	// string objects
+	MEM_LISTS,	// list objects and their items
+	MEM_SEGMENTS,	// list of output segments
+	MEM_ALU,	// ALU stacks and lists of undefined results
+	MEM_OUTPUT,	// pages of output buffer
+	MEM_FILES,	// cached source and binary files
+	MEM_BUFFERS,	// dynamic buffers
+	MEM_CATEGORIES	// end marker
+};
+
+
+// Prototypes
+// (counting is always done, "--mem-stats" only enables the report)
+
+// allocate memory for given category and die if not available
+extern void *tagged_malloc(size_t size, enum mem_category category);
+// change size of block (or allocate new one if NULL) and die if not available.
+// blocks keep their category, new ones get the given one.
+extern void *tagged_realloc(void *block, size_t size, enum mem_category category);
+// release block got from safe_malloc() or tagged_malloc() (NULL is ignored)
+extern void safe_free(void *block);
+// change category of block (for blocks allocated by generic code, like
+// DynaBuf_get_copy(). NULL is ignored)
+extern void safe_tag(void *block, enum mem_category category);
+// account for memory not allocated by the functions above (dynabufs)
+extern void memstats_account(enum mem_category category, size_t old_size, size_t new_size);
+// start of pass (statistics of a pass done again replace the old ones)
+extern void memstats_passinit(int pass_nr);
+// write report (if wanted) and forget per-pass statistics
+extern void memstats_report(FILE *fd);
+
+
+#endif
@@ -7,6 +7,7 @@
 #include "config.h"
 #include "alu.h"
 #include "cpu.h"
+#include "depgraph.h"
 #include "dynabuf.h"
 #include "global.h"
 #include "input.h"
@@ -723,6 +724,9 @@ static bits calc_arg_size(bits force_bit, struct number *argument, bits addressi
 			return NUMBER_FORCES_8;
 		}
 
+		// the 8-bit mode might have done, so let pass report know
+		if (addressing_modes & NUMBER_FORCES_8)
+			depgraph_unsure_size();
 		// if there is a 16-bit addressing, use that
 		// call helper function for "oversized addr mode" warning
 		if (NUMBER_FORCES_16 & addressing_modes) {
@@ -19,27 +19,33 @@
 #include "dynabuf.h"
 #include "global.h"
 #include "input.h"
+#include "macro.h"
 #include "platform.h"
+#include "replay.h"
 #include "tree.h"
 
 
 // constants
 #define NO_SEGMENT_START	(-1)	// invalid value to signal "not in a segment"
+#define BUFPAGE_BITS		12	// output buffer is split into pages of 4 KiB
+#define BUFPAGE_SIZE		(1 << BUFPAGE_BITS)
+#define BUFPAGE_MASK		(BUFPAGE_SIZE - 1)
+#define SEGMENTS_INITIAL_SIZE	64	// array of segments is doubled when full
 
 
-// structure for linked list of segment data
+// structure for segment data. segments are kept in an array sorted by start
+// address (and length), so lookups can use binary search.
 struct segment {
-	struct segment	*next,
-			*prev;
 	intval_t	start,
-			length;
+			length,
+			max_end;	// largest end (start + length) of this and all earlier segments
 };
 
 // structure for all output stuff:
 struct output {
 	// output buffer stuff
 	intval_t	bufsize;	// either 64 KiB or 16 MiB
-	char		*buffer;	// holds assembled code
+	char		**pages;	// hold assembled code (NULL: page is untouched, so all bytes are fill_value)
 	intval_t	write_idx;	// index of next write
 	intval_t	lowest_written;		// smallest address used
 	intval_t	highest_written;	// largest address used
@@ -49,7 +55,9 @@ struct output {
 		intval_t	start;	// start of current segment (or NO_SEGMENT_START)
 		intval_t	max;	// highest address segment may use
 		bits		flags;	// segment flags ("overlay" and "invisible", see header file)
-		struct segment	list_head;	// head element of doubly-linked ring list
+		struct segment	*list;	// sorted array of segments
+		int		count,	// number of segments in array
+				list_size;	// number of allocated entries
 	} segment;
 	char		xor;		// output modifier
 };
@@ -65,29 +73,34 @@ static struct output	*out	= &default_output;
 struct vcpu		CPU_state;	// current CPU state
 
 // FIXME - move output _file_ stuff to some other .c file!
-// possible file formats
-enum output_format {
-	OUTPUT_FORMAT_UNSPECIFIED,	// default (uses "plain" actually)
-	OUTPUT_FORMAT_APPLE,		// load address, length, code
-	OUTPUT_FORMAT_CBM,		// load address, code (default for "!to" pseudo opcode)
-	OUTPUT_FORMAT_PLAIN,		// code only
-	OUTPUT_FORMAT_HEX
-};
 // predefined stuff
 // tree to hold output formats (FIXME - a tree for three items, really?)
 static struct ronode	file_format_tree[]	= {
 	PREDEF_START,
-#define KNOWN_FORMATS	"'plain', 'cbm', 'apple', 'hex'"	// shown in CLI error message for unknown formats
+#define KNOWN_FORMATS	"'plain', 'cbm', 'apple', 'hex', 'srec'"	// shown in CLI error message for unknown formats
 	PREDEFNODE("apple",	OUTPUT_FORMAT_APPLE),
 	PREDEFNODE("cbm",	OUTPUT_FORMAT_CBM),
 //	PREDEFNODE("o65",	OUTPUT_FORMAT_O65),
 	PREDEFNODE("plain",	OUTPUT_FORMAT_PLAIN),
-	PREDEF_END("hex",	OUTPUT_FORMAT_HEX),
+	PREDEFNODE("hex",	OUTPUT_FORMAT_HEX),
+	PREDEF_END("srec",	OUTPUT_FORMAT_SREC),
 	//    ^^^^ this marks the last element
 };
 // chosen file format
 static enum output_format	output_format	= OUTPUT_FORMAT_UNSPECIFIED;
 const char			outputfile_formats[]	= KNOWN_FORMATS;	// string to show if outputfile_set_format() returns nonzero
+// additional output files holding address ranges ("!to" with range)
+#define OUTFILES_INITIAL_SIZE	8
+struct outfile {
+	char			*filename;
+	enum output_format	format;
+	intval_t		start,
+				end;	// exclusive
+	int			pass_number;	// to detect duplicates
+};
+static struct outfile	*outfile_list		= NULL;
+static int		outfile_count		= 0;
+static int		outfile_list_size	= 0;
 
 
 // report binary output
@@ -100,23 +113,62 @@ static void report_binary(char value)
 }
 
 
+// get pointer to byte in output buffer, allocating its page if needed.
+// the page ends at the next multiple of BUFPAGE_SIZE.
+static char *write_ptr(intval_t idx)
+{
+	char	**page	= &out->pages[idx >> BUFPAGE_BITS];
+
+	if (*page == NULL) {
+		*page = tagged_malloc(BUFPAGE_SIZE, MEM_OUTPUT);
+		memset(*page, out->fill_value, BUFPAGE_SIZE);
+	}
+	return *page + (idx & BUFPAGE_MASK);
+}
+
+
+// read byte from output buffer (without allocating anything)
+static char read_byte(intval_t idx)
+{
+	char	*page	= out->pages[idx >> BUFPAGE_BITS];
+
+	return page ? page[idx & BUFPAGE_MASK] : out->fill_value;
+}
+
+
+// return index of first segment that does not sort before the given start
+// address and length (so the new segment would have to be inserted there).
+static int find_segment(intval_t start, intval_t length)
+{
+	int	low	= 0,
+		high	= out->segment.count,
+		middle;
+
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		if ((out->segment.list[middle].start < start)
+		|| ((out->segment.list[middle].start == start) && (out->segment.list[middle].length < length)))
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return low;
+}
+
+
 // set up new out->segment.max value according to the given address.
 // just find the next segment start and subtract 1.
 static void find_segment_max(intval_t new_pc)
 {
-	struct segment	*test_segment	= out->segment.list_head.next;
+	int	index;
 
 	// search for smallest segment start address that
 	// is larger than given address
-	// use list head as sentinel
-// FIXME - if +1 overflows intval_t, we have an infinite loop!
-	out->segment.list_head.start = new_pc + 1;
-	while (test_segment->start <= new_pc)
-		test_segment = test_segment->next;
-	if (test_segment == &out->segment.list_head)
+	index = find_segment(new_pc + 1, 0);
+	if (index == out->segment.count)
 		out->segment.max = out->bufsize - 1;
 	else
-		out->segment.max = test_segment->start - 1;	// last free address available
+		out->segment.max = out->segment.list[index].start - 1;	// last free address available
 }
 
 
@@ -156,9 +208,9 @@ static void real_output(intval_t byte)
 	if (out->write_idx > out->highest_written)
 		out->highest_written = out->write_idx;
 	// write byte and advance ptrs
-	if (report->fd)
+	if (report->text)
 		report_binary(byte & 0xff);	// file for reporting, taking also CPU_2add
-	out->buffer[out->write_idx++] = (byte & 0xff) ^ out->xor;
+	*write_ptr(out->write_idx++) = (byte & 0xff) ^ out->xor;
 	++CPU_state.add_to_pc;
 }
 
@@ -173,11 +225,129 @@ static void no_output(intval_t byte)
 }
 
 
+// prepare for writing a run of bytes: do the checks real_output() does for
+// each byte, but only once for the whole run. returns FALSE if the bytes must
+// be sent one by one (because pc is undefined or the run would reach the next
+// segment, so warnings are the same as for single bytes).
+static boolean start_run(size_t size)
+{
+	if ((Output_byte != real_output)
+	|| (out->write_idx > out->segment.max)
+	|| (size - 1 > (size_t) (out->segment.max - out->write_idx)))
+		return FALSE;
+
+	// CAUTION - there are now three copies of these checks!
+	// new minimum address?
+	if (out->write_idx < out->lowest_written)
+		out->lowest_written = out->write_idx;
+	// new maximum address?
+	if (out->write_idx + (intval_t) size - 1 > out->highest_written)
+		out->highest_written = out->write_idx + size - 1;
+	return TRUE;
+}
+
+// get write pointer for next part of run (up to end of page) and advance ptrs.
+// returns size of part.
+static size_t next_run_part(char **target, size_t size)
+{
+	size_t	part	= BUFPAGE_SIZE - (out->write_idx & BUFPAGE_MASK);
+
+	if (part > size)
+		part = size;
+	*target = write_ptr(out->write_idx);
+	out->write_idx += part;
+	CPU_state.add_to_pc += part;
+	return part;
+}
+
+
+// send a sequence of bytes to output buffer, automatically increasing program counter
+void output_sequence(const char *src, size_t size)
+{
+	char	xor	= out->xor;
+	char	*target;
+	size_t	part,
+		ii;
+
+	if (size == 0)
+		return;
+
+	if (!start_run(size)) {
+		while (size--)
+			Output_byte(*src++);
+		return;
+	}
+
+	if (report->text) {
+		for (ii = 0; ii < size; ++ii)
+			report_binary(src[ii]);
+	}
+	while (size) {
+		part = next_run_part(&target, size);
+		if (xor) {
+			// simple enough for compilers to vectorize
+			for (ii = 0; ii < part; ++ii)
+				target[ii] = src[ii] ^ xor;
+		} else {
+			memcpy(target, src, part);
+		}
+		src += part;
+		size -= part;
+	}
+}
+
+
+// send a number of copies of a byte to output buffer, automatically increasing
+// program counter (same as calling Output_byte() for each byte)
+void output_fill(char value, size_t size)
+{
+	char	*target;
+	size_t	part,
+		ii;
+
+	if (size == 0)
+		return;
+
+	if (!start_run(size)) {
+		while (size--)
+			Output_byte(value);
+		return;
+	}
+
+	if (report->text) {
+		for (ii = 0; ii < size; ++ii)
+			report_binary(value);
+	}
+	while (size) {
+		part = next_run_part(&target, size);
+		memset(target, value ^ out->xor, part);
+		size -= part;
+	}
+}
+
+
+// get index of next write
+intval_t output_get_write_idx(void)
+{
+	return out->write_idx;
+}
+
+
+// copy already written bytes from output buffer, undoing the current xor
+void output_read_back(char *target, intval_t start, intval_t size)
+{
+	while (size--)
+		*target++ = read_byte(start++) ^ out->xor;
+}
+
+
 // skip over some bytes in output buffer without starting a new segment
 // (used by "!skip", and also called by "!binary" if really calling
 // Output_byte would be a waste of time)
 void output_skip(int size)
 {
+	macro_memo_taint();	// skipped bytes are not "produced", so do not memoize
+	replay_taint();
 	if (size < 1) {
 		// FIXME - ok for zero, but why is there no error message
 		// output for negative values?
@@ -207,9 +377,17 @@ void output_skip(int size)
 
 
 // fill output buffer with given byte value
+// (pages are released, so they will be re-allocated and filled when written to)
 static void fill_completely(char value)
 {
-	memset(out->buffer, value, out->bufsize);
+	intval_t	ii;
+
+	for (ii = 0; ii < out->bufsize >> BUFPAGE_BITS; ++ii) {
+		if (out->pages[ii]) {
+			safe_free(out->pages[ii]);
+			out->pages[ii] = NULL;
+		}
+	}
 	out->fill_value = value;
 }
 
@@ -218,6 +396,8 @@ static void fill_completely(char value)
 // returns zero if ok, nonzero if already set
 int output_initmem(char content)
 {
+	macro_memo_taint();
+	replay_taint();
 	// if MemInit flag is already set, complain
 	if (out->initvalue_set) {
 		Throw_warning("Memory already initialised.");
@@ -230,8 +410,8 @@ int output_initmem(char content)
 	// enforce another pass
 	if (pass.undefined_count == 0)
 		pass.undefined_count = 1;
-	//if (pass.needvalue_count == 0)	FIXME - use? instead or additionally?
-	//	pass.needvalue_count = 1;
+	if (pass.needvalue_count == 0)
+		pass.needvalue_count = 1;
 // FIXME - enforcing another pass is not needed if there hasn't been any
 // output yet. But that's tricky to detect without too much overhead.
 // The old solution was to add &&(out->lowest_written < out->highest_written+1) to "if" above
@@ -239,8 +419,8 @@ int output_initmem(char content)
 }
 
 
-// try to set output format held in DynaBuf. Returns zero on success.
-int outputfile_set_format(void)
+// try to find output format held in DynaBuf. Returns zero on success.
+int outputfile_lookup_format(enum output_format *format)
 {
 	void	*node_body;
 
@@ -248,10 +428,22 @@ int outputfile_set_format(void)
 	if (!Tree_easy_scan(file_format_tree, &node_body, GlobalDynaBuf))
 		return 1;
 
-	output_format = (enum output_format) node_body;
+	*format = (enum output_format) node_body;
 	return 0;
 }
 
+// try to set output format held in DynaBuf. Returns zero on success.
+int outputfile_set_format(void)
+{
+	return outputfile_lookup_format(&output_format);
+}
+
+// forget output format (before handling options of next server request)
+void outputfile_clear_format(void)
+{
+	output_format = OUTPUT_FORMAT_UNSPECIFIED;
+}
+
 // if file format was already chosen, returns zero.
 // if file format isn't set, chooses CBM and returns 1.
 int outputfile_prefer_cbm_format(void)
@@ -265,8 +457,10 @@ int outputfile_prefer_cbm_format(void)
 
 // select output file ("!to" pseudo opcode)
 // returns zero on success, nonzero if already set
-int outputfile_set_filename(void)
+int outputfile_set_filename(const char *filename)
 {
+	char	*copy;
+
 	// if output file already chosen, complain and exit
 	if (output_filename) {
 		Throw_warning("Output file already chosen.");
@@ -274,16 +468,92 @@ int outputfile_set_filename(void)
 	}
 
 	// get malloc'd copy of filename
-	output_filename = DynaBuf_get_copy(GlobalDynaBuf);
+	copy = safe_malloc(strlen(filename) + 1);
+	strcpy(copy, filename);
+	output_filename = copy;
 	return 0;	// ok
 }
 
+// add additional output file holding an address range ("!to" with range).
+// this is called in every pass, so the range may depend on symbols defined
+// later on: entries are looked up by name and the last pass wins.
+// returns zero on success, nonzero if file was already chosen in this pass
+int outputfile_add_range(const char *filename, enum output_format format, intval_t start, intval_t end)
+{
+	struct outfile	*file;
+	int		index;
+
+	for (index = 0; index < outfile_count; ++index) {
+		if (strcmp(outfile_list[index].filename, filename) == 0)
+			break;
+	}
+	if (index == outfile_count) {
+		// new entry, so make room
+		if (outfile_count == outfile_list_size) {
+			outfile_list_size = outfile_list_size ? 2 * outfile_list_size : OUTFILES_INITIAL_SIZE;
+			outfile_list = realloc(outfile_list, outfile_list_size * sizeof(*outfile_list));
+			if (outfile_list == NULL)
+				Throw_serious_error(exception_no_memory_left);
+		}
+		file = &outfile_list[outfile_count++];
+		file->filename = safe_malloc(strlen(filename) + 1);
+		strcpy(file->filename, filename);
+		file->pass_number = -1;
+	} else {
+		file = &outfile_list[index];
+	}
+	if (file->pass_number == pass.number) {
+		if (FIRST_PASS)
+			Throw_warning("Output file already chosen.");
+		return 1;	// failed
+	}
+	file->pass_number = pass.number;
+	file->format = format;
+	file->start = start;
+	file->end = end;
+	return 0;	// ok
+}
+
+// get number of additional output files ("!to" with range)
+int outputfile_range_count(void)
+{
+	return outfile_count;
+}
+
+// get file name of additional output file
+const char *outputfile_range_name(int index)
+{
+	return outfile_list[index].filename;
+}
+
 
 // init output struct (done later)
+// may be called again (server mode), a buffer of the same size is re-used then.
 void Output_init(signed long fill_value, boolean use_large_buf)
 {
-	out->bufsize = use_large_buf ? 0x1000000 : 0x10000;
-	out->buffer = safe_malloc(out->bufsize);
+	intval_t	bufsize	= use_large_buf ? 0x1000000 : 0x10000;
+
+	if (out->pages && (out->bufsize != bufsize)) {
+		fill_completely(0);	// frees all pages
+		safe_free(out->pages);
+		safe_free(out->segment.list);
+		out->pages = NULL;
+	}
+	if (out->pages == NULL) {
+		out->bufsize = bufsize;
+		// pages are only allocated when written to
+		out->pages = tagged_malloc((out->bufsize >> BUFPAGE_BITS) * sizeof(*out->pages), MEM_OUTPUT);
+		memset(out->pages, 0, (out->bufsize >> BUFPAGE_BITS) * sizeof(*out->pages));
+		// init segment array
+		out->segment.list_size = SEGMENTS_INITIAL_SIZE;
+		out->segment.list = tagged_malloc(out->segment.list_size * sizeof(*out->segment.list), MEM_SEGMENTS);
+	}
+	Output_reset(fill_value);
+}
+
+// forget all output (done before assembling another build variant)
+void Output_reset(signed long fill_value)
+{
 	if (fill_value == MEMINIT_USE_DEFAULT) {
 		fill_value = FILLVALUE_INITIAL;
 		out->initvalue_set = FALSE;
@@ -292,105 +562,218 @@ void Output_init(signed long fill_value, boolean use_large_buf)
 	}
 	// init output buffer (fill memory with initial value)
 	fill_completely(fill_value & 0xff);
-
-	// init ring list of segments
-	out->segment.list_head.next = &out->segment.list_head;
-	out->segment.list_head.prev = &out->segment.list_head;
+	// clear segment array
+	out->segment.count = 0;
+	// forget additional output files
+	while (outfile_count)
+		safe_free(outfile_list[--outfile_count].filename);
 }
 
-// output a single line in Intel HEX format
-void outputHexChunk(int start, unsigned char  size, FILE* fd)
+// text record output (Intel HEX and Motorola S-records)
+#define RECORD_BUFSIZE		65536	// records are collected here and then written in one go
+#define RECORD_MAXLEN		256	// more than enough for a single record
+#define RECORD_MAXDATA		64	// maximum number of data bytes per record
+#define RECORD_MAXEMPTY		32	// longer runs of fill value start a new record
+static const char	lower_digits[]	= "0123456789abcdef";
+static const char	upper_digits[]	= "0123456789ABCDEF";
+static struct {
+	FILE		*fd;
+	const char	*digits;	// hex digit table to use
+	unsigned int	checksum;	// sum of bytes in current record
+	intval_t	upper;		// Intel HEX: current upper 16 address bits
+	int		address_size;	// S-records: number of address bytes (2, 3 or 4)
+	int		used;
+	char		buffer[RECORD_BUFSIZE];
+} record;
+
+// write collected records to file
+static void record_flush(void)
 {
-	int addr = start;
-	fprintf(fd, ":%02x%04x00", size,addr);
+	fwrite(record.buffer, record.used, 1, record.fd);
+	record.used = 0;
+}
 
-	int checksum = size + (unsigned char)((addr & 0xff00)>>8) + (unsigned char)(addr & 0xff);
-	
-	for (int i = 0; i < size; ++i)
-	{
-		checksum += (unsigned char)out->buffer[start + i];
-		fprintf(fd, "%02x", (unsigned char)out->buffer[start + i]);
-	}
+// start a new record (make sure there is enough room in buffer)
+static void record_start(const char *prefix)
+{
+	if (record.used > RECORD_BUFSIZE - RECORD_MAXLEN)
+		record_flush();
+	while (*prefix)
+		record.buffer[record.used++] = *prefix++;
+	record.checksum = 0;
+}
 
-	checksum = ~checksum + 1;
-	fprintf(fd, "%02x\n", checksum & 0xff);
+// add byte to record as two hex digits and update checksum
+static void record_byte(unsigned char value)
+{
+	record.buffer[record.used++] = record.digits[value >> 4];
+	record.buffer[record.used++] = record.digits[value & 15];
+	record.checksum += value;
 }
 
-// output to Intel HEX
-void outputHex(intval_t start, intval_t amount, FILE* fd)
+// add address to record, big-endian
+static void record_address(intval_t address, int size)
 {
-	// max # of empty (fill) character before we start a new chunk
-	const int maxEmpty							 = 32;
+	while (size--)
+		record_byte((unsigned char) (address >> (8 * size)));
+}
 
-	// maximum bytes per line
-	const unsigned char maxChunkSize = 64;
+// add bytes from output buffer to record
+static void record_data(intval_t address, int size)
+{
+	while (size--)
+		record_byte((unsigned char) read_byte(address++));
+}
 
-	out->buffer;
+// end record
+static void record_end(void)
+{
+	record.buffer[record.used++] = '\n';
+}
 
-	int chunkStart = start;
-	int emptyCount = 0;
-	int i = start;
-	for (; i < amount; ++i)
-	{
-		char c = out->buffer[i];
-		if (out->fill_value && c == out->fill_value)
-		{
-			++emptyCount;
-			continue;
+// output Intel HEX data record(s), inserting extended linear address
+// records whenever the upper 16 address bits change
+static void ihex_record(intval_t address, int size)
+{
+	int	part;
+
+	while (size) {
+		// records must not cross 64 KiB borders
+		part = 0x10000 - (address & 0xffff);
+		if (part > size)
+			part = size;
+		if ((address >> 16) != record.upper) {
+			record.upper = address >> 16;
+			record_start(":");
+			record_byte(2);
+			record_address(0, 2);
+			record_byte(4);	// record type: extended linear address
+			record_address(record.upper, 2);
+			record_byte((unsigned char) -record.checksum);
+			record_end();
 		}
+		record_start(":");
+		record_byte((unsigned char) part);
+		record_address(address, 2);
+		record_byte(0);	// record type: data
+		record_data(address, part);
+		record_byte((unsigned char) -record.checksum);
+		record_end();
+		address += part;
+		size -= part;
+	}
+}
 
-		int chunkSize = i - chunkStart;
+// output Motorola S-record (type given by address size)
+static void srec_record(intval_t address, int size)
+{
+	static const char	*prefix[]	= {"S1", "S2", "S3"};
+
+	record_start(prefix[record.address_size - 2]);
+	record_byte((unsigned char) (record.address_size + size + 1));
+	record_address(address, record.address_size);
+	record_data(address, size);
+	record_byte((unsigned char) ~record.checksum);
+	record_end();
+}
+
+// split used part of output buffer into records.
+// runs of more than RECORD_MAXEMPTY fill bytes are skipped, unless fill value is zero.
+static void write_records(intval_t start, intval_t end, void (*fn)(intval_t, int))
+{
+	intval_t	chunk_start	= start,
+			ii;
+	int		empty_count	= 0,
+			chunk_size,
+			amount;
 
-		if (emptyCount > maxEmpty)
-		{
-			chunkSize -= emptyCount;
+	for (ii = start; ii < end; ++ii) {
+		if (out->fill_value && read_byte(ii) == out->fill_value) {
+			++empty_count;
+			continue;
 		}
+		chunk_size = ii - chunk_start;
+		if (empty_count > RECORD_MAXEMPTY)
+			chunk_size -= empty_count;
 		else
-		{
-			emptyCount = 0;
-		}
-
-		if (emptyCount || chunkSize >= maxChunkSize)
-		{
-			int bytesToWrite = chunkSize > maxChunkSize ? maxChunkSize : chunkSize;
-
-			outputHexChunk(chunkStart, bytesToWrite, fd);
-			chunkStart = i - (chunkSize - bytesToWrite);
+			empty_count = 0;
+		if (empty_count || chunk_size >= RECORD_MAXDATA) {
+			amount = chunk_size > RECORD_MAXDATA ? RECORD_MAXDATA : chunk_size;
+			if (amount)
+				fn(chunk_start, amount);
+			chunk_start = ii - (chunk_size - amount);
 		}
-
-		emptyCount = 0;
+		empty_count = 0;
 	}
-
-	unsigned char  chunkSize = i - chunkStart;
-	if (chunkSize)
-	{
-		outputHexChunk(chunkStart, chunkSize, fd);
+	// remainder (may include trailing fill bytes)
+	while (chunk_start < end) {
+		amount = end - chunk_start;
+		if (amount > RECORD_MAXDATA)
+			amount = RECORD_MAXDATA;
+		fn(chunk_start, amount);
+		chunk_start += amount;
 	}
-	fputs(":00000001ff", fd);
 }
 
+// output to Intel HEX
+static void save_hex(intval_t start, intval_t end, FILE *fd)
+{
+	record.fd = fd;
+	record.digits = lower_digits;
+	record.upper = 0;
+	record.used = 0;
+	write_records(start, end, ihex_record);
+	record_start(":00000001ff");	// end of file record
+	record_flush();
+}
 
-// dump used portion of output buffer into output file
-void Output_save_file(FILE *fd)
+// output to Motorola S-records
+static void save_srec(intval_t start, intval_t end, FILE *fd)
 {
-	intval_t	start,
-			amount;
+	static const char	*terminator[]	= {"S9", "S8", "S7"};
+
+	record.fd = fd;
+	record.digits = upper_digits;
+	record.used = 0;
+	// choose record type according to highest address
+	if (end <= 0x10000)
+		record.address_size = 2;
+	else if (end <= 0x1000000)
+		record.address_size = 3;
+	else
+		record.address_size = 4;
+	// header record (no data)
+	record_start("S0");
+	record_byte(3);
+	record_address(0, 2);
+	record_byte((unsigned char) ~record.checksum);
+	record_end();
+	write_records(start, end, srec_record);
+	// termination record (start address zero)
+	record_start(terminator[record.address_size - 2]);
+	record_byte((unsigned char) (record.address_size + 1));
+	record_address(0, record.address_size);
+	record_byte((unsigned char) ~record.checksum);
+	record_end();
+	record_flush();
+}
 
-	if (out->highest_written < out->lowest_written) {
-		// nothing written
-		start = 0;	// I could try to use some segment start, but what for?
-		amount = 0;
-	} else {
-		start = out->lowest_written;
-		amount = out->highest_written - start + 1;
-	}
+
+// dump part of output buffer into output file
+static void save_part(FILE *fd, enum output_format format, const char *filename, intval_t start, intval_t amount)
+{
+	intval_t	part,
+			ii;
+	char		*page;
+
+	(void) filename;	// only used on platforms with file types (see PLATFORM_SETFILETYPE_*)
 	if (config.process_verbosity)
 		printf("Saving %ld (0x%lx) bytes (0x%lx - 0x%lx exclusive).\n",
 			amount, amount, start, start + amount);
 	// output file header according to file format
-	switch (output_format) {
+	switch (format) {
 	case OUTPUT_FORMAT_APPLE:
-		PLATFORM_SETFILETYPE_APPLE(output_filename);
+		PLATFORM_SETFILETYPE_APPLE(filename);
 		// output 16-bit load address in little-endian byte order
 		putc(start & 255, fd);
 		putc(start >> 8, fd);
@@ -400,46 +783,131 @@ void Output_save_file(FILE *fd)
 		break;
 	case OUTPUT_FORMAT_UNSPECIFIED:
 	case OUTPUT_FORMAT_PLAIN:
-		PLATFORM_SETFILETYPE_PLAIN(output_filename);
+		PLATFORM_SETFILETYPE_PLAIN(filename);
 		break;
 	case OUTPUT_FORMAT_CBM:
-		PLATFORM_SETFILETYPE_CBM(output_filename);
+		PLATFORM_SETFILETYPE_CBM(filename);
 		// output 16-bit load address in little-endian byte order
 		putc(start & 255, fd);
 		putc(start >> 8, fd);
 		break;
 	case OUTPUT_FORMAT_HEX:
-		PLATFORM_SETFILETYPE_HEX(output_filename);
-		outputHex(start, start + amount, fd);
+		PLATFORM_SETFILETYPE_HEX(filename);
+		save_hex(start, start + amount, fd);
+		return;
+	case OUTPUT_FORMAT_SREC:
+		PLATFORM_SETFILETYPE_SREC(filename);
+		save_srec(start, start + amount, fd);
 		return;
 	}
-	// dump output buffer to file
-	fwrite(out->buffer + start, amount, 1, fd);
+	// dump output buffer to file, page by page
+	while (amount) {
+		part = BUFPAGE_SIZE - (start & BUFPAGE_MASK);
+		if (part > amount)
+			part = amount;
+		page = out->pages[start >> BUFPAGE_BITS];
+		if (page) {
+			fwrite(page + (start & BUFPAGE_MASK), part, 1, fd);
+		} else {
+			// untouched page, so all bytes are fill value
+			for (ii = 0; ii < part; ++ii)
+				putc(out->fill_value, fd);
+		}
+		start += part;
+		amount -= part;
+	}
 }
 
+// get start address and size of used portion of output buffer
+void Output_get_used_range(intval_t *start, intval_t *amount)
+{
+	if (out->highest_written < out->lowest_written) {
+		// nothing written
+		*start = 0;	// I could try to use some segment start, but what for?
+		*amount = 0;
+	} else {
+		*start = out->lowest_written;
+		*amount = out->highest_written - *start + 1;
+	}
+}
 
-// link segment data into segment ring
-static void link_segment(intval_t start, intval_t length)
+// copy part of output buffer to memory (no file format header)
+void Output_copy_part(char *target, intval_t start, intval_t amount)
 {
-	struct segment	*new_segment,
-			*test_segment	= out->segment.list_head.next;
+	intval_t	part;
+	char		*page;
+
+	while (amount) {
+		part = BUFPAGE_SIZE - (start & BUFPAGE_MASK);
+		if (part > amount)
+			part = amount;
+		page = out->pages[start >> BUFPAGE_BITS];
+		if (page)
+			memcpy(target, page + (start & BUFPAGE_MASK), part);
+		else
+			memset(target, out->fill_value, part);	// untouched page
+		target += part;
+		start += part;
+		amount -= part;
+	}
+}
+
+// dump used portion of output buffer into output file
+void Output_save_file(FILE *fd)
+{
+	intval_t	start,
+			amount;
+
+	Output_get_used_range(&start, &amount);
+	save_part(fd, output_format, output_filename, start, amount);
+}
 
-	// init new segment
-	new_segment = safe_malloc(sizeof(*new_segment));
-	new_segment->start = start;
-	new_segment->length = length;
-	// use ring head as sentinel
-	out->segment.list_head.start = start;
-	out->segment.list_head.length = length + 1;	// +1 to make sure sentinel exits loop
-	// walk ring to find correct spot
-	while ((test_segment->start < new_segment->start)
-	|| ((test_segment->start == new_segment->start) && (test_segment->length < new_segment->length)))
-		test_segment = test_segment->next;
-	// link into ring
-	new_segment->next = test_segment;
-	new_segment->prev = test_segment->prev;
-	new_segment->next->prev = new_segment;
-	new_segment->prev->next = new_segment;
+// dump address range of additional output file into file
+// (range is not trimmed, so unused parts are written as fill value)
+void Output_save_range(int index, FILE *fd)
+{
+	struct outfile	*file	= &outfile_list[index];
+	intval_t	start	= file->start,
+			end	= file->end;
+
+	// clip to output buffer
+	if (start < 0)
+		start = 0;
+	if (end > out->bufsize)
+		end = out->bufsize;
+	if (end < start)
+		end = start;
+	save_part(fd, file->format, file->filename, start, end - start);
+}
+
+
+// insert segment data into sorted segment array
+static void link_segment(intval_t start, intval_t length)
+{
+	struct segment	*list;
+	int		index;
+	intval_t	max_end;
+
+	// make room
+	if (out->segment.count == out->segment.list_size) {
+		out->segment.list_size *= 2;
+		out->segment.list = tagged_realloc(out->segment.list, out->segment.list_size * sizeof(*out->segment.list), MEM_SEGMENTS);
+	}
+	list = out->segment.list;
+	// find correct spot (segments are usually created in ascending order,
+	// so this is mostly at the end and the loop below does not run long)
+	index = find_segment(start, length);
+	memmove(list + index + 1, list + index, (out->segment.count - index) * sizeof(*list));
+	++out->segment.count;
+	list[index].start = start;
+	list[index].length = length;
+	// update running maximum of segment ends
+	max_end = index ? list[index - 1].max_end : 0;
+	for (; index < out->segment.count; ++index) {
+		if (list[index].start + list[index].length > max_end)
+			max_end = list[index].start + list[index].length;
+		list[index].max_end = max_end;
+	}
 }
 
 
@@ -447,23 +915,17 @@ static void link_segment(intval_t start, intval_t length)
 // only call in first pass, otherwise too many warnings might be thrown	(TODO - still?)
 static void check_segment(intval_t new_pc)
 {
-	struct segment	*test_segment	= out->segment.list_head.next;
-
-	// use list head as sentinel
-	out->segment.list_head.start = new_pc + 1;	// +1 to make sure sentinel exits loop
-	out->segment.list_head.length = 1;
-	// search ring for matching entry
-	while (test_segment->start <= new_pc) {
-		if ((test_segment->start + test_segment->length) > new_pc) {
-			// TODO - include overlap size in error message!
-			if (config.segment_warning_is_error)
-				Throw_error("Segment starts inside another one, overwriting it.");
-			else
-				Throw_warning("Segment starts inside another one, overwriting it.");
-			return;
-		}
+	int	index;
 
-		test_segment = test_segment->next;
+	// all segments starting at or before the given pc are stored before
+	// this index, so check whether one of them reaches beyond pc:
+	index = find_segment(new_pc + 1, 0);
+	if (index && (out->segment.list[index - 1].max_end > new_pc)) {
+		// TODO - include overlap size in error message!
+		if (config.segment_warning_is_error)
+			Throw_error("Segment starts inside another one, overwriting it.");
+		else
+			Throw_warning("Segment starts inside another one, overwriting it.");
 	}
 }
 
@@ -594,6 +1056,8 @@ void vcpu_set_pc(intval_t new_pc, bits segment_flags)
 			// stuff happens! i see no reason to try to mimic that.
 		}
 	}
+	macro_memo_taint();
+	replay_taint();
 	pc_change = new_pc - CPU_state.pc.val.intval;
 	CPU_state.pc.val.intval = new_pc;	// FIXME - oversized values are accepted without error and will be wrapped at end of statement!
 	CPU_state.pc.ntype = NUMTYPE_INT;	// FIXME - remove when allowing undefined!
@@ -634,6 +1098,7 @@ Maybe like this:
 // get program counter
 void vcpu_read_pc(struct number *target)
 {
+	macro_memo_taint();	// result depends on position
 	*target = CPU_state.pc;
 }
 
@@ -664,6 +1129,8 @@ void pseudopc_start(struct number *new_pc)
 {
 	struct pseudopc	*new_context;
 
+	macro_memo_taint();
+	replay_taint();
 	new_context = safe_malloc(sizeof(*new_context));	// create new struct (this must never be freed, as it gets linked to labels!)
 	new_context->outer = pseudopc_current_context;	// let it point to previous one
 	pseudopc_current_context = new_context;	// make it the current one
@@ -677,6 +1144,8 @@ void pseudopc_start(struct number *new_pc)
 // end offset assembly
 void pseudopc_end(void)
 {
+	macro_memo_taint();
+	replay_taint();
 	if (pseudopc_current_context == NULL) {
 		// trying to end offset assembly though it isn't active:
 		// in current versions this cannot happen and so must be a bug.
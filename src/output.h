@@ -43,29 +43,67 @@ extern void Output_passinit(void);
 
 // alloc and init mem buffer (done later)
 extern void Output_init(signed long fill_value, boolean use_large_buf);
+// forget all output (done before assembling another build variant)
+extern void Output_reset(signed long fill_value);
 // skip over some bytes in output buffer without starting a new segment
 // (used by "!skip", and also called by "!binary" if really calling
 // Output_byte would be a waste of time)
 extern void output_skip(int size);
 // Send low byte of arg to output buffer and advance pointer
-// FIXME - replace by output_sequence(char *src, size_t size)
+// (for runs of bytes, use output_sequence() or output_fill() instead)
 extern void (*Output_byte)(intval_t);
+// send a sequence of bytes to output buffer, automatically increasing
+// program counter (same as calling Output_byte() for each byte)
+extern void output_sequence(const char *src, size_t size);
+// send a number of copies of a byte to output buffer, automatically increasing
+// program counter (same as calling Output_byte() for each byte)
+extern void output_fill(char value, size_t size);
+// get index of next write (used to find out what a macro expansion produced)
+extern intval_t output_get_write_idx(void);
+// copy already written bytes from output buffer, undoing the current xor
+extern void output_read_back(char *target, intval_t start, intval_t size);
 // define default value for empty memory ("!initmem" pseudo opcode)
 // returns zero if ok, nonzero if already set
 extern int output_initmem(char content);
 
 // outfile stuff:
 
+// possible file formats
+enum output_format {
+	OUTPUT_FORMAT_UNSPECIFIED,	// default (uses "plain" actually)
+	OUTPUT_FORMAT_APPLE,		// load address, length, code
+	OUTPUT_FORMAT_CBM,		// load address, code (default for "!to" pseudo opcode)
+	OUTPUT_FORMAT_PLAIN,		// code only
+	OUTPUT_FORMAT_HEX,		// Intel HEX records
+	OUTPUT_FORMAT_SREC		// Motorola S-records
+};
+// try to find output format held in DynaBuf. Returns zero on success.
+extern int outputfile_lookup_format(enum output_format *format);
 // try to set output format held in DynaBuf. Returns zero on success.
 extern int outputfile_set_format(void);
 extern const char	outputfile_formats[];	// string to show if outputfile_set_format() returns nonzero
+// forget output format (before handling options of next server request)
+extern void outputfile_clear_format(void);
 // if file format was already chosen, returns zero.
 // if file format isn't set, chooses CBM and returns 1.
 extern int outputfile_prefer_cbm_format(void);
-// try to set output file name held in DynaBuf. Returns zero on success.
-extern int outputfile_set_filename(void);
+// try to set output file name. Returns zero on success.
+extern int outputfile_set_filename(const char *filename);
+// add additional output file holding an address range ("!to" with range).
+// returns zero on success, nonzero if file was already chosen in this pass
+extern int outputfile_add_range(const char *filename, enum output_format format, intval_t start, intval_t end);
+// get number of additional output files
+extern int outputfile_range_count(void);
+// get file name of additional output file
+extern const char *outputfile_range_name(int index);
 // write smallest-possible part of memory buffer to file
 extern void Output_save_file(FILE *fd);
+// get start address and size of used portion of output buffer
+extern void Output_get_used_range(intval_t *start, intval_t *amount);
+// copy part of output buffer to memory (no file format header)
+extern void Output_copy_part(char *target, intval_t start, intval_t amount);
+// write address range of additional output file to file
+extern void Output_save_range(int index, FILE *fd);
 // change output pointer and enable output
 extern void Output_start_segment(intval_t address_change, bits segment_flags);
 // Show start and end of current segment
@@ -0,0 +1,142 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Pass driver (shared by stand-alone assembler and library interface)
+//
+// Sources are assembled again and again until all results are defined, or
+// until the remaining undefined ones are known not to matter, or until
+// further passes would not help. The front ends only differ in how they
+// report problems and what they do with the output.
+#include "passes.h"
+#include <stdio.h>
+#include "acme.h"
+#include "alu.h"
+#include "cpu.h"
+#include "depgraph.h"
+#include "dynabuf.h"
+#include "encoding.h"
+#include "flow.h"
+#include "global.h"
+#include "input.h"
+#include "memstats.h"
+#include "output.h"
+#include "profile.h"
+#include "replay.h"
+#include "section.h"
+
+
+// start collecting listing report of another pass
+static void report_passinit(void)
+{
+	if (report->text)
+		DYNABUF_CLEAR(report->text);
+	report->asc_used = 0;
+	report->bin_used = 0;
+	report->last_input = NULL;
+}
+
+
+// increment pass number and perform a single pass
+void passes_perform(struct assembly *assembly)
+{
+	const struct filecontents	*file;
+	int				ii;
+
+	++pass.number;
+	// call modules' "pass init" functions
+	Output_passinit();	// disable output, PC undefined
+	cputype_passinit(assembly->default_cpu);	// set default cpu type
+	// if start address was given, use it:
+	if (assembly->start_address != -1)
+		vcpu_set_pc(assembly->start_address, 0);
+	encoding_passinit();	// set default encoding
+	section_passinit();	// set initial zone (untitled)
+	// init variables
+	pass.undefined_count = 0;
+	pass.needvalue_count = 0;
+	pass.error_count = 0;
+	ALU_passinit();
+	flow_passinit();
+	replay_passinit();
+	report_passinit();
+	depgraph_passinit();
+	memstats_passinit(pass.number);
+	profile_passinit();
+	profile_begin(PROFILE_PASS, NULL, pass.number + 1);
+	// Process toplevel files
+	for (ii = 0; ii < assembly->source_count; ++ii) {
+		DYNABUF_CLEAR(GlobalDynaBuf);
+		DynaBuf_add_string(GlobalDynaBuf, assembly->sources[ii]);
+		DynaBuf_append(GlobalDynaBuf, '\0');
+		if ((file = includepaths_load_toplevel())) {
+			flow_parse_file(file, assembly->sources[ii]);
+		} else {
+			assembly->cannot_open(assembly->sources[ii]);
+			++pass.error_count;
+		}
+	}
+	Output_end_segment();
+	profile_end(1);
+/*	TODO:
+	if --save-start is given, parse arg string
+	if --save-limit is given, parse arg string
+*/
+}
+
+
+// check whether output of current pass is final although there are undefined
+// results: they must not be needed for output (nor for symbol list or VICE
+// labels) and they must all be forward references, so there are no errors.
+// "!ifdef"/"!ifndef" must not have tested symbols that were still to come.
+static boolean output_is_final(struct assembly *assembly)
+{
+	return (pass.needvalue_count == 0)
+		&& (symbollist_filename == NULL)	// (may be set by "!sl")
+		&& !assembly->lists_all_symbols
+		&& ALU_forward_refs_only()
+		&& flow_ifdef_results_final();
+}
+
+
+// do passes until done (or errors occurred). Return whether output is ready.
+boolean passes_do(struct assembly *assembly)
+{
+	int	undefs_before;	// number of undefined results in previous pass
+
+	if (config.process_verbosity > 1)
+		puts("First pass.");
+	pass.complain_about_undefined = FALSE;	// disable until error pass needed
+	pass.number = -1;	// pre-init, will be incremented by passes_perform()
+	if (!(assembly->first_pass && assembly->first_pass(assembly)))
+		passes_perform(assembly);	// first pass
+	if (pass.error_count)
+		return FALSE;
+
+	// pretend there has been a previous pass, with one more undefined result
+	undefs_before = pass.undefined_count + 1;
+	// keep doing passes as long as the number of undefined results keeps decreasing.
+	// stop on zero, or when the remaining ones do not matter.
+	while (pass.undefined_count && (pass.undefined_count < undefs_before) && !output_is_final(assembly)) {
+		undefs_before = pass.undefined_count;
+		if (config.process_verbosity > 1)
+			puts("Further pass.");
+		passes_perform(assembly);
+		if (pass.error_count)
+			return FALSE;
+	}
+	// any errors left?
+	if ((pass.undefined_count == 0) || output_is_final(assembly))
+		return TRUE;
+
+	// There are still errors (unsolvable by doing further passes).
+	// Show the ones found in the last pass or, if there are none, perform
+	// additional pass to find them.
+	if (ALU_throw_undefined() == 0) {
+		if (config.process_verbosity > 1)
+			puts("Extra pass needed to find error.");
+		pass.complain_about_undefined = TRUE;	// activate error output
+		passes_perform(assembly);	// perform pass, but now show "value undefined"
+	}
+	return FALSE;
+}
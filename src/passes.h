@@ -0,0 +1,41 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Pass driver (shared by stand-alone assembler and library interface)
+#ifndef passes_H
+#define passes_H
+
+
+#include "config.h"
+
+
+struct cpu_type;
+
+// context of an assembly: what to assemble and how the front end wants to
+// hear about it. symbols, macros, output buffer etc. are still held by the
+// modules themselves, so there can only be one assembly at a time.
+struct assembly {
+	const char * const	*sources;	// names of toplevel source files
+	int			source_count;
+	const struct cpu_type	*default_cpu;	// NULL means default
+	signed long		start_address;	// -1 means none
+	boolean			lists_all_symbols;	// front end wants all values, so undefined ones always need another pass
+	// called if toplevel file could not be loaded (error is counted by caller)
+	void			(*cannot_open)(const char *name);
+	// if set, called for the first pass. returns FALSE if the pass was not
+	// usable, so a normal first pass must be done.
+	boolean			(*first_pass)(struct assembly *assembly);
+};
+
+
+// Prototypes
+
+// increment pass number and perform a single pass
+extern void passes_perform(struct assembly *assembly);
+// do passes until done (or errors occurred). Return whether output is ready.
+// If not, errors have been shown or there was an error pass without errors.
+extern boolean passes_do(struct assembly *assembly);
+
+
+#endif
@@ -0,0 +1,449 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Profiler ("--stats", "--trace" and "--line-profile")
+//
+// Passes, included files, macro expansions and loops are timed. Timings of the
+// same kind and name are added up in a table, so "--stats" can show where the
+// time went. Times include everything nested inside (a macro's time includes
+// the loops it expands to), but recursive expansions are only counted once.
+// "--trace" writes each timing as a "complete" event in Chrome's trace event
+// format, so the whole run can be inspected as a timeline (for example, in
+// chrome://tracing or Perfetto).
+// "--line-profile" counts the statements executed in each source line (in
+// loops, macros and all passes) and their time, and writes these as CSV.
+// Statement times do not include nested blocks: a statement that pushes a
+// frame (macro call, loop, ...) is done before its body is parsed, and blocks
+// parsed recursively (like "!zone {...}") are subtracted.
+#include "profile.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "config.h"
+#include "global.h"
+#include "input.h"
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h>
+#if defined(_POSIX_TIMERS) && (_POSIX_TIMERS > 0) && defined(CLOCK_MONOTONIC)
+#define PROFILE_USE_MONOTONIC
+#endif
+#endif
+
+
+// constants
+#define PROFILE_TABLE_SIZE	16384	// must be a power of two
+#define STACK_INITIAL_SIZE	64
+#define PROFILE_TOP_ENTRIES	20	// per group in summary
+
+
+// sum of timings with same kind, name and line number
+struct profile_entry {
+	struct profile_entry	*next;	// in hash chain
+	enum profile_kind	kind;
+	char			*name;	// NULL for passes
+	int			line_number;
+	long			count;
+	int			active;	// number of timings in progress
+	double			total;	// in microseconds
+};
+// timing in progress
+struct profile_timing {
+	struct profile_entry	*entry;
+	double			start;	// in microseconds
+};
+// statement in progress
+struct statement_timing {
+	const char	*filename;
+	int		line_number;
+	double		start,
+			nested;	// time of statements in nested blocks
+};
+// group of entries in summary
+struct profile_group {
+	const char		*title;
+	enum profile_kind	first,
+				last;
+};
+
+
+// variables
+static struct profile_entry	*profile_table[PROFILE_TABLE_SIZE];
+static int			entry_count	= 0;
+static struct profile_timing	*stack		= NULL;
+static int			stack_count	= 0;
+static int			stack_size	= 0;
+static double			epoch		= -1;	// time of first timing (-1 if not yet)
+static FILE			*trace_fd	= NULL;
+static boolean			trace_failed	= FALSE;	// to complain only once
+static boolean			trace_atexit	= FALSE;	// close function registered?
+static struct statement_timing	*statements	= NULL;
+static int			statements_count	= 0;
+static int			statements_size		= 0;
+static const char	*category[PROFILE_KINDS]	= {
+	"pass",	// PROFILE_PASS
+	"file",	// PROFILE_FILE
+	"macro",	// PROFILE_MACRO
+	"for",	// PROFILE_FOR
+	"do",	// PROFILE_DO
+	"line",	// PROFILE_LINE
+};
+static struct profile_group	groups[]	= {
+	{"Passes",			PROFILE_PASS,	PROFILE_PASS},
+	{"Source files (inclusions)",	PROFILE_FILE,	PROFILE_FILE},
+	{"Macros (expansions)",		PROFILE_MACRO,	PROFILE_MACRO},
+	{"Loops (iterations)",		PROFILE_FOR,	PROFILE_DO},
+};
+
+
+// check whether timing of passes, files, macros and loops is wanted
+static boolean enabled(void)
+{
+	return config.profile_stats || (config.profile_trace != NULL);
+}
+
+
+// read clock, in microseconds
+static double now(void)
+{
+#ifdef PROFILE_USE_MONOTONIC
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+#else
+	return clock() * (1e6 / CLOCKS_PER_SEC);
+#endif
+}
+
+
+// find table entry (create if not found)
+static struct profile_entry *find_entry(enum profile_kind kind, const char *name, int line_number)
+{
+	struct profile_entry	**chain,
+				*entry;
+	unsigned int		hash	= 2166136261u;	// FNV-1a
+	const char		*read;
+
+	if (name) {
+		for (read = name; *read; ++read)
+			hash = (hash ^ (unsigned char) *read) * 16777619u;
+	}
+	hash ^= kind + 31 * (unsigned int) line_number;
+	chain = &profile_table[hash & (PROFILE_TABLE_SIZE - 1)];
+	for (entry = *chain; entry; entry = entry->next) {
+		if ((entry->kind == kind)
+		&& (entry->line_number == line_number)
+		&& ((entry->name == name) || (name && entry->name && (strcmp(entry->name, name) == 0))))
+			return entry;
+	}
+	entry = safe_malloc(sizeof(*entry));
+	entry->next = *chain;
+	entry->kind = kind;
+	entry->name = NULL;
+	if (name) {
+		entry->name = safe_malloc(strlen(name) + 1);
+		strcpy(entry->name, name);
+	}
+	entry->line_number = line_number;
+	entry->count = 0;
+	entry->active = 0;
+	entry->total = 0;
+	*chain = entry;
+	++entry_count;
+	return entry;
+}
+
+
+// print what was timed (escaped for JSON, if wanted)
+static void print_name(FILE *fd, const struct profile_entry *entry, boolean json)
+{
+	const char	*read;
+
+	if (entry->kind == PROFILE_PASS) {
+		fprintf(fd, "pass %d", entry->line_number);
+		return;
+	}
+
+	if (entry->kind == PROFILE_FOR)
+		fputs("!for at ", fd);
+	else if (entry->kind == PROFILE_DO)
+		fputs("!do/!while at ", fd);
+	for (read = entry->name; *read; ++read) {
+		if (json && ((*read == '"') || (*read == '\\')))
+			fputc('\\', fd);
+		if (json && ((unsigned char) *read < ' '))
+			fprintf(fd, "\\u%04x", (unsigned char) *read);
+		else
+			fputc(*read, fd);
+	}
+	if (entry->line_number)
+		fprintf(fd, ", line %d", entry->line_number);
+}
+
+
+// finish trace file
+void profile_close(void)
+{
+	if (trace_fd) {
+		fputs("\n]\n", trace_fd);
+		fclose(trace_fd);
+		trace_fd = NULL;
+	}
+	trace_failed = FALSE;
+	epoch = -1;
+}
+
+
+// write timing to trace file
+static void trace_event(const struct profile_entry *entry, double start, double duration, long count)
+{
+	if (trace_fd == NULL) {
+		if (trace_failed)
+			return;
+
+		trace_fd = fopen(config.profile_trace, "w");
+		if (trace_fd == NULL) {
+			fprintf(stderr, "Error: Cannot open trace file \"%s\".\n", config.profile_trace);
+			trace_failed = TRUE;
+			return;
+		}
+
+		if (!trace_atexit) {
+			atexit(profile_close);
+			trace_atexit = TRUE;
+		}
+		fputs("[\n", trace_fd);
+	} else {
+		fputs(",\n", trace_fd);
+	}
+	fputs("{\"name\":\"", trace_fd);
+	print_name(trace_fd, entry, TRUE);
+	fprintf(trace_fd, "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1,\"args\":{\"count\":%ld}}",
+		category[entry->kind], start - epoch, duration, count);
+}
+
+
+// forget about timings left unfinished by an aborted pass
+void profile_passinit(void)
+{
+	while (stack_count)
+		--stack[--stack_count].entry->active;
+	statements_count = 0;
+}
+
+
+// start timing
+void profile_begin(enum profile_kind kind, const char *name, int line_number)
+{
+	struct profile_timing	*timing;
+
+	if (!enabled())
+		return;
+
+	if (stack_count == stack_size) {
+		stack_size = stack_size ? 2 * stack_size : STACK_INITIAL_SIZE;
+		stack = realloc(stack, stack_size * sizeof(*stack));
+		if (stack == NULL)
+			Throw_serious_error(exception_no_memory_left);
+	}
+	timing = &stack[stack_count++];
+	timing->entry = find_entry(kind, name, line_number);
+	++timing->entry->active;
+	timing->start = now();
+	if (epoch < 0)
+		epoch = timing->start;
+}
+
+
+// stop timing the innermost entry
+void profile_end(long count)
+{
+	struct profile_timing	*timing;
+	double			duration;
+
+	if ((!enabled()) || (stack_count == 0))
+		return;
+
+	timing = &stack[--stack_count];
+	duration = now() - timing->start;
+	timing->entry->count += count;
+	// for recursive expansions, only count outermost one
+	if (--timing->entry->active == 0)
+		timing->entry->total += duration;
+	if (config.profile_trace)
+		trace_event(timing->entry, timing->start, duration, count);
+}
+
+
+// start of statement
+void profile_statement_begin(void)
+{
+	struct statement_timing	*timing;
+
+	if (config.profile_lines == NULL)
+		return;
+
+	if (statements_count == statements_size) {
+		statements_size = statements_size ? 2 * statements_size : STACK_INITIAL_SIZE;
+		statements = realloc(statements, statements_size * sizeof(*statements));
+		if (statements == NULL)
+			Throw_serious_error(exception_no_memory_left);
+	}
+	timing = &statements[statements_count++];
+	// line number is already correct, because start-of-line has been read
+	timing->filename = Input_now->original_filename;
+	timing->line_number = Input_now->line_number;
+	timing->nested = 0;
+	timing->start = now();
+}
+
+
+// end of statement
+void profile_statement_end(boolean empty)
+{
+	struct statement_timing	*timing;
+	struct profile_entry	*entry;
+	double			duration;
+
+	if ((config.profile_lines == NULL) || (statements_count == 0))
+		return;
+
+	timing = &statements[--statements_count];
+	duration = now() - timing->start;
+	if (statements_count)
+		statements[statements_count - 1].nested += duration;
+	if (empty)
+		return;
+
+	entry = find_entry(PROFILE_LINE, timing->filename, timing->line_number);
+	++entry->count;
+	entry->total += duration - timing->nested;
+}
+
+
+// sort order of summary: passes in order, everything else most expensive first
+static int compare_entries(const void *a, const void *b)
+{
+	const struct profile_entry	*ea	= *(const struct profile_entry **) a,
+					*eb	= *(const struct profile_entry **) b;
+
+	if (ea->kind == PROFILE_PASS)
+		return ea->line_number - eb->line_number;
+
+	if (ea->total != eb->total)
+		return (ea->total < eb->total) ? 1 : -1;
+
+	return eb->count < ea->count ? -1 : eb->count > ea->count;
+}
+
+
+// print one group of entries
+static void print_group(FILE *fd, const struct profile_group *group, struct profile_entry **sorted, double passes_total)
+{
+	struct profile_entry	*entry;
+	int			ii,
+				count	= 0;
+
+	for (ii = 0; ii < PROFILE_TABLE_SIZE; ++ii) {
+		for (entry = profile_table[ii]; entry; entry = entry->next) {
+			if ((entry->kind >= group->first) && (entry->kind <= group->last))
+				sorted[count++] = entry;
+		}
+	}
+	if (count == 0)
+		return;
+
+	qsort(sorted, count, sizeof(*sorted), compare_entries);
+	fprintf(fd, "%s:\n", group->title);
+	for (ii = 0; (ii < count) && (ii < PROFILE_TOP_ENTRIES); ++ii) {
+		fprintf(fd, "\t%10.3f ms %5.1f%% %8ld  ", sorted[ii]->total / 1e3,
+			passes_total ? 100 * sorted[ii]->total / passes_total : 0.0,
+			sorted[ii]->count);
+		print_name(fd, sorted[ii], FALSE);
+		fputc('\n', fd);
+	}
+	if (count > PROFILE_TOP_ENTRIES)
+		fprintf(fd, "\t(%d more)\n", count - PROFILE_TOP_ENTRIES);
+}
+
+
+// write line profile as CSV, most expensive lines first
+static void write_lines(FILE *fd, struct profile_entry **sorted)
+{
+	struct profile_entry	*entry;
+	const char		*read;
+	int			ii,
+				count	= 0;
+
+	for (ii = 0; ii < PROFILE_TABLE_SIZE; ++ii) {
+		for (entry = profile_table[ii]; entry; entry = entry->next) {
+			if (entry->kind == PROFILE_LINE)
+				sorted[count++] = entry;
+		}
+	}
+	qsort(sorted, count, sizeof(*sorted), compare_entries);
+	fputs("file,line,count,microseconds\n", fd);
+	for (ii = 0; ii < count; ++ii) {
+		fputc('"', fd);
+		for (read = sorted[ii]->name; *read; ++read) {
+			if (*read == '"')
+				fputc('"', fd);
+			fputc(*read, fd);
+		}
+		fprintf(fd, "\",%d,%ld,%.3f\n", sorted[ii]->line_number, sorted[ii]->count, sorted[ii]->total);
+	}
+}
+
+
+// write summary and line profile, flush trace file and forget all timings
+void profile_report(FILE *fd)
+{
+	struct profile_entry	*entry,
+				*next,
+				**sorted;
+	FILE			*lines_fd;
+	double			passes_total	= 0;
+	int			ii;
+
+	if (!(enabled() || config.profile_lines))
+		return;
+
+	sorted = safe_malloc((entry_count ? entry_count : 1) * sizeof(*sorted));
+
+	if (config.profile_stats && entry_count) {
+		for (ii = 0; ii < PROFILE_TABLE_SIZE; ++ii) {
+			for (entry = profile_table[ii]; entry; entry = entry->next) {
+				if (entry->kind == PROFILE_PASS)
+					passes_total += entry->total;
+			}
+		}
+		fprintf(fd, "Profile: %.3f ms in passes (times include nested work).\n", passes_total / 1e3);
+		for (ii = 0; ii < (int) (sizeof(groups) / sizeof(*groups)); ++ii)
+			print_group(fd, &groups[ii], sorted, passes_total);
+	}
+	if (config.profile_lines) {
+		lines_fd = fopen(config.profile_lines, "w");
+		if (lines_fd) {
+			write_lines(lines_fd, sorted);
+			fclose(lines_fd);
+		} else {
+			fprintf(stderr, "Error: Cannot open line profile file \"%s\".\n", config.profile_lines);
+		}
+	}
+	safe_free(sorted);
+	if (trace_fd)
+		fflush(trace_fd);
+	// forget timings
+	for (ii = 0; ii < PROFILE_TABLE_SIZE; ++ii) {
+		for (entry = profile_table[ii]; entry; entry = next) {
+			next = entry->next;
+			safe_free(entry->name);
+			safe_free(entry);
+		}
+		profile_table[ii] = NULL;
+	}
+	entry_count = 0;
+	stack_count = 0;
+	statements_count = 0;
+}
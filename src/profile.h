@@ -0,0 +1,47 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Profiler ("--stats", "--trace" and "--line-profile")
+#ifndef profile_H
+#define profile_H
+
+
+#include <stdio.h>
+#include "config.h"
+
+
+// what is being timed
+enum profile_kind {
+	PROFILE_PASS,	// line number is pass number
+	PROFILE_FILE,	// name is file name
+	PROFILE_MACRO,	// name is macro name
+	PROFILE_FOR,	// name and line number are position of loop
+	PROFILE_DO,	// (same)
+	PROFILE_LINE,	// name and line number are position of statement
+	PROFILE_KINDS	// end marker
+};
+
+
+// Prototypes
+// (all functions do nothing unless config.profile_stats,
+// config.profile_trace or config.profile_lines is set)
+
+// start of pass: forget about timings left unfinished by an aborted pass
+extern void profile_passinit(void);
+// start timing (calls must be nested properly)
+extern void profile_begin(enum profile_kind kind, const char *name, int line_number);
+// stop timing the innermost entry and add to its count (expansions,
+// iterations, ...)
+extern void profile_end(long count);
+// start of statement
+extern void profile_statement_begin(void);
+// end of statement (if it was empty, it is not counted)
+extern void profile_statement_end(boolean empty);
+// write summary and line profile (if wanted), flush trace file and forget all timings
+extern void profile_report(FILE *fd);
+// close trace file (done before handling options of next server request)
+extern void profile_close(void);
+
+
+#endif
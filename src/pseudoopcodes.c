@@ -17,6 +17,8 @@
 #include "macro.h"
 #include "global.h"
 #include "output.h"
+#include "profile.h"
+#include "replay.h"
 #include "section.h"
 #include "symbol.h"
 #include "tree.h"
@@ -32,6 +34,7 @@ enum eos {
 };
 
 // constants
+#define HEX_BUFFER_SIZE		64	// bytes collected by "!hex" before sending them to output
 static const char	exception_unknown_pseudo_opcode[]	= "Unknown pseudo opcode.";
 
 
@@ -128,26 +131,33 @@ static enum eos po_xor(void)
 // select output file and format ("!to" pseudo opcode)
 static enum eos po_to(void)
 {
+	enum output_format	format;
+	char			*filename;
+	intval_t		start,
+				end;
+
 	// bugfix: first read filename, *then* check for first pass.
 	// if skipping right away, quoted colons might be misinterpreted as EOS
 	// FIXME - fix the skipping code to handle quotes! :)
 	// "!sl" has been fixed as well
 
+	macro_memo_taint();	// expansions with side effects must not be memoized
+
 	// read filename to global dynamic buffer
 	// if no file name given, exit (complaining will have been done)
 	if (Input_read_filename(FALSE, NULL))
 		return SKIP_REMAINDER;
 
-	// only act upon this pseudo opcode in first pass
-	if (!FIRST_PASS)
-		return SKIP_REMAINDER;
-
-	if (outputfile_set_filename())
-		return SKIP_REMAINDER;
-
 	// select output format
 	// if no comma found, use default file format
 	if (Input_accept_comma() == FALSE) {
+		// only act upon this pseudo opcode in first pass
+		if (!FIRST_PASS)
+			return SKIP_REMAINDER;
+
+		if (outputfile_set_filename(GLOBALDYNABUF_CURRENT))
+			return SKIP_REMAINDER;
+
 		if (outputfile_prefer_cbm_format()) {
 			// output deprecation warning (unless user requests really old behaviour)
 			if (config.wanted_version >= VER_DEPRECATE_REALPC)
@@ -156,17 +166,45 @@ static enum eos po_to(void)
 		return ENSURE_EOS;
 	}
 
+	// keep filename, because format keyword will overwrite dynabuf
+	filename = DynaBuf_get_copy(GlobalDynaBuf);
+
 	// parse output format name
 	// if no keyword given, give up
 	if (Input_read_and_lower_keyword() == 0)
-		return SKIP_REMAINDER;
+		goto fail;
 
-	if (outputfile_set_format()) {
+	if (outputfile_lookup_format(&format)) {
 		// error occurred
 		Throw_error("Unknown output format.");
-		return SKIP_REMAINDER;
+		goto fail;
+	}
+
+	// "!to FILENAME, FORMAT, START, END" adds another output file holding
+	// the given address range. this is handled in every pass, so start and
+	// end may be symbols defined later on.
+	if (Input_accept_comma()) {
+		ALU_any_int(&start);
+		if (!Input_accept_comma()) {
+			Throw_error(exception_syntax);
+			goto fail;
+		}
+		ALU_any_int(&end);
+		outputfile_add_range(filename, format, start, end);
+		safe_free(filename);
+		return ENSURE_EOS;
 	}
+
+	// only act upon "!to FILENAME, FORMAT" in first pass
+	// (keyword is still in dynabuf, so format can be set from there)
+	if (FIRST_PASS && (outputfile_set_filename(filename) == 0))
+		outputfile_set_format();
+	safe_free(filename);
 	return ENSURE_EOS;	// success
+
+fail:
+	safe_free(filename);
+	return SKIP_REMAINDER;
 }
 
 
@@ -187,73 +225,56 @@ static enum eos iterate(void (*fn)(intval_t))
 }
 
 
+// pseudo opcodes that do nothing but output data ("!8", "!16", ...). they
+// are kept in a tree of their own, so loops consisting of these can be run
+// without the statement parser (see flow.c).
+struct data_pseudoopcode {
+	void	(*little_endian)(intval_t);	// output function for little-endian cpus
+	void	(*big_endian)(intval_t);	// output function for big-endian cpus
+};
 // insert 8-bit values ("!8" / "!08" / "!by" / "!byte" pseudo opcode)
-static enum eos po_byte(void)
-{
-	return iterate(output_8);
-}
-
-
+static struct data_pseudoopcode	po_byte	= {output_8, output_8};
 // Insert 16-bit values ("!16" / "!wo" / "!word" pseudo opcode)
-static enum eos po_16(void)
-{
-	return iterate((CPU_state.type->flags & CPUFLAG_ISBIGENDIAN) ? output_be16 : output_le16);
-}
+static struct data_pseudoopcode	po_16	= {output_le16, output_be16};
 // Insert 16-bit values big-endian ("!be16" pseudo opcode)
-static enum eos po_be16(void)
-{
-	return iterate(output_be16);
-}
+static struct data_pseudoopcode	po_be16	= {output_be16, output_be16};
 // Insert 16-bit values little-endian ("!le16" pseudo opcode)
-static enum eos po_le16(void)
-{
-	return iterate(output_le16);
-}
-
-
+static struct data_pseudoopcode	po_le16	= {output_le16, output_le16};
 // Insert 24-bit values ("!24" pseudo opcode)
-static enum eos po_24(void)
-{
-	return iterate((CPU_state.type->flags & CPUFLAG_ISBIGENDIAN) ? output_be24 : output_le24);
-}
+static struct data_pseudoopcode	po_24	= {output_le24, output_be24};
 // Insert 24-bit values big-endian ("!be24" pseudo opcode)
-static enum eos po_be24(void)
-{
-	return iterate(output_be24);
-}
+static struct data_pseudoopcode	po_be24	= {output_be24, output_be24};
 // Insert 24-bit values little-endian ("!le24" pseudo opcode)
-static enum eos po_le24(void)
-{
-	return iterate(output_le24);
-}
-
-
+static struct data_pseudoopcode	po_le24	= {output_le24, output_le24};
 // Insert 32-bit values ("!32" pseudo opcode)
-static enum eos po_32(void)
-{
-	return iterate((CPU_state.type->flags & CPUFLAG_ISBIGENDIAN) ? output_be32 : output_le32);
-}
+static struct data_pseudoopcode	po_32	= {output_le32, output_be32};
 // Insert 32-bit values big-endian ("!be32" pseudo opcode)
-static enum eos po_be32(void)
-{
-	return iterate(output_be32);
-}
+static struct data_pseudoopcode	po_be32	= {output_be32, output_be32};
 // Insert 32-bit values little-endian ("!le32" pseudo opcode)
-static enum eos po_le32(void)
+static struct data_pseudoopcode	po_le32	= {output_le32, output_le32};
+
+// get output function of data pseudo opcode for current cpu
+static void (*data_output_fn(const struct data_pseudoopcode *po))(intval_t)
 {
-	return iterate(output_le32);
+	return (CPU_state.type->flags & CPUFLAG_ISBIGENDIAN) ? po->big_endian : po->little_endian;
 }
 
 
 // Insert bytes given as pairs of hex digits (helper for source code generators)
 static enum eos po_hex(void)	// now GotByte = illegal char
 {
+	char		buffer[HEX_BUFFER_SIZE];
+	size_t		used	= 0;
 	int		digits	= 0;
 	unsigned char	byte	= 0;
 
 	for (;;) {
 		if (digits == 2) {
-			Output_byte(byte);
+			if (used == HEX_BUFFER_SIZE) {
+				output_sequence(buffer, used);
+				used = 0;
+			}
+			buffer[used++] = byte;
 			digits = 0;
 			byte = 0;
 		}
@@ -278,6 +299,7 @@ static enum eos po_hex(void)	// now GotByte = illegal char
 		// if we're here, the current character is not a hex digit,
 		// which is only allowed outside of pairs:
 		if (digits == 1) {
+			output_sequence(buffer, used);
 			Throw_error("Hex digits are not given in pairs.");
 			return SKIP_REMAINDER;	// error exit
 		}
@@ -287,8 +309,10 @@ static enum eos po_hex(void)	// now GotByte = illegal char
 			GetByte();	// spaces and tabs are ignored (maybe add commas, too?)
 			continue;
 		case CHAR_EOS:
+			output_sequence(buffer, used);
 			return AT_EOS_ANYWAY;	// normal exit
 		default:
+			output_sequence(buffer, used);
 			Throw_error(exception_syntax);	// all other characters are errors
 			return SKIP_REMAINDER;	// error exit
 		}
@@ -309,16 +333,14 @@ static enum eos po_cbm(void)
 }
 
 // read encoding table from file
-static enum eos user_defined_encoding(FILE *stream)
+static enum eos user_defined_encoding(const struct filecontents *file)
 {
 	unsigned char		local_table[256],
 				*buffered_table		= encoding_loaded_table;
 	const struct encoder	*buffered_encoder	= encoder_current;
 
-	if (stream) {
-		encoding_load_from_file(local_table, stream);
-		fclose(stream);
-	}
+	if (file)
+		encoding_load_from_file(local_table, file);
 	encoder_current = &encoder_file;	// activate new encoding
 	encoding_loaded_table = local_table;		// activate local table
 	// if there's a block, parse that and then restore old values
@@ -359,15 +381,15 @@ static enum eos predefined_encoding(void)
 static enum eos po_convtab(void)
 {
 	boolean	uses_lib;
-	FILE	*stream;
 
 	if ((GotByte == '<') || (GotByte == '"')) {
 		// encoding table from file
+		macro_memo_taint();	// file contents are not part of memo key
+		replay_taint();	// table contents are not recorded
 		if (Input_read_filename(TRUE, &uses_lib))
 			return SKIP_REMAINDER;	// missing or unterminated file name
 
-		stream = includepaths_open_ro(uses_lib);
-		return user_defined_encoding(stream);
+		return user_defined_encoding(includepaths_load(uses_lib));
 	} else {
 		// one of the pre-defined encodings
 		return predefined_encoding();
@@ -402,9 +424,10 @@ static enum eos encode_string(const struct encoder *inner_encoder, unsigned char
 			if (Input_unescape_dynabuf(0))
 				return SKIP_REMAINDER;	// escaping error
 
-			// send characters
+			// convert characters, then send them
 			for (offset = 0; offset < GlobalDynaBuf->size; ++offset)
-				output_8(xor ^ encoding_encode_char(GLOBALDYNABUF_CURRENT[offset]));
+				GlobalDynaBuf->buffer[offset] = (char) (xor ^ encoding_encode_char(GLOBALDYNABUF_CURRENT[offset]));
+			output_sequence(GLOBALDYNABUF_CURRENT, GlobalDynaBuf->size);
 		} else {
 			// handle everything else (also strings in newer dialects):
 			// parse value. no problems with single characters because the
@@ -453,12 +476,14 @@ static enum eos po_scrxor(void)
 // FIXME - split this into "parser" and "worker" fn and move worker fn somewhere else.
 static enum eos po_binary(void)
 {
-	boolean		uses_lib;
-	FILE		*stream;
-	int		byte;
-	struct number	size,
-			skip;
+	boolean				uses_lib;
+	const struct filecontents	*file;
+	long				offset,
+					amount;
+	struct number			size,
+					skip;
 
+	macro_memo_taint();	// file contents are not part of memo key
 	size.val.intval = -1;	// means "not given" => "until EOF"
 	skip.val.intval	= 0;
 
@@ -466,9 +491,9 @@ static enum eos po_binary(void)
 	if (Input_read_filename(TRUE, &uses_lib))
 		return SKIP_REMAINDER;
 
-	// try to open file
-	stream = includepaths_open_ro(uses_lib);
-	if (stream == NULL)
+	// try to read file (or get it from cache)
+	file = includepaths_load(uses_lib);
+	if (file == NULL)
 		return SKIP_REMAINDER;
 
 	// read optional arguments
@@ -492,30 +517,24 @@ static enum eos po_binary(void)
 	// check whether including is a waste of time
 	// FIXME - future changes ("several-projects-at-once")
 	// may be incompatible with this!
-	if ((size.val.intval >= 0) && (pass.undefined_count || pass.error_count)) {
-	//if ((size.val.intval >= 0) && (pass.needvalue_count || pass.error_count)) {	FIXME - use!
+	if ((size.val.intval >= 0) && (pass.needvalue_count || pass.error_count)) {
 		output_skip(size.val.intval);	// really including is useless anyway
 	} else {
 		// really insert file
-		fseek(stream, skip.val.intval, SEEK_SET);	// set read pointer
-		// if "size" non-negative, read "size" bytes.
-		// otherwise, read until EOF.
-		while (size.val.intval != 0) {
-			byte = getc(stream);
-			if (byte == EOF)
-				break;
-			Output_byte(byte);
-			--size.val.intval;
-		}
+		// (negative skip values are ignored, just like fseek() did)
+		offset = (skip.val.intval > 0) ? skip.val.intval : 0;
+		amount = (offset < file->size) ? file->size - offset : 0;
+		// if "size" non-negative, insert "size" bytes.
+		// otherwise, insert until EOF.
+		if ((size.val.intval >= 0) && (size.val.intval < amount))
+			amount = size.val.intval;
+		output_sequence(file->data + offset, amount);
 		// if more should have been read, warn and add padding
-		if (size.val.intval > 0) {
+		if (size.val.intval > amount) {
 			Throw_warning("Padding with zeroes.");
-			do
-				Output_byte(0);
-			while (--size.val.intval);
+			output_fill(0, size.val.intval - amount);
 		}
 	}
-	fclose(stream);
 	// if verbose, produce some output
 	if (FIRST_PASS && (config.process_verbosity > 1)) {
 		int	amount	= vcpu_get_statement_size();
@@ -536,8 +555,13 @@ static enum eos po_fill(void)
 	ALU_defined_int(&sizeresult);	// FIXME - forbid addresses!
 	if (Input_accept_comma())
 		ALU_any_int(&fill);	// FIXME - forbid addresses!
-	while (sizeresult.val.intval--)
-		output_8(fill);
+	if ((sizeresult.val.intval > 0) && (fill >= -0x80) && (fill <= 0xff)) {
+		output_fill((char) fill, sizeresult.val.intval);
+	} else {
+		// let output_8() complain about each byte
+		while (sizeresult.val.intval--)
+			output_8(fill);
+	}
 	return ENSURE_EOS;
 }
 
@@ -771,6 +795,7 @@ static enum eos po_symbollist(void)
 	// FIXME - why not just fix the skipping code to handle quotes? :)
 	// "!to" has been fixed as well
 
+	macro_memo_taint();	// expansions with side effects must not be memoized
 	// read filename to global dynamic buffer
 	// if no file name given, exit (complaining will have been done)
 	if (Input_read_filename(FALSE, NULL))
@@ -843,12 +868,10 @@ static enum eos po_subzone(void)
 // include source file ("!source" or "!src"). has to be re-entrant.
 static enum eos po_source(void)	// now GotByte = illegal char
 {
-	boolean		uses_lib;
-	FILE		*stream;
-	char		local_gotbyte;
-	struct input	new_input,
-			*outer_input;
+	boolean				uses_lib;
+	const struct filecontents	*file;
 
+	macro_memo_taint();	// file contents are not part of memo key
 	// enter new nesting level
 	// quit program if recursion too deep
 	if (--source_recursions_left < 0)
@@ -858,25 +881,23 @@ static enum eos po_source(void)	// now GotByte = illegal char
 		return SKIP_REMAINDER;
 
 	// if file could be opened, parse it. otherwise, complain
-	stream = includepaths_open_ro(uses_lib);
-	if (stream) {
-// FIXME - just use safe_malloc and never free! this also saves us making a copy if defining macros down the road...
-#ifdef __GNUC__
-		char	filename[GlobalDynaBuf->size];	// GCC can do this
-#else
-		char	*filename	= safe_malloc(GlobalDynaBuf->size);	// VS can not
-#endif
-
-		strcpy(filename, GLOBALDYNABUF_CURRENT);
-		outer_input = Input_now;	// remember old input
-		local_gotbyte = GotByte;	// CAUTION - ugly kluge
-		Input_now = &new_input;	// activate new input
-		flow_parse_and_close_file(stream, filename);
-		Input_now = outer_input;	// restore previous input
-		GotByte = local_gotbyte;	// CAUTION - ugly kluge
-#ifndef __GNUC__
-		free(filename);	// GCC auto-frees
-#endif
+	file = includepaths_load(uses_lib);
+	if (file)
+		profile_begin(PROFILE_FILE, file->path, 0);	// ended by source_end() or below
+	if (file && replay_try(file)) {
+		// same state as in an earlier pass, so results are known
+		if (config.process_verbosity > 2)
+			printf("Replaying source file '%s'\n", GLOBALDYNABUF_CURRENT);
+		profile_end(1);
+		++source_recursions_left;	// leave nesting level
+		return ENSURE_EOS;
+	}
+	if (file) {
+		// the parser loop goes on with the file. at its end, the nesting
+		// level is left, the timing is ended and the remainder of this
+		// statement is checked.
+		flow_include_file(file, GLOBALDYNABUF_CURRENT);
+		return AT_EOS_ANYWAY;
 	}
 	// leave nesting level
 	++source_recursions_left;
@@ -890,14 +911,49 @@ enum ifmode {
 	IFMODE_IFNDEF,	// check symbol, then parse block or line
 	IFMODE_ELSE	// unconditional last block
 };
+// "!if" block context
+struct if_frame {
+	struct flow_frame	frame;
+	enum ifmode		mode;
+};
+static enum eos ifelse(enum ifmode mode, boolean block_done);
+// handle remainder of line according to given eos value
+static void handle_eos(enum eos then)
+{
+	if (then == SKIP_REMAINDER)
+		Input_skip_remainder();
+	else if (then == ENSURE_EOS)
+		Input_ensure_EOS();
+	// the other two possibilities (PARSE_REMAINDER and AT_EOS_ANYWAY)
+	// will lead to the remainder of the line being parsed by the mainloop.
+}
+// end of executed "!if" block: skip the rest of the if/else chain
+static boolean if_end(struct flow_frame *context)
+{
+	struct if_frame	*frame	= (struct if_frame *) context;
+
+	// if block isn't correctly terminated, complain and exit
+	if (GotByte != CHAR_EOB)
+		Throw_serious_error(exception_no_right_brace);
+	handle_eos(ifelse(frame->mode, TRUE));
+	return FALSE;
+}
 // has to be re-entrant
-static enum eos ifelse(enum ifmode mode)
+// if block_done is TRUE, this is called after the block of the given mode has
+// been parsed (with GotByte = '}'), so all further blocks get skipped.
+static enum eos ifelse(enum ifmode mode, boolean block_done)
 {
-	boolean		nothing_done	= TRUE;	// once a block gets executed, this becomes FALSE, so all others will be skipped even if condition met
+	boolean		nothing_done	= !block_done;	// once a block gets executed, this becomes FALSE, so all others will be skipped even if condition met
 	boolean		condition_met;	// condition result for next block
 	struct number	ifresult;
+	struct if_frame	*frame;
 
 	for (;;) {
+		if (block_done) {
+			block_done = FALSE;
+			goto after_block;
+		}
+
 		// check condition according to mode
 		switch (mode) {
 		case IFMODE_IF:
@@ -924,10 +980,11 @@ static enum eos ifelse(enum ifmode mode)
 		if (condition_met && nothing_done) {
 			nothing_done = FALSE;	// all further ones will be skipped, even if conditions meet
 			if (GotByte == CHAR_SOB) {
-		                Parse_until_eob_or_eof();	// parse block
-        		        // if block isn't correctly terminated, complain and exit
-                		if (GotByte != CHAR_EOB)
-                		        Throw_serious_error(exception_no_right_brace);
+				// let parser loop parse block, then go on in if_end()
+				frame = safe_malloc(sizeof(*frame));
+				frame->mode = mode;
+				flow_push_frame(&frame->frame, if_end, NULL);
+				return AT_EOS_ANYWAY;
 			} else {
 				return PARSE_REMAINDER;	// parse line (only for ifdef/ifndef)
 			}
@@ -938,6 +995,7 @@ static enum eos ifelse(enum ifmode mode)
 				return SKIP_REMAINDER;	// skip line (only for ifdef/ifndef)
 			}
 		}
+after_block:
 		// now GotByte = '}'
 		NEXTANDSKIPSPACE();
 		// after ELSE {} it's all over. it must be.
@@ -990,21 +1048,21 @@ static enum eos ifelse(enum ifmode mode)
 // conditional assembly ("!if"). has to be re-entrant.
 static enum eos po_if(void)	// now GotByte = illegal char
 {
-	return ifelse(IFMODE_IF);
+	return ifelse(IFMODE_IF, FALSE);
 }
 
 
 // conditional assembly ("!ifdef"). has to be re-entrant.
 static enum eos po_ifdef(void)	// now GotByte = illegal char
 {
-	return ifelse(IFMODE_IFDEF);
+	return ifelse(IFMODE_IFDEF, FALSE);
 }
 
 
 // conditional assembly ("!ifndef"). has to be re-entrant.
 static enum eos po_ifndef(void)	// now GotByte = illegal char
 {
-	return ifelse(IFMODE_IFNDEF);
+	return ifelse(IFMODE_IFNDEF, FALSE);
 }
 
 
@@ -1105,13 +1163,10 @@ does not fail. */
 	// read loop body into DynaBuf and get copy
 	loop.block.body = Input_skip_or_store_block(TRUE);	// changes line number!
 
+	// the parser loop parses the body, afterwards the remainder of this
+	// statement is checked (and loop body gets freed)
 	flow_forloop(&loop);
-	// free memory
-	free(loop.block.body);
-
-	// GotByte of OuterInput would be '}' (if it would still exist)
-	GetByte();	// fetch next byte
-	return ENSURE_EOS;
+	return AT_EOS_ANYWAY;
 }
 
 
@@ -1135,11 +1190,7 @@ static enum eos po_do(void)	// now GotByte = illegal char
 	// read tail condition to buffer
 	flow_store_doloop_condition(&loop.tail_cond, CHAR_EOS);	// must be freed!
 	// now GotByte = CHAR_EOS
-	flow_do_while(&loop);
-	// free memory
-	free(loop.head_cond.body);
-	free(loop.block.body);
-	free(loop.tail_cond.body);
+	flow_do_while(&loop);	// frees conditions and body when done
 	return AT_EOS_ANYWAY;
 }
 
@@ -1161,19 +1212,17 @@ static enum eos po_while(void)	// now GotByte = illegal char
 	loop.block.body = Input_skip_or_store_block(TRUE);	// must be freed!
 	// clear tail condition
 	loop.tail_cond.body = NULL;
+	// now GotByte = '}', the remainder of this statement is checked when
+	// loop is done (and conditions and body get freed)
 	flow_do_while(&loop);
-	// free memory
-	free(loop.head_cond.body);
-	free(loop.block.body);
-	// GotByte of OuterInput would be '}' (if it would still exist)
-	GetByte();	// fetch next byte
-	return ENSURE_EOS;
+	return AT_EOS_ANYWAY;
 }
 
 
 // macro definition ("!macro").
 static enum eos po_macro(void)	// now GotByte = illegal char
 {
+	macro_memo_taint();	// defining macros is a side effect
 	// in first pass, parse. In all other passes, skip.
 	if (FIRST_PASS) {
 		Macro_parse_definition();	// now GotByte = '}'
@@ -1277,6 +1326,9 @@ static enum eos throw_string(const char prefix[], void (*fn)(const char *))
 		} else {
 			// parse value
 			ALU_any_result(&object);
+			// do not stop before the message can show the real value
+			if (!object.type->is_defined(&object))
+				++pass.needvalue_count;
 			object.type->print(&object, user_message);
 		}
 	} while (Input_accept_comma());
@@ -1326,33 +1378,40 @@ static enum eos po_serious(void)
 // end of source file ("!endoffile" or "!eof")
 static enum eos po_endoffile(void)
 {
+	macro_memo_taint();	// ending the file is a side effect
 	// well, it doesn't end right here and now, but at end-of-line! :-)
 	Input_ensure_EOS();
 	Input_now->state = INPUTSTATE_EOF;
 	return AT_EOS_ANYWAY;
 }
 
+// data pseudo opcode table (bodies point to struct data_pseudoopcode)
+static struct ronode	data_pseudo_opcode_tree[]	= {
+	PREDEF_START,
+	PREDEFNODE("by",		&po_byte),
+	PREDEFNODE("byte",		&po_byte),
+	PREDEFNODE("8",			&po_byte),
+	PREDEFNODE("08",		&po_byte),	// legacy alias, don't ask...
+	PREDEFNODE("wo",		&po_16),
+	PREDEFNODE("word",		&po_16),
+	PREDEFNODE("16",		&po_16),
+	PREDEFNODE("be16",		&po_be16),
+	PREDEFNODE("le16",		&po_le16),
+	PREDEFNODE("24",		&po_24),
+	PREDEFNODE("be24",		&po_be24),
+	PREDEFNODE("le24",		&po_le24),
+	PREDEFNODE("32",		&po_32),
+	PREDEFNODE("be32",		&po_be32),
+	PREDEF_END("le32",		&po_le32),
+	//    ^^^^ this marks the last element
+};
+
 // pseudo opcode table
 static struct ronode	pseudo_opcode_tree[]	= {
 	PREDEF_START,
 	PREDEFNODE("initmem",		po_initmem),
 	PREDEFNODE("xor",		po_xor),
 	PREDEFNODE("to",		po_to),
-	PREDEFNODE("by",		po_byte),
-	PREDEFNODE("byte",		po_byte),
-	PREDEFNODE("8",			po_byte),
-	PREDEFNODE("08",		po_byte),	// legacy alias, don't ask...
-	PREDEFNODE("wo",		po_16),
-	PREDEFNODE("word",		po_16),
-	PREDEFNODE("16",		po_16),
-	PREDEFNODE("be16",		po_be16),
-	PREDEFNODE("le16",		po_le16),
-	PREDEFNODE("24",		po_24),
-	PREDEFNODE("be24",		po_be24),
-	PREDEFNODE("le24",		po_le24),
-	PREDEFNODE("32",		po_32),
-	PREDEFNODE("be32",		po_be32),
-	PREDEFNODE("le32",		po_le32),
 	PREDEFNODE("h",			po_hex),
 	PREDEFNODE("hex",		po_hex),
 	PREDEFNODE("cbm",		po_cbm),	// obsolete
@@ -1412,9 +1471,10 @@ static struct ronode	pseudo_opcode_tree[]	= {
 // parse a pseudo opcode. has to be re-entrant.
 void pseudoopcode_parse(void)	// now GotByte = "!"
 {
-	void		*node_body;
-	enum eos	(*fn)(void),
-			then	= SKIP_REMAINDER;	// prepare for errors
+	void				*node_body;
+	enum eos			(*fn)(void),
+					then	= SKIP_REMAINDER;	// prepare for errors
+	const struct data_pseudoopcode	*data_po;
 
 	GetByte();	// read next byte
 	// on missing keyword, return (complaining will have been done)
@@ -1426,14 +1486,42 @@ void pseudoopcode_parse(void)	// now GotByte = "!"
 			SKIPSPACE();
 			// call function
 			then = fn();
+		} else if ((data_po = pseudoopcode_find_data())) {
+			SKIPSPACE();
+			then = iterate(data_output_fn(data_po));
 		} else {
 			Throw_error(exception_unknown_pseudo_opcode);
 		}
 	}
-	if (then == SKIP_REMAINDER)
-		Input_skip_remainder();
-	else if (then == ENSURE_EOS)
-		Input_ensure_EOS();
-	// the other two possibilities (PARSE_REMAINDER and AT_EOS_ANYWAY)
-	// will lead to the remainder of the line being parsed by the mainloop.
+	handle_eos(then);
+}
+
+
+// if GlobalDynaBuf holds the name of a pseudo opcode that does nothing but
+// output data, return it. otherwise return NULL.
+const struct data_pseudoopcode *pseudoopcode_find_data(void)
+{
+	void	*node_body;
+
+	if (Tree_easy_scan(data_pseudo_opcode_tree, &node_body, GlobalDynaBuf))
+		return node_body;
+
+	return NULL;
+}
+
+// call pseudo opcode found by pseudoopcode_find_data()
+void pseudoopcode_call(const struct data_pseudoopcode *po)	// now GotByte = first byte of arguments
+{
+	handle_eos(iterate(data_output_fn(po)));
+}
+
+// output value like pseudo opcode found by pseudoopcode_find_data() would
+void pseudoopcode_output(const struct data_pseudoopcode *po, struct object *value)
+{
+	struct iter_context	iter;
+
+	iter.fn = data_output_fn(po);
+	iter.accept_long_strings = FALSE;
+	iter.stringxor = 0;
+	output_object(value, &iter);
 }
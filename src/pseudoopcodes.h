@@ -7,10 +7,23 @@
 #define pseudoopcodes_H
 
 
+struct object;
+struct data_pseudoopcode;	// pseudo opcode that does nothing but output data
+
+
 // call when "*= EXPRESSION" is parsed
 extern void notreallypo_setpc(void);
 // parse pseudo opcode. has to be re-entrant.
 extern void pseudoopcode_parse(void);
+// if GlobalDynaBuf holds the name of a pseudo opcode that does nothing but
+// output data (like "!byte" or "!word"), return it. otherwise return NULL.
+extern const struct data_pseudoopcode *pseudoopcode_find_data(void);
+// call pseudo opcode found by pseudoopcode_find_data().
+// call with GotByte = first byte of arguments.
+extern void pseudoopcode_call(const struct data_pseudoopcode *po);
+// output value like pseudo opcode found by pseudoopcode_find_data() would
+// (for values computed in advance, see flow.c)
+extern void pseudoopcode_output(const struct data_pseudoopcode *po, struct object *value);
 
 
 #endif
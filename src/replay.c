@@ -0,0 +1,353 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Replay of included source files ("!source") in later passes
+//
+// In later passes, most included files start at the same PC and see the same
+// symbol values as in the pass before, so they produce the same bytes and
+// symbol values again. Therefore each inclusion is recorded: the entry state
+// (PC, CPU, encoding, zone and scope counters), the value of every symbol the
+// file touched when it was first accessed, and the results (bytes, final
+// symbol values, CPU/encoding/zone at end of file).
+// If a later inclusion of the same file finds the same entry state and the
+// same symbol values, the results are applied without parsing the file.
+// Every change to a symbol is preceded by a lookup, so the values seen at
+// first access are the values at start of the file. Inclusions that change
+// state which is not recorded (segments, pseudopc, memory init, ...) or that
+// produce messages or undefined results are not recorded.
+#include "replay.h"
+#include <stdlib.h>
+#include <string.h>
+#include "alu.h"
+#include "config.h"
+#include "encoding.h"
+#include "global.h"
+#include "output.h"
+#include "section.h"
+#include "symbol.h"
+
+
+// constants
+#define REPLAY_TABLE_SIZE	1024	// must be a power of two
+#define TOUCHED_INITIAL_SIZE	256
+
+
+// symbol touched by an inclusion
+struct replay_symbol {
+	struct symbol	*symbol;
+	struct object	entry,	// value at first access
+			exit;	// value at end of file
+	boolean		entry_fresh,	// whether symbol's pass field was
+			exit_fresh;	// the current pass (see anon counters)
+};
+// recorded inclusion
+struct replay {
+	struct replay_state	entry;	// entry.file is NULL if slot is unused
+	struct replay_symbol	*symbols;
+	int			symbol_count;
+	char			*bytes;	// produced bytes (with xor undone)
+	intval_t		size;
+	// state at end of file
+	const struct cpu_type	*cpu_type;
+	boolean			a_is_long,
+				xy_are_long;
+	const struct encoder	*encoder;
+	scope_t			local_scope,
+				cheap_scope,
+				local_delta,	// scope numbers used up by file
+				cheap_delta;
+	const char		*section_type;
+	char			*section_title;	// copy if zone was changed by file, otherwise NULL
+};
+
+
+// variables
+static struct replay		replay_table[REPLAY_TABLE_SIZE];	// direct-mapped
+static struct replay_frame	*replay_innermost	= NULL;	// NULL if no inclusion is recorded
+// symbols touched by inclusions in progress (outer ones include the ranges of inner ones)
+static struct replay_symbol	*touched	= NULL;
+static int			touched_count	= 0;
+static int			touched_size	= 0;
+
+
+// get current state
+static void get_state(struct replay_state *state, const struct filecontents *file)
+{
+	memset(state, 0, sizeof(*state));	// so states can be compared using memcmp()
+	state->file = file;
+	state->pc_ntype = CPU_state.pc.ntype;
+	state->pc_flags = CPU_state.pc.flags;
+	state->pc = CPU_state.pc.val.intval;
+	state->pc_addr_refs = CPU_state.pc.addr_refs;
+	state->write_idx = output_get_write_idx();
+	state->cpu_type = CPU_state.type;
+	state->a_is_long = CPU_state.a_is_long;
+	state->xy_are_long = CPU_state.xy_are_long;
+	state->encoder = encoder_current;
+	state->xor = output_get_xor();
+	state->local_scope = section_now->local_scope;
+	state->cheap_scope = section_now->cheap_scope;
+	section_get_scope_maxima(&state->local_max, &state->cheap_max);
+}
+
+
+// check whether current state can be recorded at all
+static boolean state_is_recordable(void)
+{
+	// reports need the file's lines, pseudopc contexts are re-created in
+	// each pass, and user-defined tables are not recorded
+	return (report->text == NULL)
+		&& (pseudopc_get_context() == NULL)
+		&& (CPU_state.pc.ntype == NUMTYPE_INT)
+		&& (CPU_state.add_to_pc == 0)
+		&& (encoder_current != &encoder_file);
+}
+
+
+// return table slot for given state
+static struct replay *replay_slot(const struct replay_state *state)
+{
+	size_t	hash;
+
+	hash = ((size_t) state->file >> 4) ^ ((size_t) state->pc * 31) ^ ((size_t) state->local_max * 7);
+	return &replay_table[hash & (REPLAY_TABLE_SIZE - 1)];
+}
+
+
+// check whether two objects are the same (lists must be the very same)
+static boolean same_object(const struct object *a, const struct object *b)
+{
+	if (a->type != b->type)
+		return FALSE;
+
+	if (a->type == NULL)
+		return TRUE;	// both not yet assigned
+
+	if (a->type == &type_string)
+		return (a->u.string->length == b->u.string->length)
+			&& (memcmp(a->u.string->payload, b->u.string->payload, a->u.string->length) == 0);
+
+	if (a->type == &type_list)
+		return a->u.listhead == b->u.listhead;
+
+	if ((a->u.number.ntype != b->u.number.ntype)
+	|| (a->u.number.flags != b->u.number.flags)
+	|| (a->u.number.addr_refs != b->u.number.addr_refs))
+		return FALSE;
+
+	if (a->u.number.ntype == NUMTYPE_INT)
+		return a->u.number.val.intval == b->u.number.val.intval;
+	if (a->u.number.ntype == NUMTYPE_FLOAT)
+		return a->u.number.val.fpval == b->u.number.val.fpval;
+	return TRUE;
+}
+
+
+// free contents of table slot
+static void free_slot(struct replay *replay)
+{
+	safe_free(replay->symbols);
+	safe_free(replay->bytes);
+	safe_free(replay->section_title);
+	memset(replay, 0, sizeof(*replay));
+}
+
+
+// forget recorded inclusions
+void replay_clear(void)
+{
+	int	ii;
+
+	for (ii = 0; ii < REPLAY_TABLE_SIZE; ++ii)
+		free_slot(&replay_table[ii]);
+	replay_passinit();
+}
+
+
+// forget about inclusions in progress
+void replay_passinit(void)
+{
+	replay_innermost = NULL;
+	touched_count = 0;
+}
+
+
+// mark all inclusions in progress as not replayable
+void replay_taint(void)
+{
+	struct replay_frame	*frame;
+
+	for (frame = replay_innermost; frame; frame = frame->outer)
+		frame->recording = FALSE;
+}
+
+
+// add symbol to list of touched symbols (if not yet there)
+void replay_note_symbol(struct symbol *symbol)
+{
+	struct replay_symbol	*entry;
+	int			index	= symbol->replay_entry;
+
+	if (replay_innermost == NULL)
+		return;
+
+	// already in innermost inclusion's range (and therefore in all others)?
+	if ((index >= replay_innermost->first_symbol)
+	&& (index < touched_count)
+	&& (touched[index].symbol == symbol))
+		return;
+
+	// make room
+	if (touched_count == touched_size) {
+		touched_size = touched_size ? 2 * touched_size : TOUCHED_INITIAL_SIZE;
+		touched = realloc(touched, touched_size * sizeof(*touched));
+		if (touched == NULL)
+			Throw_serious_error(exception_no_memory_left);
+	}
+	entry = &touched[touched_count];
+	entry->symbol = symbol;
+	entry->entry = symbol->object;
+	entry->entry_fresh = (symbol->pass == pass.number);
+	symbol->replay_entry = touched_count++;
+}
+
+
+// replay recorded inclusion if entry state and symbol values match
+boolean replay_try(const struct filecontents *file)
+{
+	struct replay_state	state;
+	struct replay		*replay;
+	struct replay_symbol	*entry;
+	int			ii;
+
+	if (!state_is_recordable())
+		return FALSE;
+
+	get_state(&state, file);
+	replay = replay_slot(&state);
+	if ((replay->entry.file == NULL)
+	|| memcmp(&replay->entry, &state, sizeof(state)))
+		return FALSE;
+
+	for (ii = 0; ii < replay->symbol_count; ++ii) {
+		entry = &replay->symbols[ii];
+		if ((!same_object(&entry->symbol->object, &entry->entry))
+		|| (entry->entry_fresh != (entry->symbol->pass == pass.number)))
+			return FALSE;
+	}
+
+	// match, so apply results (and let outer inclusions know about them)
+	for (ii = 0; ii < replay->symbol_count; ++ii) {
+		entry = &replay->symbols[ii];
+		replay_note_symbol(entry->symbol);
+		entry->symbol->object = entry->exit;
+		if (entry->exit_fresh)
+			entry->symbol->pass = pass.number;
+	}
+	output_sequence(replay->bytes, replay->size);
+	CPU_state.type = replay->cpu_type;
+	CPU_state.a_is_long = replay->a_is_long;
+	CPU_state.xy_are_long = replay->xy_are_long;
+	encoder_current = replay->encoder;
+	if (replay->section_title) {
+		// file changed zone
+		section_finalize(section_now);
+		section_now->type = replay->section_type;
+		section_now->title = safe_malloc(strlen(replay->section_title) + 1);
+		strcpy(section_now->title, replay->section_title);
+		section_now->allocated = TRUE;
+	}
+	section_now->local_scope = replay->local_scope;
+	section_now->cheap_scope = replay->cheap_scope;
+	section_skip_scopes(replay->local_delta, replay->cheap_delta);
+	return TRUE;
+}
+
+
+// start recording inclusion
+void replay_start(struct replay_frame *frame, const struct filecontents *file)
+{
+	frame->outer = replay_innermost;
+	frame->recording = state_is_recordable();
+	get_state(&frame->entry, file);
+	frame->first_symbol = touched_count;
+	frame->undefined_count = pass.undefined_count;
+	frame->needvalue_count = pass.needvalue_count;
+	frame->throw_count = Throw_get_counter();
+	replay_innermost = frame;
+}
+
+
+// store results of inclusion in table
+static void record(struct replay_frame *frame)
+{
+	struct replay		*replay;
+	struct replay_symbol	*entry;
+	intval_t		size	= output_get_write_idx() - frame->entry.write_idx;
+	scope_t			local_max,
+				cheap_max;
+	int			ii,
+				count;
+
+	// a symbol may be in the list more than once (if an outer inclusion
+	// touched it before an inner one), but only the first entry holds the
+	// value at start of file: point each symbol to its first entry...
+	for (ii = touched_count - 1; ii >= frame->first_symbol; --ii)
+		touched[ii].symbol->replay_entry = ii;
+	count = 0;
+	for (ii = frame->first_symbol; ii < touched_count; ++ii) {
+		if (touched[ii].symbol->replay_entry == ii)
+			++count;
+	}
+	// ...and replace previous contents of slot
+	replay = replay_slot(&frame->entry);
+	free_slot(replay);
+	replay->entry = frame->entry;
+	replay->symbols = safe_malloc((count ? count : 1) * sizeof(*replay->symbols));
+	for (ii = frame->first_symbol; ii < touched_count; ++ii) {
+		if (touched[ii].symbol->replay_entry != ii)
+			continue;
+
+		entry = &replay->symbols[replay->symbol_count++];
+		*entry = touched[ii];
+		entry->exit = entry->symbol->object;
+		entry->exit_fresh = (entry->symbol->pass == pass.number);
+	}
+	replay->bytes = size ? safe_malloc(size) : NULL;
+	output_read_back(replay->bytes, frame->entry.write_idx, size);
+	replay->size = size;
+	replay->cpu_type = CPU_state.type;
+	replay->a_is_long = CPU_state.a_is_long;
+	replay->xy_are_long = CPU_state.xy_are_long;
+	replay->encoder = encoder_current;
+	replay->local_scope = section_now->local_scope;
+	replay->cheap_scope = section_now->cheap_scope;
+	if (section_now->local_scope != frame->entry.local_scope) {
+		replay->section_type = section_now->type;
+		replay->section_title = safe_malloc(strlen(section_now->title) + 1);
+		strcpy(replay->section_title, section_now->title);
+	}
+	section_get_scope_maxima(&local_max, &cheap_max);
+	replay->local_delta = local_max - frame->entry.local_max;
+	replay->cheap_delta = cheap_max - frame->entry.cheap_max;
+}
+
+
+// end recording inclusion
+void replay_end(struct replay_frame *frame)
+{
+	replay_innermost = frame->outer;
+	// do not record inclusions with undefined results, messages or
+	// unrecorded state changes
+	if (frame->recording
+	&& (pass.undefined_count == frame->undefined_count)
+	&& (pass.needvalue_count == frame->needvalue_count)
+	&& (Throw_get_counter() == frame->throw_count)
+	&& (output_get_xor() == frame->entry.xor)
+	&& state_is_recordable())
+		record(frame);
+	// outer inclusions touched the same symbols, so keep list for them
+	if (replay_innermost == NULL)
+		touched_count = 0;
+}
@@ -0,0 +1,68 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Replay of included source files ("!source") in later passes
+#ifndef replay_H
+#define replay_H
+
+
+#include "config.h"
+#include "input.h"	// for struct filecontents
+
+
+struct symbol;
+
+// state an inclusion depends on (besides symbols)
+struct replay_state {
+	const struct filecontents	*file;
+	enum numtype			pc_ntype;
+	bits				pc_flags;
+	intval_t			pc;
+	int				pc_addr_refs;
+	intval_t			write_idx;
+	const struct cpu_type		*cpu_type;
+	boolean				a_is_long,
+					xy_are_long;
+	const struct encoder		*encoder;
+	char				xor;
+	scope_t				local_scope,	// of current section
+					cheap_scope,
+					local_max,	// highest scope numbers yet
+					cheap_max;
+};
+// info about an inclusion in progress (linked list, innermost first)
+struct replay_frame {
+	struct replay_frame	*outer;
+	boolean			recording;	// FALSE if inclusion cannot be replayed
+	struct replay_state	entry;
+	int			first_symbol;	// index in list of touched symbols
+	int			undefined_count,
+				needvalue_count,
+				throw_count;
+};
+
+
+// Prototypes
+
+// forget recorded inclusions (their symbols are about to be freed)
+extern void replay_clear(void);
+// forget about inclusions in progress (an aborted pass may have left some)
+extern void replay_passinit(void);
+// if the given file was included with the same state and symbol values before,
+// output the same bytes and set the same symbol values again, then return
+// TRUE. otherwise return FALSE, so the file must be parsed.
+extern boolean replay_try(const struct filecontents *file);
+// start recording inclusion of given file
+extern void replay_start(struct replay_frame *frame, const struct filecontents *file);
+// end recording inclusion. if it did not depend on anything that was not
+// recorded, remember its results for later passes.
+extern void replay_end(struct replay_frame *frame);
+// called whenever something changes state that is not recorded (segments,
+// pseudopc, ...), so the current inclusion(s) cannot be replayed
+extern void replay_taint(void);
+// called on symbol access, so the symbol's value becomes part of the entry state
+extern void replay_note_symbol(struct symbol *symbol);
+
+
+#endif
@@ -64,7 +64,23 @@ void section_new_cheap_scope(struct section *section)
 void section_finalize(struct section *section)
 {
 	if (section->allocated)
-		free(section->title);
+		safe_free(section->title);
+}
+
+
+// get highest scope numbers yet
+void section_get_scope_maxima(scope_t *local, scope_t *cheap)
+{
+	*local = local_scope_max;
+	*cheap = cheap_scope_max;
+}
+
+
+// skip scope numbers as if sections had been created
+void section_skip_scopes(scope_t local_delta, scope_t cheap_delta)
+{
+	local_scope_max += local_delta;
+	cheap_scope_max += cheap_delta;
 }
 
 
@@ -32,6 +32,11 @@ extern void section_new_cheap_scope(struct section *section);
 extern void section_passinit(void);
 // tidy up: if necessary, release section title.
 extern void section_finalize(struct section *section);
+// get highest scope numbers yet
+extern void section_get_scope_maxima(scope_t *local, scope_t *cheap);
+// skip scope numbers as if sections had been created (needed when replaying
+// memoized macro expansions, so later scopes keep their numbers)
+extern void section_skip_scopes(scope_t local_delta, scope_t cheap_delta);
 
 
 #endif
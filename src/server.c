@@ -0,0 +1,372 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Server mode (resident assembler answering requests on a local socket)
+//
+// The server keeps running between builds, so the contents of source and
+// include files (re-read only if their modification time or size changed)
+// and the keyword trees do not have to be set up again for each build. The
+// client sends its working directory and its command line arguments, the
+// server runs the request with stdout/stderr redirected to temporary files
+// and finally sends their contents and the exit code.
+//
+// Protocol: the client sends zero-terminated strings (working directory,
+// then the arguments) and shuts down its sending side. The server sends the
+// request's stdout output and then its stderr output, each preceded by its
+// length (four bytes, most significant first), followed by the exit code
+// byte, and closes the connection. A client that does not finish sending its
+// request (or reading the answer) within REQUEST_TIMEOUT seconds is dropped,
+// so it cannot keep the server from answering other requests.
+#include "server.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "config.h"
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#define SERVER_USE_SOCKETS
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+// constants
+#define REQUEST_INITIAL_SIZE	1024
+#define REQUEST_MAX_SIZE	(1024 * 1024)	// larger requests are rejected
+#define OUTPUT_INITIAL_SIZE	4096
+#define LENGTH_SIZE		4	// bytes in front of each output part
+#define COPY_BUFFER_SIZE	4096
+#define DIRECTORY_MAX		4096	// maximum length of working directory
+#define REQUEST_TIMEOUT		5	// seconds a client may take to send or receive
+
+
+#ifdef SERVER_USE_SOCKETS
+
+// complain and exit
+static void no_memory(void)
+{
+	fputs("Error: No memory left.\n", stderr);
+	exit(EXIT_FAILURE);
+}
+
+
+// fill in socket address. returns nonzero if path is too long.
+static int make_address(struct sockaddr_un *address, const char *socket_path)
+{
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(address->sun_path)) {
+		fprintf(stderr, "Error: Socket filename \"%s\" is too long.\n", socket_path);
+		return 1;
+	}
+	strcpy(address->sun_path, socket_path);
+	return 0;
+}
+
+
+// read whole request into buffer (zero-terminated strings). returns number of
+// bytes read, or -1 on error.
+static long read_request(int fd, char **buffer)
+{
+	long	size	= REQUEST_INITIAL_SIZE,
+		used	= 0,
+		got;
+
+	*buffer = malloc(size);
+	if (*buffer == NULL)
+		no_memory();
+	while ((got = read(fd, *buffer + used, size - used)) > 0) {
+		used += got;
+		if (used == size) {
+			if (size == REQUEST_MAX_SIZE)
+				return -1;
+
+			size *= 2;
+			*buffer = realloc(*buffer, size);
+			if (*buffer == NULL)
+				no_memory();
+		}
+	}
+	if (got < 0)
+		return -1;
+
+	return used;
+}
+
+
+// split request into strings. returns number of strings.
+static int split_request(char *buffer, long size, const char ***strings)
+{
+	int	count	= 0,
+		ii;
+	long	pos;
+
+	for (pos = 0; pos < size; ++pos) {
+		if (buffer[pos] == '\0')
+			++count;
+	}
+	*strings = malloc((count + 1) * sizeof(**strings));
+	if (*strings == NULL)
+		no_memory();
+	pos = 0;
+	for (ii = 0; ii < count; ++ii) {
+		(*strings)[ii] = buffer + pos;
+		pos += strlen(buffer + pos) + 1;
+	}
+	(*strings)[count] = NULL;
+	return count;
+}
+
+
+// send length and contents of temporary output file. returns nonzero on error.
+static int send_part(int fd, FILE *part)
+{
+	char		buffer[COPY_BUFFER_SIZE];
+	unsigned long	length;
+	size_t		got;
+	int		ii;
+
+	fflush(part);
+	fseek(part, 0, SEEK_END);
+	length = (unsigned long) ftell(part);
+	rewind(part);
+	for (ii = 0; ii < LENGTH_SIZE; ++ii)
+		buffer[ii] = (char) (length >> (8 * (LENGTH_SIZE - 1 - ii)));
+	if (write(fd, buffer, LENGTH_SIZE) != LENGTH_SIZE)
+		return 1;
+
+	while ((got = fread(buffer, 1, sizeof(buffer), part))) {
+		if (write(fd, buffer, got) != (ssize_t) got)
+			return 1;
+	}
+	return 0;
+}
+
+
+// handle one connection
+static void serve(int fd, const char *program_name, int (*fn)(const char *directory, int argc, const char *argv[]))
+{
+	char		*buffer,
+			exit_byte;
+	const char	**strings,
+			*directory;
+	long		size;
+	FILE		*out_part,
+			*err_part;
+	int		count,
+			saved_stdout,
+			saved_stderr,
+			exit_code	= EXIT_FAILURE;
+
+	size = read_request(fd, &buffer);
+	// request must at least hold working directory and be terminated
+	if ((size < 1) || buffer[size - 1]) {
+		free(buffer);
+		return;
+	}
+	// output is collected in files, so the client can keep stdout and
+	// stderr apart (and a request cannot block on a full socket)
+	out_part = tmpfile();
+	err_part = tmpfile();
+	if ((out_part == NULL) || (err_part == NULL)) {
+		fputs("Error: Cannot create temporary files for request.\n", stderr);
+		if (out_part)
+			fclose(out_part);
+		if (err_part)
+			fclose(err_part);
+		free(buffer);
+		return;	// client will complain about connection being closed
+	}
+	count = split_request(buffer, size, &strings);
+	// redirect all output
+	fflush(stdout);
+	fflush(stderr);
+	saved_stdout = dup(STDOUT_FILENO);
+	saved_stderr = dup(STDERR_FILENO);
+	dup2(fileno(out_part), STDOUT_FILENO);
+	dup2(fileno(err_part), STDERR_FILENO);
+	directory = strings[0];
+	if (chdir(directory)) {
+		fprintf(stderr, "Error: Cannot change to directory \"%s\".\n", directory);
+	} else {
+		// arguments start with program name
+		strings[0] = program_name;
+		exit_code = fn(directory, count, strings);
+	}
+	fflush(stdout);
+	fflush(stderr);
+	dup2(saved_stdout, STDOUT_FILENO);
+	dup2(saved_stderr, STDERR_FILENO);
+	close(saved_stdout);
+	close(saved_stderr);
+	exit_byte = (char) exit_code;
+	if (send_part(fd, out_part)
+	|| send_part(fd, err_part)
+	|| (write(fd, &exit_byte, 1) != 1))
+		fputs("Warning: Could not send output and exit code to client.\n", stderr);
+	fclose(out_part);
+	fclose(err_part);
+	free(strings);
+	free(buffer);
+}
+
+
+// serve requests on given socket until killed
+int server_run(const char *socket_path, const char *program_name, int (*fn)(const char *directory, int argc, const char *argv[]))
+{
+	struct sockaddr_un	address;
+	struct stat		stats;
+	struct timeval		timeout;
+	int			listener,
+				fd;
+
+	if (make_address(&address, socket_path))
+		return EXIT_FAILURE;
+
+	// clients closing the connection early must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) {
+		fputs("Error: Cannot create socket.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	// remove stale socket of earlier server, but never anything else
+	if (lstat(socket_path, &stats) == 0) {
+		if (!S_ISSOCK(stats.st_mode)) {
+			fprintf(stderr, "Error: \"%s\" exists and is not a socket.\n", socket_path);
+			close(listener);
+			return EXIT_FAILURE;
+		}
+		unlink(socket_path);
+	}
+	if (bind(listener, (struct sockaddr *) &address, sizeof(address))
+	|| listen(listener, SOMAXCONN)) {
+		fprintf(stderr, "Error: Cannot listen on socket \"%s\".\n", socket_path);
+		close(listener);
+		return EXIT_FAILURE;
+	}
+	for (;;) {
+		fd = accept(listener, NULL, NULL);
+		if (fd < 0)
+			continue;
+		// server handles one request at a time, so do not wait forever
+		timeout.tv_sec = REQUEST_TIMEOUT;
+		timeout.tv_usec = 0;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		serve(fd, program_name, fn);
+		close(fd);
+	}
+}
+
+
+// get output part from server's answer and write it to given stream.
+// returns nonzero if answer is too short.
+static int take_part(const char *answer, long size, long *pos, FILE *stream)
+{
+	unsigned long	length	= 0;
+	int		ii;
+
+	if (size - *pos < LENGTH_SIZE)
+		return 1;
+
+	for (ii = 0; ii < LENGTH_SIZE; ++ii)
+		length = (length << 8) | (unsigned char) answer[(*pos)++];
+	if ((unsigned long) (size - *pos) < length)
+		return 1;
+
+	fwrite(answer + *pos, 1, length, stream);
+	*pos += (long) length;
+	return 0;
+}
+
+
+// send request to server and show its output
+int server_request(const char *socket_path, int argc, const char *argv[])
+{
+	struct sockaddr_un	address;
+	char			directory[DIRECTORY_MAX],
+				*output		= NULL;
+	long			size		= 0,
+				used		= 0,
+				pos		= 0,
+				got;
+	int			fd,
+				ii;
+
+	if (make_address(&address, socket_path))
+		return EXIT_FAILURE;
+
+	if (getcwd(directory, sizeof(directory)) == NULL) {
+		fputs("Error: Cannot get working directory.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		fputs("Error: Cannot create socket.\n", stderr);
+		return EXIT_FAILURE;
+	}
+	if (connect(fd, (struct sockaddr *) &address, sizeof(address))) {
+		fprintf(stderr, "Error: Cannot connect to server at \"%s\".\n", socket_path);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	// send working directory and arguments, including terminators
+	if (write(fd, directory, strlen(directory) + 1) < 0)
+		goto fail;
+	for (ii = 0; ii < argc; ++ii) {
+		if (write(fd, argv[ii], strlen(argv[ii]) + 1) < 0)
+			goto fail;
+	}
+	shutdown(fd, SHUT_WR);
+	// collect answer (exit code is in last byte)
+	do {
+		if (used == size) {
+			size = size ? 2 * size : OUTPUT_INITIAL_SIZE;
+			output = realloc(output, size);
+			if (output == NULL)
+				no_memory();
+		}
+		got = read(fd, output + used, size - used);
+		if (got > 0)
+			used += got;
+	} while (got > 0);
+	close(fd);
+	if ((used < 2 * LENGTH_SIZE + 1)
+	|| take_part(output, used - 1, &pos, stdout)
+	|| take_part(output, used - 1, &pos, stderr)
+	|| (pos != used - 1)) {
+		fputs("Error: Server closed connection unexpectedly.\n", stderr);
+		free(output);
+		return EXIT_FAILURE;
+	}
+	ii = (unsigned char) output[used - 1];
+	free(output);
+	return ii;
+
+fail:
+	fputs("Error: Cannot send request to server.\n", stderr);
+	close(fd);
+	return EXIT_FAILURE;
+}
+
+#else
+
+// no sockets available
+int server_run(const char *socket_path, const char *program_name, int (*fn)(const char *directory, int argc, const char *argv[]))
+{
+	fputs("Error: Server mode is not supported on this platform.\n", stderr);
+	return EXIT_FAILURE;
+}
+int server_request(const char *socket_path, int argc, const char *argv[])
+{
+	fputs("Error: Server mode is not supported on this platform.\n", stderr);
+	return EXIT_FAILURE;
+}
+
+#endif
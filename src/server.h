@@ -0,0 +1,23 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Server mode (resident assembler answering requests on a local socket)
+#ifndef server_H
+#define server_H
+
+
+// Prototypes
+
+// serve requests on given socket (until killed). For each request, fn is
+// called in the client's working directory with the client's command line
+// arguments (argv[0] is program name) and with its stdout/stderr output
+// going to the client. Its return value is sent to the client as exit code.
+// Only returns on errors (with exit code).
+extern int server_run(const char *socket_path, const char *program_name, int (*fn)(const char *directory, int argc, const char *argv[]));
+// send request (working directory and given arguments) to server, show its
+// output on stdout/stderr and return its exit code.
+extern int server_request(const char *socket_path, int argc, const char *argv[]);
+
+
+#endif
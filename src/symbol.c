@@ -9,25 +9,67 @@
 // 23 Nov 2014	Added label output in VICE format
 #include "symbol.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "acme.h"
 #include "alu.h"
+#include "depgraph.h"
 #include "dynabuf.h"
 #include "global.h"
 #include "input.h"
+#include "macro.h"
 #include "output.h"
 #include "platform.h"
+#include "replay.h"
 #include "section.h"
 #include "tree.h"
 #include "typesystem.h"
 
 
+// Constants
+#define BINDING_TABLE_SIZE	4096	// must be a power of two
+#define SEED_USES_INITIAL_SIZE	64
+#define DOOMED_INITIAL_SIZE	256
+
+
+// binding slot: remembers which symbol a reference at a given position in a
+// stored block (loop or macro body) resolved to, so later runs of the block
+// do not have to search the symbol tree. RAM blocks of loops get freed and
+// re-used, so a hit is only accepted if scope and name match as well.
+struct binding {
+	const char	*site;	// RAM read pointer after symbol name
+	scope_t		scope;
+	struct rwnode	*node;
+};
+
+
+// seed use: remembers which value of the previous build was used for a
+// forward reference, so it can be checked at the end of the pass.
+struct seed_use {
+	struct symbol	*symbol;
+	struct number	*seed;
+};
+
+
 // variables
 struct rwnode	*symbols_forest[256]	= { NULL };	// because of 8-bit hash - must be (at least partially) pre-defined so array will be zeroed!
+static struct binding	binding_table[BINDING_TABLE_SIZE];
+// warm start: values of global symbols from previous build
+static struct rwnode	*seed_forest[256]	= { NULL };
+static boolean		seeds_enabled		= FALSE;
+static struct seed_use	*seed_uses		= NULL;
+static int		seed_use_count		= 0;
+static int		seed_uses_size		= 0;
+// blocks to release when forgetting all symbols (see symbols_clear())
+static void		**doomed		= NULL;
+static int		doomed_count		= 0;
+static int		doomed_size		= 0;
 
 
 // Dump symbol value and flags to dump file
-static void dump_one_symbol(struct rwnode *node, FILE *fd)
+static void dump_one_symbol(struct rwnode *node, void *env)
 {
+	FILE		*fd	= env;
 	struct symbol	*symbol	= node->body;
 
 	// if symbol is neither int nor float, skip
@@ -70,8 +112,9 @@ static void dump_one_symbol(struct rwnode *node, FILE *fd)
 
 
 // output symbols in VICE format (example: "al C:09ae .nmi1")
-static void dump_vice_address(struct rwnode *node, FILE *fd)
+static void dump_vice_address(struct rwnode *node, void *env)
 {
+	FILE		*fd	= env;
 	struct symbol	*symbol	= node->body;
 
 	// dump address symbols even if they are not used
@@ -80,8 +123,9 @@ static void dump_vice_address(struct rwnode *node, FILE *fd)
 	&& (symbol->object.u.number.addr_refs == 1))
 		fprintf(fd, "al C:%04x .%s\n", (unsigned) symbol->object.u.number.val.intval, node->id_string);
 }
-static void dump_vice_usednonaddress(struct rwnode *node, FILE *fd)
+static void dump_vice_usednonaddress(struct rwnode *node, void *env)
 {
+	FILE		*fd	= env;
 	struct symbol	*symbol	= node->body;
 
 	// dump non-addresses that are used
@@ -91,8 +135,9 @@ static void dump_vice_usednonaddress(struct rwnode *node, FILE *fd)
 	&& (symbol->object.u.number.addr_refs != 1))
 		fprintf(fd, "al C:%04x .%s\n", (unsigned) symbol->object.u.number.val.intval, node->id_string);
 }
-static void dump_vice_unusednonaddress(struct rwnode *node, FILE *fd)
+static void dump_vice_unusednonaddress(struct rwnode *node, void *env)
 {
+	FILE		*fd	= env;
 	struct symbol	*symbol	= node->body;
 
 	// dump non-addresses that are unused
@@ -104,19 +149,20 @@ static void dump_vice_unusednonaddress(struct rwnode *node, FILE *fd)
 }
 
 
-// search for symbol. if it does not exist, create with NULL object (CAUTION!).
+// search for symbol node. if it does not exist, create with NULL object (CAUTION!).
 // the symbol name must be held in GlobalDynaBuf.
-struct symbol *symbol_find(scope_t scope)
+static struct rwnode *find_node(scope_t scope)
 {
 	struct rwnode	*node;
 	struct symbol	*symbol;
 	boolean		node_created;
 
+	macro_memo_check_scope(scope);
 	node_created = Tree_hard_scan(&node, symbols_forest, scope, TRUE);
 	// if node has just been created, create symbol as well
 	if (node_created) {
 		// create new symbol structure
-		symbol = safe_malloc(sizeof(*symbol));
+		symbol = tagged_malloc(sizeof(*symbol), MEM_SYMBOLS);
 		node->body = symbol;
 		// finish empty symbol item
 		symbol->object.type = NULL;	// no object yet (CAUTION!)
@@ -124,14 +170,57 @@ struct symbol *symbol_find(scope_t scope)
 		symbol->has_been_read = FALSE;
 		symbol->has_been_reported = FALSE;
 		symbol->pseudopc = NULL;
-	} else {
-		symbol = node->body;
+		symbol->replay_entry = -1;
+		symbol->undefined_read = -1;
+		symbol->dep = NULL;
 	}
-	return symbol;	// now symbol->object.type can be tested to see if this was freshly created.
+	replay_note_symbol(node->body);
+	depgraph_note_node(node, scope);
+	return node;
+}
+
+
+// search for symbol. if it does not exist, create with NULL object (CAUTION!).
+// the symbol name must be held in GlobalDynaBuf.
+struct symbol *symbol_find(scope_t scope)
+{
+	return find_node(scope)->body;	// now symbol->object.type can be tested to see if this was freshly created.
 	// CAUTION: this only works if caller always sets a type pointer after checking! if NULL is kept, the struct still looks new later on...
 }
 
 
+// same as symbol_find(), but when reading from a stored block, remember the
+// result for the current read position and re-use it next time (loops tend
+// to read the same symbol again and again, from the same positions).
+// the name is still compared, because anonymous labels have internal names
+// that depend on counters, so the same position may refer to another symbol.
+struct symbol *symbol_find_bound(scope_t scope)
+{
+	struct binding	*entry;
+	const char	*site;
+
+	if (Input_now->source != INPUTSRC_RAM)
+		return symbol_find(scope);
+
+	site = Input_now->src.ram_ptr;
+	entry = &binding_table[((size_t) site) & (BINDING_TABLE_SIZE - 1)];
+	// hit?
+	if ((entry->site == site)
+	&& (entry->scope == scope)
+	&& (strcmp(entry->node->id_string, GLOBALDYNABUF_CURRENT) == 0)) {
+		macro_memo_check_scope(scope);
+		replay_note_symbol(entry->node->body);
+		return entry->node->body;	// may have been changed by call-by-reference, so do not cache symbol pointer
+	}
+
+	// miss, so search tree and re-bind slot
+	entry->site = site;
+	entry->scope = scope;
+	entry->node = find_node(scope);
+	return entry->node->body;
+}
+
+
 // assign object to symbol. the function acts upon the symbol's flag bits and
 // produces an error if needed.
 // using "power" bits, caller can state which changes are ok.
@@ -213,6 +302,76 @@ void symbol_define(intval_t value)
 }
 
 
+// add block to those to be released
+static void doom(void *block)
+{
+	if (doomed_count == doomed_size) {
+		doomed_size = doomed_size ? 2 * doomed_size : DOOMED_INITIAL_SIZE;
+		doomed = realloc(doomed, doomed_size * sizeof(*doomed));
+		if (doomed == NULL)
+			Throw_serious_error(exception_no_memory_left);
+	}
+	doomed[doomed_count++] = block;
+}
+// add string/list payload of object to blocks to be released
+static void doom_payload(const struct object *object)
+{
+	struct listitem	*item;
+
+	if (object->type == &type_string) {
+		doom(object->u.string);
+	} else if (object->type == &type_list) {
+		doom(object->u.listhead);
+		for (item = object->u.listhead->next; item != object->u.listhead; item = item->next) {
+			doom(item);
+			doom_payload(&item->u.payload);
+		}
+	}
+}
+// add symbol and its payload to blocks to be released (called for each node)
+static void doom_symbol(void *body)
+{
+	struct symbol	*symbol	= body;
+
+	doom(symbol);
+	if (symbol->object.type)
+		doom_payload(&symbol->object);
+}
+// compare block addresses (for sorting)
+static int compare_blocks(const void *a, const void *b)
+{
+	const char	*block_a	= *(void * const *) a,
+			*block_b	= *(void * const *) b;
+
+	return (block_a > block_b) - (block_a < block_b);
+}
+
+
+// forget all symbols (done before assembling another build variant)
+// symbols and their payloads may be referenced more than once (nodes of
+// call-by-reference macro arguments share the caller's symbol, and copies of
+// strings and lists share their contents), so all blocks are collected first
+// and each one is released exactly once.
+void symbols_clear(void)
+{
+	int	ii;
+
+	doomed_count = 0;
+	Tree_free_forest(symbols_forest, doom_symbol);
+	if (doomed_count)
+		qsort(doomed, doomed_count, sizeof(*doomed), compare_blocks);
+	for (ii = 0; ii < doomed_count; ++ii) {
+		if ((ii == 0) || (doomed[ii] != doomed[ii - 1]))
+			safe_free(doomed[ii]);
+	}
+	doomed_count = 0;
+	// bindings and recorded inclusions point to the freed nodes
+	memset(binding_table, 0, sizeof(binding_table));
+	replay_clear();
+	depgraph_clear();
+}
+
+
 // dump global symbols to file
 void symbols_list(FILE *fd)
 {
@@ -236,6 +395,127 @@ void symbols_vicelabels(FILE *fd)
 }
 
 
+// write one global integer symbol to seed file
+static void save_one_seed(struct rwnode *node, void *env)
+{
+	FILE		*fd	= env;
+	struct symbol	*symbol	= node->body;
+
+	if ((symbol->object.type != &type_number)
+	|| (symbol->object.u.number.ntype != NUMTYPE_INT))
+		return;
+
+	fprintf(fd, "%s %ld %u %d\n", node->id_string, (long) symbol->object.u.number.val.intval, symbol->object.u.number.flags, symbol->object.u.number.addr_refs);
+}
+
+
+// read seed file (as written by symbols_save_seeds()), forgetting older seeds.
+// returns number of seeds read.
+int symbols_load_seeds(FILE *fd)
+{
+	struct rwnode	*node;
+	struct number	*seed;
+	long		value;
+	unsigned int	flags;
+	int		addr_refs,
+			byte,
+			count	= 0;
+
+	Tree_free_forest(seed_forest, safe_free);
+	for (;;) {
+		// each line holds name, value, flags and address references
+		DYNABUF_CLEAR(GlobalDynaBuf);
+		while (((byte = getc(fd)) != EOF) && (byte != ' ') && (byte != '\n'))
+			DynaBuf_append(GlobalDynaBuf, byte);
+		if ((byte != ' ')
+		|| (fscanf(fd, "%ld %u %d\n", &value, &flags, &addr_refs) != 3))
+			break;	// end of file (or garbage)
+
+		DynaBuf_append(GlobalDynaBuf, '\0');
+		if (Tree_hard_scan(&node, seed_forest, SCOPE_GLOBAL, TRUE))
+			node->body = tagged_malloc(sizeof(*seed), MEM_SYMBOLS);
+		seed = node->body;
+		seed->ntype = NUMTYPE_INT;
+		seed->flags = flags;
+		seed->val.intval = value;
+		seed->addr_refs = addr_refs;
+		++count;
+	}
+	return count;
+}
+
+
+// write values of global integer symbols to seed file (for next build)
+void symbols_save_seeds(FILE *fd)
+{
+	Tree_dump_forest(symbols_forest, SCOPE_GLOBAL, save_one_seed, fd);
+}
+
+
+// enable or disable use of seeds, and forget about seeds used so far
+void symbols_use_seeds(boolean enable)
+{
+	seeds_enabled = enable;
+	seed_use_count = 0;
+}
+
+
+// if seeds are enabled and there is one for the given global symbol (name
+// held in GlobalDynaBuf), store its value in target and return TRUE.
+// the use is remembered, see symbols_seeds_confirmed().
+boolean symbol_get_seed(struct symbol *symbol, scope_t scope, struct number *target)
+{
+	struct rwnode	*node;
+
+	if ((!seeds_enabled) || (scope != SCOPE_GLOBAL))
+		return FALSE;
+
+	Tree_hard_scan(&node, seed_forest, SCOPE_GLOBAL, FALSE);
+	if (node == NULL)
+		return FALSE;
+
+	*target = *((struct number *) node->body);
+	// a use is only needed once, so skip it if it was the previous one
+	if (seed_use_count && (seed_uses[seed_use_count - 1].symbol == symbol))
+		return TRUE;
+
+	if (seed_use_count == seed_uses_size) {
+		seed_uses_size = seed_uses_size ? 2 * seed_uses_size : SEED_USES_INITIAL_SIZE;
+		seed_uses = realloc(seed_uses, seed_uses_size * sizeof(*seed_uses));
+		if (seed_uses == NULL)
+			Throw_serious_error(exception_no_memory_left);
+	}
+	seed_uses[seed_use_count].symbol = symbol;
+	seed_uses[seed_use_count].seed = node->body;
+	++seed_use_count;
+	return TRUE;
+}
+
+
+// check whether every seed used in this pass has turned out to be correct,
+// i.e. the symbol has got exactly the same value and flags by now.
+boolean symbols_seeds_confirmed(void)
+{
+	struct number	*now,
+			*seed;
+	int		ii;
+
+	for (ii = 0; ii < seed_use_count; ++ii) {
+		if (seed_uses[ii].symbol->object.type != &type_number)
+			return FALSE;
+
+		now = &seed_uses[ii].symbol->object.u.number;
+		seed = seed_uses[ii].seed;
+		if ((now->ntype != NUMTYPE_INT)
+		|| (now->val.intval != seed->val.intval)
+		|| (now->flags != seed->flags)
+		|| (now->addr_refs != seed->addr_refs))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+
 // fix name of anonymous forward label (held in DynaBuf, NOT TERMINATED!) so it
 // references the *next* anonymous forward label definition. The tricky bit is,
 // each name length would need its own counter. But hey, ACME's real quick in
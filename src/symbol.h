@@ -11,12 +11,18 @@
 #include "config.h"
 
 
+struct dep_node;
+
+
 struct symbol {
 	struct object	object;	// number/list/string
 	int		pass;	// pass of creation (for anon counters)
 	boolean		has_been_read;	// to find out if actually used
 	boolean		has_been_reported;	// indicates "has been reported as undefined"
 	struct pseudopc	*pseudopc;	// NULL when defined outside of !pseudopc block
+	int		replay_entry;	// index in list of symbols touched by inclusions (see replay.c)
+	int		undefined_read;	// index in list of undefined reads of current pass (see alu.c)
+	struct dep_node	*dep;	// dependency graph node (see depgraph.c), NULL if none
 	// add file ref + line num of last definition
 };
 
@@ -32,6 +38,9 @@ extern struct rwnode	*symbols_forest[];	// trees (because of 8-bit hash)
 // search for symbol. if it does not exist, create with NULL type object (CAUTION!).
 // the symbol name must be held in GlobalDynaBuf.
 extern struct symbol *symbol_find(scope_t scope);
+// same, but when reading a stored block (loop or macro body), the result is
+// bound to the read position, so the next run of the block skips the search.
+extern struct symbol *symbol_find_bound(scope_t scope);
 // assign object to symbol. function acts upon the symbol's flag bits and
 // produces an error if needed.
 // using "power" bits, caller can state which changes are ok.
@@ -44,10 +53,25 @@ extern void symbol_set_force_bit(struct symbol *symbol, bits force_bit);
 // set global symbol to value, no questions asked (for "-D" switch)
 // name must be held in GlobalDynaBuf.
 extern void symbol_define(intval_t value);
+// forget all symbols (done before assembling another build variant)
+extern void symbols_clear(void);
 // dump global symbols to file
 extern void symbols_list(FILE *fd);
 // dump global labels to file in VICE format
 extern void symbols_vicelabels(FILE *fd);
+// warm start ("--warm-start"): forward references to global symbols use the
+// values of the previous build in the first pass.
+// read seed file, forgetting older seeds. returns number of seeds read.
+extern int symbols_load_seeds(FILE *fd);
+// write values of global integer symbols to seed file (for next build)
+extern void symbols_save_seeds(FILE *fd);
+// enable or disable use of seeds, and forget about seeds used so far
+extern void symbols_use_seeds(boolean enable);
+// if seeds are enabled and there is one for the given global symbol (name
+// held in GlobalDynaBuf), store its value in target and return TRUE.
+extern boolean symbol_get_seed(struct symbol *symbol, scope_t scope, struct number *target);
+// check whether every seed used has turned out to be correct
+extern boolean symbols_seeds_confirmed(void);
 // fix name of anonymous forward label (held in GlobalDynaBuf, NOT TERMINATED!)
 // so it references the *next* anonymous forward label definition.
 extern void symbol_fix_forward_anon_name(boolean increment);
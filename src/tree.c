@@ -4,6 +4,7 @@
 //
 // tree stuff
 #include "tree.h"
+#include <stdlib.h>
 #include "config.h"
 #include "dynabuf.h"
 #include "global.h"
@@ -174,12 +175,13 @@ int Tree_hard_scan(struct rwnode **result, struct rwnode **forest, int id_number
 		return FALSE;	// return FALSE because node was not created
 	}
 	// create new node
-	new_leaf_node = safe_malloc(sizeof(*new_leaf_node));
+	new_leaf_node = tagged_malloc(sizeof(*new_leaf_node), MEM_TREE);
 	new_leaf_node->greater_than = NULL;
 	new_leaf_node->less_than_or_equal = NULL;
 	new_leaf_node->hash_value = wanted.hash_value;
 	new_leaf_node->id_number = id_number;
 	new_leaf_node->id_string = DynaBuf_get_copy(GlobalDynaBuf);	// make permanent copy
+	safe_tag(new_leaf_node->id_string, MEM_TREE);
 	// add new leaf to tree
 	*current_node = new_leaf_node;
 	// store pointer to new node in result location
@@ -189,7 +191,7 @@ int Tree_hard_scan(struct rwnode **result, struct rwnode **forest, int id_number
 
 // Call given function for each object of matching type in the given tree.
 // Calls itself recursively.
-static void dump_tree(struct rwnode *node, int id_number, void (*fn)(struct rwnode *, FILE *), FILE *env)
+static void dump_tree(struct rwnode *node, int id_number, void (*fn)(struct rwnode *, void *), void *env)
 {
 
 	if (node->id_number == id_number)
@@ -200,8 +202,34 @@ static void dump_tree(struct rwnode *node, int id_number, void (*fn)(struct rwno
 		dump_tree(node->less_than_or_equal, id_number, fn, env);
 }
 
+// Free given node and its sub-trees, calling given function for each body.
+// Calls itself recursively.
+static void free_tree(struct rwnode *node, void (*fn)(void *))
+{
+	if (node->greater_than)
+		free_tree(node->greater_than, fn);
+	if (node->less_than_or_equal)
+		free_tree(node->less_than_or_equal, fn);
+	fn(node->body);
+	safe_free(node->id_string);
+	safe_free(node);
+}
+
+// Free all trees of the given tree table, calling given function for each body.
+void Tree_free_forest(struct rwnode **forest, void (*fn)(void *))
+{
+	int	ii;
+
+	for (ii = 0; ii < 256; ++ii) {
+		if (forest[ii]) {
+			free_tree(forest[ii], fn);
+			forest[ii] = NULL;
+		}
+	}
+}
+
 // Call Tree_dump_tree for each non-zero entry of the given tree table.
-void Tree_dump_forest(struct rwnode **forest, int id_number, void (*fn)(struct rwnode *, FILE *), FILE *env)
+void Tree_dump_forest(struct rwnode **forest, int id_number, void (*fn)(struct rwnode *, void *), void *env)
 {
 	int	ii;
 
@@ -52,7 +52,9 @@ extern int Tree_easy_scan(struct ronode *tree, void **node_body, struct dynabuf
 // If "create" is FALSE, store NULL. Returns whether item was created.
 extern int Tree_hard_scan(struct rwnode **result, struct rwnode **forest, int id_number, boolean create);
 // Call given function for each node of each tree of given forest.
-extern void Tree_dump_forest(struct rwnode **, int id_number, void (*)(struct rwnode *, FILE *), FILE *);
+extern void Tree_dump_forest(struct rwnode **, int id_number, void (*)(struct rwnode *, void *), void *);
+// Free all nodes of given forest, calling given function for each body.
+extern void Tree_free_forest(struct rwnode **forest, void (*fn)(void *));
 
 
 #endif
@@ -0,0 +1,117 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Worker threads (for computing independent values in parallel)
+//
+// The callers only read global state in the worker threads, apart from
+// warnings and errors. These are trapped while the threads are running (see
+// global.h), so the caller can redo the work in the main thread to show them.
+// On systems without POSIX threads, all work is done in the main thread.
+#include "workers.h"
+#include "global.h"
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+#define WORKERS_USE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+
+// constants
+#define WORKERS_MAX		16	// more threads hardly help
+#define WORKERS_MIN_ITEMS	64	// fewer items are not worth another thread
+
+
+// range of items for a thread
+struct range {
+	void	(*fn)(void *arg, int first, int end);
+	void	*arg;
+	int	first,
+		end;
+};
+
+
+// variables
+static boolean		trapped;	// messages were trapped while running
+#ifdef WORKERS_USE_THREADS
+static pthread_mutex_t	trap_mutex	= PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+// called instead of outputting a message (from any thread)
+static void trap(void)
+{
+#ifdef WORKERS_USE_THREADS
+	pthread_mutex_lock(&trap_mutex);
+	trapped = TRUE;
+	pthread_mutex_unlock(&trap_mutex);
+#else
+	trapped = TRUE;
+#endif
+}
+
+
+// do range of items
+static void *run_range(void *arg)
+{
+	struct range	*range	= arg;
+
+	range->fn(range->arg, range->first, range->end);
+	return NULL;
+}
+
+
+// get number of ranges to split work into
+static int range_count(int count)
+{
+	int	ranges	= 1;
+#ifdef WORKERS_USE_THREADS
+	long	cpus	= sysconf(_SC_NPROCESSORS_ONLN);
+
+	ranges = count / WORKERS_MIN_ITEMS;
+	if (ranges > cpus)
+		ranges = cpus;
+	if (ranges > WORKERS_MAX)
+		ranges = WORKERS_MAX;
+	if (ranges < 1)
+		ranges = 1;
+#endif
+	return ranges;
+}
+
+
+// call fn for all items, on several threads where possible
+boolean workers_run(int count, void (*fn)(void *arg, int first, int end), void *arg)
+{
+	struct range	ranges[WORKERS_MAX];
+#ifdef WORKERS_USE_THREADS
+	pthread_t	threads[WORKERS_MAX];
+#endif
+	int		range_total	= range_count(count),
+			started		= 1,	// first range is done by this thread
+			ii;
+
+	for (ii = 0; ii < range_total; ++ii) {
+		ranges[ii].fn = fn;
+		ranges[ii].arg = arg;
+		ranges[ii].first = (int) ((long long) count * ii / range_total);
+		ranges[ii].end = (int) ((long long) count * (ii + 1) / range_total);
+	}
+	trapped = FALSE;
+	trap_message = trap;
+#ifdef WORKERS_USE_THREADS
+	for (; started < range_total; ++started) {
+		if (pthread_create(&threads[started], NULL, run_range, &ranges[started]))
+			break;	// no more threads, so do remaining ranges here
+	}
+#endif
+	run_range(&ranges[0]);
+	for (ii = started; ii < range_total; ++ii)
+		run_range(&ranges[ii]);
+#ifdef WORKERS_USE_THREADS
+	for (ii = 1; ii < started; ++ii)
+		pthread_join(threads[ii], NULL);
+#endif
+	trap_message = NULL;
+	return !trapped;
+}
@@ -0,0 +1,23 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Worker threads (for computing independent values in parallel)
+#ifndef workers_H
+#define workers_H
+
+
+#include "config.h"
+
+
+// Prototypes
+
+// call fn for all items from zero to count - 1, split into ranges that are
+// done by several threads where possible. fn must only read global state.
+// Warnings and errors cannot be shown from worker threads, so they are not
+// output at all: if there were any, FALSE is returned and the caller must do
+// the work again the normal way. Otherwise, TRUE is returned.
+extern boolean workers_run(int count, void (*fn)(void *arg, int first, int end), void *arg);
+
+
+#endif
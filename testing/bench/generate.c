@@ -0,0 +1,271 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Benchmark source generator: writes large sources that stress different
+// parts of the assembler. Output only depends on the given scale, so results
+// of different versions can be compared.
+//
+// usage: bench-gen DIRECTORY [PERCENT]
+//
+// straight.a	200k lines of straight code
+// labels.a	50k labels, each referenced before its definition
+// macros.a	library of 1000 macros, plus macros nested 12 levels deep
+// tables.a	"!for" loops building float tables (like examples/trigono.a)
+// lists.a	lists split into low and high bytes (like ACME_Lib/6502/split.a)
+// binary.a	"!binary" includes of a 1 MiB file (written as binary.bin)
+#include <stdio.h>
+#include <stdlib.h>
+
+
+// constants
+#define SEGMENT_SIZE	0x8000	// output is spread over overlay segments of this size
+
+
+// variables
+static const char	*directory;
+static int		percent	= 100;
+static unsigned long	seed;
+
+
+// get scaled count (at least 1)
+static long scaled(long count)
+{
+	count = count * percent / 100;
+	return count ? count : 1;
+}
+
+
+// get next pseudo random number (0..range-1)
+static unsigned int next_random(unsigned int range)
+{
+	seed = (seed * 1103515245 + 12345) & 0x7fffffff;
+	return (seed >> 8) % range;
+}
+
+
+// create file in output directory and restart random numbers
+static FILE *create(const char *name, const char *mode)
+{
+	char	path[1024];
+	FILE	*fd;
+
+	snprintf(path, sizeof(path), "%s/%s", directory, name);
+	fd = fopen(path, mode);
+	if (fd == NULL) {
+		fprintf(stderr, "Error: Cannot create \"%s\".\n", path);
+		exit(EXIT_FAILURE);
+	}
+	seed = 1;
+	return fd;
+}
+
+
+// start new overlay segment
+static void segment(FILE *fd)
+{
+	fputs("\t* = $1000, overlay\n", fd);
+}
+
+
+// straight code: instructions with various addressing modes, a local label
+// every 16 lines and a new segment every 8000 lines
+static void write_straight(void)
+{
+	static const char	*formats[]	= {
+		"\tlda #$%02x\n",
+		"\tsta $%02x\n",
+		"\tadc $%02x,x\n",
+		"\tldx $%02x00\n",
+		"\tsta $%02x00,y\n",
+		"\tand ($%02x),y\n",
+		"\tinc $%02x\n",
+		"\tcmp #%d\n",
+		"\teor $%02x42,x\n",
+		"\tasl\n",
+		"\tnop\n",
+		"\tbne .loop\n",
+	};
+	FILE		*fd	= create("straight.a", "w");
+	long		lines	= scaled(200000),
+			ii;
+	const char	*format;
+
+	fputs(";ACME 0.97\n", fd);
+	for (ii = 0; ii < lines; ++ii) {
+		if (ii % 8000 == 0)
+			segment(fd);
+		if (ii % 16 == 0) {
+			fputs("!zone\n.loop\n", fd);
+		} else {
+			format = formats[next_random(sizeof(formats) / sizeof(*formats))];
+			fprintf(fd, format, next_random(255));	// $ff would make "($ff),y" wrap
+		}
+	}
+	fclose(fd);
+}
+
+
+// labels: each label's code reads a label further down and branches to the
+// next one, so all addresses are only known in the second pass
+static void write_labels(void)
+{
+	FILE	*fd	= create("labels.a", "w");
+	long	labels	= scaled(50000),
+		ii;
+
+	fputs(";ACME 0.97\n", fd);
+	for (ii = 0; ii < labels; ++ii) {
+		if (ii % 5000 == 0)
+			segment(fd);
+		fprintf(fd, "l%ld\tlda l%ld\n", ii, (ii + 1 + next_random(200)) % labels);
+		if ((ii + 1) % 5000 && (ii + 1 < labels))
+			fprintf(fd, "\tbne l%ld\n", ii + 1);
+	}
+	fclose(fd);
+}
+
+
+// macros: a library of macros calling each other, every one of them used,
+// and a chain of macros that each expand the next one twice
+static void write_macros(void)
+{
+	FILE	*fd	= create("macros.a", "w");
+	long	library	= scaled(1000),
+		calls	= scaled(8),
+		ii;
+	int	depth	= 12;
+
+	fputs(";ACME 0.97\n", fd);
+	// library
+	for (ii = 0; ii < library; ++ii) {
+		fprintf(fd, "!macro lib%ld .a, .b {\n", ii);
+		if (ii % 10)
+			fprintf(fd, "\t+lib%ld .b, .a + %u\n", ii - 1, next_random(100));
+		else
+			fputs("\tlda #(.a + .b) & $ff\n", fd);
+		fputs("\tsta .b & $ff\n}\n", fd);
+	}
+	segment(fd);
+	for (ii = 0; ii < library; ++ii)
+		fprintf(fd, "\t+lib%ld %ld, %u\n", ii, ii, next_random(1000));
+	// nested chain
+	fputs("!macro deep0 .v {\n\t!byte .v & $ff\n}\n", fd);
+	for (ii = 1; ii <= depth; ++ii)
+		fprintf(fd, "!macro deep%ld .v {\n\t+deep%ld .v\n\t+deep%ld .v * 3 + %ld\n}\n", ii, ii - 1, ii - 1, ii);
+	for (ii = 0; ii < calls; ++ii) {
+		segment(fd);
+		fprintf(fd, "\t+deep%d %ld\n", depth, ii);
+	}
+	fclose(fd);
+}
+
+
+// tables: float calculations in "!for" loops, one table per segment
+static void write_tables(void)
+{
+	static const char	*expressions[]	= {
+		"sin(float(x) / ENTRIES * PI * 2) * 32767",
+		"cos(float(x) / ENTRIES * PI * 2) * 32767",
+		"tan(float(x) / ENTRIES * PI / 4) * 65535",
+		"arctan(float(x) / ENTRIES * 8) * 20000",
+		"(float(x) / ENTRIES) * (float(x) / ENTRIES) * 65535",
+		"sin(float(x) / ENTRIES * PI) * cos(float(x) / ENTRIES * PI / 2) * 32767",
+	};
+	FILE	*fd	= create("tables.a", "w");
+	int	ii;
+
+	fputs(";ACME 0.97\n", fd);
+	fprintf(fd, "\tPI = 3.14159265358979323846\n\tENTRIES = %ld\n", scaled(SEGMENT_SIZE / 2));
+	for (ii = 0; ii < (int) (sizeof(expressions) / sizeof(*expressions)); ++ii) {
+		segment(fd);
+		fprintf(fd, "\t!for x, 0, ENTRIES - 1 {\n\t\t!16 %s\n\t}\n", expressions[ii]);
+	}
+	fclose(fd);
+}
+
+
+// lists: table entries given as lists, collected in a cache and then split
+// into low and high bytes (the same way ACME_Lib/6502/split.a does it)
+static void write_lists(void)
+{
+	FILE	*fd	= create("lists.a", "w");
+	long	calls	= scaled(1000),
+		ii;
+	int	jj;
+
+	fputs(";ACME 0.97\n"
+		"!set split_cache = []\n"
+		"!macro split_lo @args {\n"
+		"\t+split_putbytes 0, @args\n"
+		"\t!set split_cache = split_cache + @args\n"
+		"}\n"
+		"!macro split_hi {\n"
+		"\t+split_putbytes 8, split_cache\n"
+		"\t!set split_cache = []\n"
+		"}\n"
+		"!macro split_putbytes @shift, @bytes {\n"
+		"\t!if len(@bytes) {\n"
+		"\t\t!for @idx, 0, len(@bytes) - 1 {\n"
+		"\t\t\t!by (@bytes[@idx] >> @shift) & $ff\n"
+		"\t\t}\n"
+		"\t}\n"
+		"}\n", fd);
+	segment(fd);
+	fputs("table_lo\n", fd);
+	for (ii = 0; ii < calls; ++ii) {
+		fputs("\t+split_lo [", fd);
+		for (jj = 0; jj < 16; ++jj)
+			fprintf(fd, "%s$%04x", jj ? ", " : "", next_random(0x10000));
+		fputs("]\n", fd);
+	}
+	fputs("table_hi\n\t+split_hi\n", fd);
+	fclose(fd);
+}
+
+
+// binary: 1 MiB file, included in parts and as a whole (skipping most of it)
+static void write_binary(void)
+{
+	FILE	*fd	= create("binary.bin", "wb");
+	long	size	= scaled(32) * SEGMENT_SIZE,
+		ii;
+
+	for (ii = 0; ii < size; ++ii)
+		fputc(next_random(256), fd);
+	fclose(fd);
+	fd = create("binary.a", "w");
+	fputs(";ACME 0.97\n", fd);
+	for (ii = 0; ii < size; ii += SEGMENT_SIZE) {
+		segment(fd);
+		fprintf(fd, "\t!binary \"binary.bin\", $%x, $%lx\n", SEGMENT_SIZE, ii);
+	}
+	segment(fd);
+	fprintf(fd, "\t!binary \"binary.bin\", , $%lx\n", size - SEGMENT_SIZE);
+	fclose(fd);
+}
+
+
+int main(int argc, const char *argv[])
+{
+	if ((argc < 2) || (argc > 3)) {
+		fputs("Usage: bench-gen DIRECTORY [PERCENT]\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	directory = argv[1];
+	if (argc == 3)
+		percent = atoi(argv[2]);
+	if (percent < 1) {
+		fputs("Error: Percentage must be positive.\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	write_straight();
+	write_labels();
+	write_macros();
+	write_tables();
+	write_lists();
+	write_binary();
+	return EXIT_SUCCESS;
+}
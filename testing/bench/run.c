@@ -0,0 +1,156 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Benchmark runner: assembles each of the given sources (as written by
+// bench-gen) and appends wall time, number of passes and peak resident set
+// size to a CSV file, so results of different versions can be compared.
+//
+// usage: bench-run ACME RESULTS DIRECTORY NAME...
+//
+// "NAME.a" in DIRECTORY is assembled to "NAME.o". The number of passes is
+// taken from the messages ACME shows with "-v2". Exit status is failure if
+// any assembly failed.
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "version.h"
+
+
+// result of one assembly
+struct run {
+	int	exit_code;	// -1 if not run or killed
+	int	passes;
+	double	seconds;
+	long	peak_rss;	// in KiB
+};
+
+
+// get wall clock time in seconds
+static double now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// assemble "NAME.a" in directory and fill in result
+static void assemble(const char *acme, const char *directory, const char *name, struct run *run)
+{
+	char		source[PATH_MAX],
+			output[PATH_MAX],
+			line[256];
+	int		fds[2],
+			status;
+	pid_t		pid;
+	FILE		*messages;
+	struct rusage	usage;
+	double		start;
+
+	run->exit_code = -1;
+	run->passes = 0;
+	run->seconds = 0;
+	run->peak_rss = 0;
+	snprintf(source, sizeof(source), "%s.a", name);
+	snprintf(output, sizeof(output), "%s.o", name);
+	if (pipe(fds)) {
+		perror("pipe");
+		return;
+	}
+
+	start = now();
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		close(fds[0]);
+		close(fds[1]);
+		return;
+	}
+
+	if (pid == 0) {
+		// child: run ACME in directory, with stdout going to pipe
+		close(fds[0]);
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[1]);
+		if (chdir(directory) == 0)
+			execl(acme, acme, "-v2", "-f", "plain", "-o", output, source, (char *) NULL);
+		perror(acme);
+		_exit(127);
+	}
+
+	// parent: count passes while ACME is running
+	close(fds[1]);
+	messages = fdopen(fds[0], "r");
+	while (fgets(line, sizeof(line), messages)) {
+		if ((strcmp(line, "First pass.\n") == 0)
+		|| (strcmp(line, "Further pass.\n") == 0)
+		|| (strcmp(line, "Extra pass needed to find error.\n") == 0))
+			++run->passes;
+	}
+	fclose(messages);
+	if (wait4(pid, &status, 0, &usage) == -1) {
+		perror("wait4");
+		return;
+	}
+
+	run->seconds = now() - start;
+#if defined(__APPLE__)
+	run->peak_rss = usage.ru_maxrss / 1024;	// macOS reports bytes
+#else
+	run->peak_rss = usage.ru_maxrss;
+#endif
+	if (WIFEXITED(status))
+		run->exit_code = WEXITSTATUS(status);
+}
+
+
+int main(int argc, const char *argv[])
+{
+	char		acme[PATH_MAX];
+	FILE		*results;
+	struct run	run;
+	int		ii,
+			failed	= 0;
+
+	if (argc < 5) {
+		fputs("Usage: bench-run ACME RESULTS DIRECTORY NAME...\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	// ACME is run in the source directory, so make its path absolute
+	if (realpath(argv[1], acme) == NULL) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	results = fopen(argv[2], "a");
+	if (results == NULL) {
+		fprintf(stderr, "Error: Cannot open results file \"%s\".\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+
+	// write header if file is new
+	fseek(results, 0, SEEK_END);
+	if (ftell(results) == 0)
+		fputs("version,benchmark,exit_code,passes,seconds,peak_rss_kib\n", results);
+	printf("%-12s%8s%12s%14s\n", "benchmark", "passes", "seconds", "peak RSS KiB");
+	for (ii = 4; ii < argc; ++ii) {
+		assemble(acme, argv[3], argv[ii], &run);
+		fprintf(results, "%s,%s,%d,%d,%.3f,%ld\n", RELEASE, argv[ii], run.exit_code, run.passes, run.seconds, run.peak_rss);
+		fflush(results);
+		printf("%-12s%8d%12.3f%14ld%s\n", argv[ii], run.passes, run.seconds, run.peak_rss, run.exit_code ? "  FAILED" : "");
+		if (run.exit_code)
+			failed = 1;
+	}
+	fclose(results);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
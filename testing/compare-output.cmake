@@ -0,0 +1,63 @@
+# Compare output of a test with an expected file.
+#
+# usage: cmake -DACTUAL=FILE -DEXPECTED=FILE [-DMASK=times|bytes] [-DSORT=ON]
+#              [-DFAILS=ON] -P compare-output.cmake [COMMAND [ARG...]]
+#
+# If a command is given, it is run first (it must succeed) and its standard
+# output is written to ACTUAL. With FAILS, the command must fail instead and
+# its error output is written to ACTUAL. Before comparing, numbers that differ
+# from run to run are replaced by '#' in both files:
+#	times	numbers with a decimal point (timings and percentages)
+#	bytes	all numbers in a line of the "--mem-stats" report but the last
+#		(sizes depend on the platform, the number of allocations does not)
+# SORT sorts the lines first, for reports ordered by time.
+
+# find command (arguments after script name)
+set(command "")
+set(after_script FALSE)
+math(EXPR last "${CMAKE_ARGC} - 1")
+foreach (ii RANGE ${last})
+	if (after_script)
+		list(APPEND command "${CMAKE_ARGV${ii}}")
+	elseif ("${CMAKE_ARGV${ii}}" MATCHES "compare-output\\.cmake$")
+		set(after_script TRUE)
+	endif ()
+endforeach (ii)
+
+if (command AND FAILS)
+	execute_process(COMMAND ${command} ERROR_FILE ${ACTUAL} RESULT_VARIABLE result)
+	if (result EQUAL 0)
+		message(FATAL_ERROR "Command did not fail: ${command}")
+	endif ()
+elseif (command)
+	execute_process(COMMAND ${command} OUTPUT_FILE ${ACTUAL} RESULT_VARIABLE result)
+	if (NOT result EQUAL 0)
+		message(FATAL_ERROR "Command failed (${result}): ${command}")
+	endif ()
+endif ()
+
+# read file and mask numbers
+function (read_masked file target)
+	file(STRINGS ${file} lines)
+	set(masked "")
+	foreach (line IN LISTS lines)
+		if (MASK STREQUAL "times")
+			string(REGEX REPLACE " *[0-9]+\\.[0-9]+" " #" line "${line}")
+		elseif (MASK STREQUAL "bytes")
+			string(REGEX REPLACE "( +[0-9]+)+ +([0-9]+)$" " # \\2" line "${line}")
+		endif ()
+		list(APPEND masked "${line}")
+	endforeach (line)
+	if (SORT)
+		list(SORT masked)
+	endif ()
+	set(${target} "${masked}" PARENT_SCOPE)
+endfunction ()
+
+read_masked(${ACTUAL} actual)
+read_masked(${EXPECTED} expected)
+if (NOT actual STREQUAL expected)
+	string(REPLACE ";" "\n" actual "${actual}")
+	string(REPLACE ";" "\n" expected "${expected}")
+	message(FATAL_ERROR "${ACTUAL} differs from ${EXPECTED}.\nGot:\n${actual}\nExpected:\n${expected}")
+endif ()
@@ -0,0 +1,116 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Test of library interface: assemble in-memory sources several times in one
+// process, including assemblies that are aborted by a serious error (one of
+// them inside a macro call, a loop and an included file) and assemblies that
+// share symbols via call-by-reference macro arguments.
+#include <stdio.h>
+#include <string.h>
+#include "libacme.h"
+
+
+static const char	main_source[]	=
+	"\t* = $1000\n"
+	"\t!source \"inc.a\"\n"
+	"start\tlda #VALUE\n"
+	"\tjmp start\n"
+	"\t!binary \"data.bin\"\n";
+static const char	include_source[]	= "VALUE = $2a\n";
+static const char	byref_source[]	=
+	"\t* = $1000\n"
+	"\t!macro set ~.symbol, .value {\n"
+	"\t\t.symbol = .value\n"
+	"\t}\n"
+	"\t+set ~VALUE, $2a\n"
+	"start\tlda #VALUE\n"
+	"\tjmp start\n"
+	"\t!binary \"data.bin\"\n";
+static const char	data[]	= { 1, 2, 3 };
+static const char	broken_source[]	= "\t!fill\n";	// serious error
+static const char	nested_source[]	=
+	"\t!macro fail ~.counter {\n"
+	"\t\t!for .counter, 1, 3 {\n"
+	"\t\t\t!source \"broken.a\"\n"
+	"\t\t}\n"
+	"\t}\n"
+	"\t+fail ~count\n";
+static const unsigned char	expected[]	= { 0xa9, 0x2a, 0x4c, 0x00, 0x10, 1, 2, 3 };
+static const struct acme_file	files[]	= {
+	{"main.a", main_source, sizeof(main_source) - 1},
+	{"inc.a", include_source, sizeof(include_source) - 1},
+	{"data.bin", data, sizeof(data)},
+	{"broken.a", broken_source, sizeof(broken_source) - 1},
+	{"byref.a", byref_source, sizeof(byref_source) - 1},
+	{"nested.a", nested_source, sizeof(nested_source) - 1},
+};
+
+
+// look up symbol value, return -1 if not found
+static long symbol_value(const struct acme_result *result, const char *name)
+{
+	int	ii;
+
+	for (ii = 0; ii < result->symbol_count; ++ii) {
+		if ((strcmp(result->symbols[ii].name, name) == 0)
+		&& (result->symbols[ii].type == ACME_SYMBOL_INT))
+			return result->symbols[ii].intval;
+	}
+	return -1;
+}
+
+
+// assemble given toplevel source, return number of problems found
+static int check(const char *source, int expect_errors)
+{
+	struct acme_options	options;
+	struct acme_result	result;
+	int			problems	= 0;
+
+	acme_default_options(&options);
+	options.files = files;
+	options.file_count = sizeof(files) / sizeof(*files);
+	options.sources = &source;
+	options.source_count = 1;
+	acme_assemble(&options, &result);
+	if (expect_errors) {
+		if ((result.error_count == 0) || (result.image != NULL) || (strstr(result.messages, "Serious error") == NULL)) {
+			fprintf(stderr, "%s: expected serious error.\n", source);
+			++problems;
+		}
+	} else {
+		if (result.error_count) {
+			fprintf(stderr, "%s: unexpected errors:\n%s", source, result.messages);
+			++problems;
+		} else if ((result.start != 0x1000)
+		|| (result.size != sizeof(expected))
+		|| memcmp(result.image, expected, sizeof(expected))) {
+			fprintf(stderr, "%s: wrong output.\n", source);
+			++problems;
+		}
+		if ((symbol_value(&result, "start") != 0x1000)
+		|| (symbol_value(&result, "VALUE") != 0x2a)) {
+			fprintf(stderr, "%s: wrong symbols.\n", source);
+			++problems;
+		}
+	}
+	acme_free_result(&result);
+	return problems;
+}
+
+
+int main(void)
+{
+	int	problems	= 0;
+
+	problems += check("main.a", 0);
+	problems += check("broken.a", 1);
+	problems += check("main.a", 0);	// state must have been reset
+	problems += check("byref.a", 0);
+	problems += check("byref.a", 0);	// symbols shared by reference must be freed once
+	problems += check("nested.a", 1);
+	problems += check("byref.a", 0);	// unfinished blocks must have been forgotten
+	problems += check("main.a", 0);
+	return problems ? 1 : 0;
+}
@@ -0,0 +1,259 @@
+// ACME - a crossassembler for producing 6502/65c02/65816/65ce02 code.
+// Copyright (C) 1998-2020 Marco Baye
+// Have a look at "acme.c" for further info
+//
+// Test of server mode: starts "acme --server" and sends several requests for
+// serverref.a via "acme --client". Between requests, the file included by
+// serverref.a is rewritten (same size, so the cache must notice the new
+// modification time), and one request stops with a serious error inside a
+// macro call and a loop. The client must keep stdout and stderr apart.
+// Before that, the server must refuse to replace a file that is not a socket,
+// and later a client that never finishes its request must not block others.
+//
+// usage: test-server ACME SOURCE
+//
+// runs in the current directory (socket and output files are created there).
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+
+// constants
+#define SOCKET_NAME	"out-server.sock"
+#define INCLUDE_NAME	"out-server-inc.a"	// (name is used in serverref.a)
+#define OUTPUT_NAME	"out-server.o"
+#define STDOUT_NAME	"out-server-stdout.txt"
+#define STDERR_NAME	"out-server-stderr.txt"
+#define TEXT_MAX	4096
+#define START_TRIES	100	// wait up to 10 seconds for socket to appear
+
+
+// variables
+static char		acme[PATH_MAX];
+static const char	*source;
+
+
+// write file with given contents
+static void write_file(const char *name, const char *contents)
+{
+	FILE	*fd	= fopen(name, "w");
+
+	if (fd == NULL) {
+		fprintf(stderr, "Error: Cannot create \"%s\".\n", name);
+		exit(EXIT_FAILURE);
+	}
+	fputs(contents, fd);
+	fclose(fd);
+}
+
+
+// read file into buffer (zero-terminated), return number of bytes
+static size_t read_file(const char *name, char *buffer)
+{
+	FILE	*fd	= fopen(name, "rb");
+	size_t	size	= 0;
+
+	if (fd) {
+		size = fread(buffer, 1, TEXT_MAX - 1, fd);
+		fclose(fd);
+	}
+	buffer[size] = '\0';
+	return size;
+}
+
+
+// run client with given definition (or NULL) and stdout/stderr redirected
+// to files, return its exit code
+static int request(const char *definition)
+{
+	pid_t	pid;
+	int	status;
+
+	remove(OUTPUT_NAME);
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		if ((freopen(STDOUT_NAME, "w", stdout) == NULL)
+		|| (freopen(STDERR_NAME, "w", stderr) == NULL))
+			_exit(127);
+		if (definition)
+			execl(acme, acme, "--client", SOCKET_NAME, "-v2", "-f", "plain", "-o", OUTPUT_NAME, definition, source, (char *) NULL);
+		else
+			execl(acme, acme, "--client", SOCKET_NAME, "-v2", "-f", "plain", "-o", OUTPUT_NAME, source, (char *) NULL);
+		_exit(127);
+	}
+	if ((waitpid(pid, &status, 0) == -1) || !WIFEXITED(status))
+		return -1;
+
+	return WEXITSTATUS(status);
+}
+
+
+// send request and check exit code, output file and messages.
+// expected_byte is -1 if request is expected to fail.
+// returns number of problems found.
+static int check(const char *value, const char *definition, int expected_byte)
+{
+	char	include[TEXT_MAX],
+		out[TEXT_MAX],
+		err[TEXT_MAX],
+		image[TEXT_MAX],
+		warning[TEXT_MAX];
+	int	exit_code,
+		problems	= 0;
+
+	snprintf(include, sizeof(include), "VALUE = %s\n", value);
+	write_file(INCLUDE_NAME, include);
+	exit_code = request(definition);
+	read_file(STDOUT_NAME, out);
+	read_file(STDERR_NAME, err);
+	if ((exit_code == 0) != (expected_byte != -1)) {
+		fprintf(stderr, "VALUE = %s: unexpected exit code %d.\n", value, exit_code);
+		++problems;
+	}
+	if (expected_byte == -1) {
+		if (strstr(err, "Request stopped on purpose.") == NULL) {
+			fprintf(stderr, "VALUE = %s: serious error not reported.\n", value);
+			++problems;
+		}
+	} else {
+		if ((read_file(OUTPUT_NAME, image) != 1)
+		|| ((unsigned char) image[0] != expected_byte)) {
+			fprintf(stderr, "VALUE = %s: wrong output.\n", value);
+			++problems;
+		}
+		// verbose output goes to stdout, warnings to stderr
+		snprintf(warning, sizeof(warning), "!warn: Value is %s", value);
+		if ((strstr(out, "First pass.") == NULL)
+		|| strstr(out, "Warning")
+		|| (strstr(err, warning) == NULL)
+		|| strstr(err, "First pass.")) {
+			fprintf(stderr, "VALUE = %s: stdout/stderr mixed up:\n%s---\n%s", value, out, err);
+			++problems;
+		}
+	}
+	return problems;
+}
+
+
+// run server on a regular file, which must be left alone.
+// returns number of problems found.
+static int check_no_socket(void)
+{
+	char	contents[TEXT_MAX];
+	pid_t	pid;
+	int	status;
+
+	write_file(SOCKET_NAME, "not a socket\n");
+	pid = fork();
+	if (pid == -1) {
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (pid == 0) {
+		if (freopen(STDERR_NAME, "w", stderr) == NULL)
+			_exit(127);
+		execl(acme, acme, "--server", SOCKET_NAME, (char *) NULL);
+		_exit(127);
+	}
+	if ((waitpid(pid, &status, 0) == -1)
+	|| !WIFEXITED(status)
+	|| (WEXITSTATUS(status) == 0)
+	|| (read_file(SOCKET_NAME, contents) == 0)
+	|| strcmp(contents, "not a socket\n")) {
+		fputs("Server did not refuse to replace regular file.\n", stderr);
+		return 1;
+	}
+	remove(SOCKET_NAME);
+	return 0;
+}
+
+
+// connect and send an unfinished request, return connection
+static int stall(void)
+{
+	struct sockaddr_un	address;
+	int			fd;
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, SOCKET_NAME);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((fd < 0)
+	|| connect(fd, (struct sockaddr *) &address, sizeof(address))
+	|| (write(fd, "/", 1) != 1)) {
+		perror("stalling client");
+		exit(EXIT_FAILURE);
+	}
+	return fd;	// sending side is not shut down
+}
+
+
+int main(int argc, const char *argv[])
+{
+	struct stat	info;
+	pid_t		server;
+	int		ii,
+			stalled,
+			problems	= 0;
+
+	if (argc != 3) {
+		fputs("Usage: test-server ACME SOURCE\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (realpath(argv[1], acme) == NULL) {
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	source = argv[2];
+	remove(SOCKET_NAME);
+	problems += check_no_socket();
+	server = fork();
+	if (server == -1) {
+		perror("fork");
+		return EXIT_FAILURE;
+	}
+	if (server == 0) {
+		execl(acme, acme, "--server", SOCKET_NAME, (char *) NULL);
+		perror(acme);
+		_exit(127);
+	}
+
+	// wait for server to listen
+	for (ii = 0; stat(SOCKET_NAME, &info); ++ii) {
+		if (ii == START_TRIES) {
+			fputs("Error: Server did not start.\n", stderr);
+			kill(server, SIGTERM);
+			return EXIT_FAILURE;
+		}
+		usleep(100000);
+	}
+	usleep(100000);	// socket file is created just before server listens
+
+	problems += check("1", NULL, 1);
+	problems += check("2", NULL, 2);	// same size, rewritten right away
+	problems += check("3", "-DFAIL=1", -1);
+	problems += check("4", NULL, 4);	// unfinished blocks must have been forgotten
+	problems += check("5", "-DFAIL=1", -1);
+	problems += check("6", NULL, 6);
+	stalled = stall();
+	problems += check("7", NULL, 7);	// must be served after timeout
+	close(stalled);
+
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+	remove(SOCKET_NAME);
+	return problems ? EXIT_FAILURE : EXIT_SUCCESS;
+}